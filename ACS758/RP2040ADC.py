@@ -1,4 +1,5 @@
 import array
+import micropython
 import uctypes
 import rp_devices as devs
 from machine import ADC
@@ -76,4 +77,193 @@ class Rp2040AdcDmaAveraging(ADC):
 
         return average
 
+# Free-running acquisition: the ADC converts at its full 500 kSPS into two buffers that DMA fills in turn,
+# and every completed buffer is reduced to mean, min, max and RMS while the other one fills. Nothing is
+# missed between buffers. With several inputs the ADC scans them round-robin in ascending order, one
+# interleaved stream at 500 kSPS in total, and each buffer is reduced per input. Four channels: data A
+# and B alternate, each one chains to a control channel that resets its write address and then starts
+# the other, so the hardware never waits for Python.
+#
+#   A (buffer A) -> ctrl A (A.WRITE_ADDR = buffer A) -> B (buffer B) -> ctrl B -> A ...
+#
+# poll() reduces the buffers DMA has finished, run it in a loop on core 1 with start(background=True),
+# or call it often enough from the main loop (a buffer lasts buffer_samples * 2 us). latest and the peaks
+# are then plain attributes to read, they never block. Same caution about unclaimed DMA channels as above;
+# the default channels are the top four, the SDK hands out the low ones first.
+class Rp2040AdcDmaPingPong(ADC):
+    SAMPLE_RATE = 500000  # ADC clock 48 MHz, 96 cycles per conversion with DIV = 0
+    _CHUNK = 256  # Samples per partial sum of squares, 256 * 4095^2 fits 32 bits
+
+    TEMPERATURE = 4  # ADC input of the on-chip sensor
+
+    # inputs: ADC inputs to scan (0-3 are GPIO26-29, TEMPERATURE the sensor), default the one on gpio_pin.
+    # buffer_samples is rounded down to whole scans.
+    def __init__(self, gpio_pin=26, dma_chans=(8, 9, 10, 11), buffer_samples=2048, inputs=None):
+        super().__init__(gpio_pin)  # initializes ADC and pin/pad
+        self.inputs = tuple(sorted(inputs)) if inputs else (gpio_pin - 26,)
+        for ainsel in self.inputs:
+            if ainsel < self.TEMPERATURE and ainsel != gpio_pin - 26:
+                ADC(26 + ainsel)  # pad of every other GPIO input
+        self._k = len(self.inputs)
+        self._n = buffer_samples // self._k * self._k
+        self._adc_channel = self.inputs[0]
+        self._adc = devs.ADC_DEVICE
+        self._dma = devs.DMA_DEVICE
+        self._chan_nums = dma_chans
+        self._data = (devs.DMA_CHANS[dma_chans[0]], devs.DMA_CHANS[dma_chans[1]])
+        self._ctrl = (devs.DMA_CHANS[dma_chans[2]], devs.DMA_CHANS[dma_chans[3]])
+        self._done_bits = (1 << dma_chans[0], 1 << dma_chans[1])
+
+        self._buffs = (array.array('H', bytearray(2 * self._n)), array.array('H', bytearray(2 * self._n)))
+        self._addrs = (array.array('I', [uctypes.addressof(self._buffs[0])]),
+                       array.array('I', [uctypes.addressof(self._buffs[1])]))
+        scan = self._n // self._k
+        self._sums = array.array('I', bytearray(4 * (3 + (scan + self._CHUNK - 1) // self._CHUNK)))
+
+        self.latest = None  # (sequence, ((mean, min, max, rms) per input)) of the last buffer, in ADC counts
+        self.peak_min = [4095] * self._k  # Per input since reset_peaks()
+        self.peak_max = [0] * self._k
+        self.buffers = 0
+        self.overruns = 0  # Buffers overwritten before poll() got to them
+        self._reset = False
+        self._running = False
+        self._background = False
+
+    def _configure(self):
+        self._adc.FCS.THRESH = 1  # request DMA after every value
+        self._adc.FCS.DREQ_EN = 1  # enable DMA requests
+        self._adc.FCS.ERR = self._adc.FCS.SHIFT = 0
+        self._adc.FCS.EN = 1  # enable FIFO – needed for DMA
+        mask = 0
+        for ainsel in self.inputs:
+            mask |= 1 << ainsel
+        self._adc.CS.TS_EN = 1 if self.TEMPERATURE in self.inputs else 0
+        self._adc.CS.RROBIN = mask if self._k > 1 else 0
+        self._adc.CS.AINSEL = self._adc_channel  # lowest input, the scan goes up from it
+        self._adc.DIV_REG = 0  # full speed ahead
+
+        # CTRL words go to the AL1 alias, writing CTRL_TRIG would start the channel
+        for i in range(2):
+            other = self._chan_nums[1 - i]
+            data, ctrl = self._data[i], self._ctrl[i]
+            data.READ_ADDR_REG = devs.ADC_FIFO_ADDR
+            data.WRITE_ADDR_REG = self._addrs[i][0]
+            data.TRANS_COUNT_REG = self._n
+            data.AL1_CTRL_REG = (devs.DREQ_ADC << 15 | self._chan_nums[2 + i] << 11 |
+                                 1 << 5 | 1 << 2 | 1)  # 16-bit, INCR_WRITE, EN, raises INTR when done
+
+            ctrl.READ_ADDR_REG = uctypes.addressof(self._addrs[i])
+            ctrl.WRITE_ADDR_REG = devs.DMA_BASE + self._chan_nums[i] * devs.DMA_CHAN_WIDTH + 0x04
+            ctrl.TRANS_COUNT_REG = 1
+            ctrl.AL1_CTRL_REG = (1 << 21 | 0x3f << 15 | other << 11 |
+                                 2 << 2 | 1)  # IRQ_QUIET, unpaced, 32-bit, no increments, EN
+        self._dma.INTR = self._done_bits[0] | self._done_bits[1]
+
+    # Discard any data in ADC FIFO
+    def _drain_adc_fifo(self) -> None:
+        while not self._adc.CS.READY:
+            pass
+        while not self._adc.FCS.EMPTY:
+            _ = self._adc.FIFO_REG
+
+    def start(self, background=False) -> None:
+        self._configure()
+        self._drain_adc_fifo()
+        self._running = True
+        self._dma.MULTI_CHAN_TRIGGER = 1 << self._chan_nums[0]
+        self._adc.CS.START_MANY = 1
+        if background and not self._background:
+            import _thread
+            self._background = True
+            _thread.start_new_thread(self._run, ())
+
+    def stop(self) -> None:
+        self._running = False
+        while self._background:  # let core 1 finish its buffer
+            pass
+        self._adc.CS.START_MANY = 0
+        # EN off first, so an abort cannot chain into the next channel
+        mask = 0
+        for chan in self._data + self._ctrl:
+            chan.AL1_CTRL_REG = 0
+        for n in self._chan_nums:
+            mask |= 1 << n
+        self._dma.CHAN_ABORT = mask
+        while self._dma.CHAN_ABORT:
+            pass
+        self._drain_adc_fifo()
+
+    def reset_peaks(self) -> None:
+        self.peak_min, self.peak_max = [4095] * self._k, [0] * self._k
+        self._reset = True  # and again where poll() runs, it may be half way through a buffer
+
+    def _run(self) -> None:
+        while self._running:
+            self.poll()
+        self._background = False
+
+    # Reduce every buffer DMA has finished since the last call
+    def poll(self) -> None:
+        for i in range(2):
+            bit = self._done_bits[i]
+            if not self._dma.INTR & bit:
+                continue
+            self._dma.INTR = bit  # write 1 to clear
+            if self._reset:
+                self._reset = False
+                self.peak_min, self.peak_max = [4095] * self._k, [0] * self._k
+
+            stats = []
+            scan = self._n // self._k
+            sums = self._sums
+            for c in range(self._k):
+                _buffer_sums(self._buffs[i], self._n, sums, self._CHUNK, c, self._k)
+                lo, hi = sums[1], sums[2]
+                square = 0
+                for j in range(3, len(sums)):
+                    square += sums[j]
+                stats.append((sums[0] / scan, lo, hi, (square / scan) ** 0.5))
+                if lo < self.peak_min[c]:
+                    self.peak_min[c] = lo
+                if hi > self.peak_max[c]:
+                    self.peak_max[c] = hi
+
+            # The channel filling this buffer again means it changed while it was summed
+            if self._dma.INTR & bit or self._data[i].CTRL_TRIG.BUSY:
+                self.overruns += 1
+            self.buffers += 1
+            self.latest = (self.buffers, tuple(stats))
+
+
+# Samples first, first + stride, ... below n of a 12 bit buffer into out: sum, min, max, then the sums
+# of squares of chunk samples each. stride 1 for one input, the number of inputs for a round-robin scan.
+@micropython.viper
+def _buffer_sums(buf, n: int, out, chunk: int, first: int, stride: int):
+    src = ptr16(buf)
+    dst = ptr32(out)
+    total = uint(0)
+    lo = 4095
+    hi = 0
+    j = 3
+    i = first
+    while i < n:
+        square = uint(0)
+        end = i + chunk * stride
+        if end > n:
+            end = n
+        while i < end:
+            x = int(src[i])
+            total += uint(x)
+            square += uint(x * x)
+            if x < lo:
+                lo = x
+            if x > hi:
+                hi = x
+            i += stride
+        dst[j] = int(square)
+        j += 1
+    dst[0] = int(total)
+    dst[1] = lo
+    dst[2] = hi
+
 # End
@@ -6,6 +6,7 @@ from picographics import PicoGraphics, DISPLAY_PICO_DISPLAY
 import utime
 from sys import exit
 import gc
+from RP2040ADC import Rp2040AdcDmaPingPong
 
 # Dictionary of scaling factors for ACS758
 # Key: "<current><direction>", where U - uni-directional (1), B - bi-directional (0)
@@ -45,8 +46,20 @@ button_y = Pin(15, Pin.IN, Pin.PULL_UP)
 enable = Pin(22, Pin.OUT)
 enable.value(0)  # Set to low initially
 
-# ADC configuration for current sensor
-sensor_temp = machine.ADC(2)
+# Rails monitored, one ACS758 each: (ADC input, sensor type, label). ADC input n is GPIO 26 + n.
+RAILS = [
+    (2, "100U", "Main"),
+]
+
+# ADC configuration for current sensors: the rails and the temperature sensor scanned round-robin,
+# free-running at 500 kSPS in total into two DMA buffers
+CAPTURE_DEPTH = 2048  # Samples per DMA buffer, 4.1 ms at 500 kSPS
+acquisition = Rp2040AdcDmaPingPong(
+    gpio_pin=26 + RAILS[0][0],
+    buffer_samples=CAPTURE_DEPTH,
+    inputs=[rail[0] for rail in RAILS] + [Rp2040AdcDmaPingPong.TEMPERATURE],
+)
+TEMP_INDEX = acquisition.inputs.index(Rp2040AdcDmaPingPong.TEMPERATURE)
 power_ACS758 = 5.0
 R1 = 1600
 R2 = 3200
@@ -55,21 +68,16 @@ Divider = R2 / (R1 + R2)  # Voltage divider ratio
 # Set up the RGB LED
 led = RGBLED(6, 7, 8)
 
-conversion_factor = 3.3 / (65535)
-
-# DMA settings for fast scanning
-CAPTURE_DEPTH = 1000  # Capture depth for 50µs signal
-SAMPLE_BUFFER_SIZE = CAPTURE_DEPTH
-SAMPLING_RATE_HZ = 500000
+conversion_factor = 3.3 / 4095  # 12-bit ADC counts to volts
 
 current_value = 0.0
 max_current = 0.0
+rail_currents = [0.0] * len(RAILS)  # RMS per rail
+temperature = 0.0
 button_y_state = False  # Track the state of button_y (True for STOP, False for START)
 state_error = False  # Track if the state is in error
 sampling_active = False
 
-capture_buffer = []
-
 
 def current_to_color(current):
     if current < 0.1:
@@ -97,53 +105,48 @@ def calculate_current(adc_value, sensor_type, power_ACS758, divider=1.0):
         current = -1 * current
     return current
 
-filter_buffer = []
-
-def filter_adc_value(new_value, window=5):
-    global filter_buffer
-    filter_buffer.append(new_value)
-    if len(filter_buffer) > window:
-        filter_buffer.pop(0)
-    return sum(filter_buffer) / len(filter_buffer)
-
-def capture_current():
-    """Function for capturing current with maximum scanning speed"""
-    global capture_buffer, current_value, max_current, Divider, power_ACS758
-
-    capture_buffer.clear()
-    gc.collect()  
 
-    start_time = utime.ticks_us()
-    for _ in range(SAMPLE_BUFFER_SIZE):
-        raw = sensor_temp.read_u16() * conversion_factor
-        capture_buffer.append(raw)
-    end_time = utime.ticks_us()
+def current_coefficients(sensor_type, power_ACS758, divider=1.0):
+    """calculate_current of ADC counts as counts * gain - offset, worked out once per rail"""
+    params = ACS758[sensor_type]
+    if power_ACS758 == 3.3:
+        offset = params["offset3"] * divider
+        scale = params["scale3"] * divider
+    else:
+        offset = params["offset"] * divider
+        scale = params["scale"] * divider
+    return conversion_factor * scale / 1000, offset * scale / 1000
 
-    # for raw in capture_buffer:
-    #     filtered_value = filter_adc_value(raw)
-    #     filter_buffer.append(filtered_value)
 
-    if capture_buffer:
-        max_raw = max(capture_buffer)
-        max_current_sample = calculate_current(max_raw, "100U", power_ACS758, Divider)
+# Per rail: index in the scan, gain, offset
+RAIL_SCAN = [
+    (acquisition.inputs.index(ainsel),) + current_coefficients(sensor, power_ACS758, Divider)
+    for ainsel, sensor, _ in RAILS
+]
 
-        if max_current_sample > max_current:
-            max_current = max_current_sample
+def capture_current():
+    """Take the figures of the latest DMA buffer for every rail, never waits"""
+    global current_value, max_current, temperature
 
-        sum_of_squares = 0
-        for raw_value in capture_buffer:
-            sum_of_squares += raw_value**2
+    latest = acquisition.latest
+    if latest is None:
+        return 0
+    _, stats = latest
 
-        # RMS = sqrt(average of squared values)
-        if len(capture_buffer) > 0:
-            current_value = (sum_of_squares / len(capture_buffer)) ** 0.5
-            current_value = calculate_current(current_value, "100U", power_ACS758, Divider)
+    # RMS and peak of the raw voltage, then scaled to current with the rail's coefficients
+    for rail, (index, gain, offset) in enumerate(RAIL_SCAN):
+        rail_currents[rail] = abs(stats[index][3] * gain - offset)
+    current_value = rail_currents[0]
+    index, gain, offset = RAIL_SCAN[0]
+    max_current_sample = abs(acquisition.peak_max[index] * gain - offset)
+    if max_current_sample > max_current:
+        max_current = max_current_sample
 
-    # Calculate actual sampling rate
-    capture_duration = utime.ticks_diff(end_time, start_time) / 1000000
-    actual_rate = SAMPLE_BUFFER_SIZE / capture_duration if capture_duration > 0 else 0
+    # RP2040 datasheet 4.9.5: 0.706 V at 27 C, -1.721 mV/C
+    temperature = 27 - (stats[TEMP_INDEX][0] * conversion_factor - 0.706) / 0.001721
 
-    return actual_rate
+    # The DMA keeps up with the ADC, overruns only mean a buffer was summed late
+    return acquisition.SAMPLE_RATE
 
 
 def update_display():
@@ -168,6 +171,13 @@ def update_display():
     status_text = "RUNNING" if button_y_state else "STOPPED"
     display.text(f"Status: {status_text}", 10, 80, WIDTH, 2)
 
+    # Temperature and the other rails
+    display.set_pen(YELLOW)
+    display.text(f"{temperature:.0f}C", WIDTH - 50, 80, WIDTH, 2)
+    others = "  ".join(f"{RAILS[r][2]} {rail_currents[r]:.1f}" for r in range(1, len(RAILS)))
+    if others:
+        display.text(others, 10, 98, WIDTH, 1)
+
     # Error information, if any
     if state_error:
         display.set_pen(RED)
@@ -195,6 +205,10 @@ def read_buttons():
         utime.sleep_ms(200)  # Debounce
         button_y_state = not button_y_state  # Toggle state
         enable.value(1 if button_y_state else 0)  # Enable/disable signal
+        if button_y_state:
+            acquisition.start(background=True)  # Buffers are reduced on core 1
+        else:
+            acquisition.stop()
         state_error = False  # Reset error on state change
 
     # Button B - reset maximum value (changed from B to A)
@@ -202,6 +216,7 @@ def read_buttons():
         utime.sleep_ms(200)  # Debounce
         max_current = 0.0  # Reset maximum value
         current_value = 0.0
+        acquisition.reset_peaks()
 
 
 # Main program loop
@@ -214,11 +229,13 @@ try:
 
         if button_y_state:
             actual_rate = capture_current()
-            # print(f"Actual sampling rate: {actual_rate:.2f} Hz")
+            # print(f"Sampling rate: {actual_rate} Hz, buffers: {acquisition.buffers}, overruns: {acquisition.overruns}")
         update_display()
         utime.sleep_ms(1)
 
 except KeyboardInterrupt:
     print("Program terminated.")
     enable.value(0)  # Disable signal on exit
+    if button_y_state:
+        acquisition.stop()
     raise SystemExit
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+// Драйвер LTC6912 (сдвоенный PGA) на USI ATtiny85 и движок последовательности усилений.
+//
+// По умолчанию (LTC6912_USI = 0) выводы платы как были: SS PB1, SCK PB2, MOSI PB0,
+// программный SPI.
+//
+// С LTC6912_USI = 1 (build_flags в platformio.ini) слово уходит через USI в трёхпроводном
+// режиме за 16 записей USICR, около 5 мкс на запись вместе с CS вместо ~200 мкс. Выводы USI
+// фиксированы, DIN и CS меняются местами, плату надо перепаять:
+//   PB1 (DO)   -> DIN LTC6912   (было SS)
+//   PB2 (USCK) -> SCK LTC6912
+//   PB0        -> CS/LD LTC6912 (было MOSI, программный)
+// LTC6912 защёлкивает данные по фронту SCK, USI работает в MODE0 (SCK в покое низкий).
+//
+// Последовательность: таблица слов LTC6912 перебирается по кругу, шаг по таймеру Timer1
+// (Timer0 занят millis) или по фронту на PB4 (PCINT4). Запись идёт из прерывания, loop()
+// свободен.
+
+#ifndef LTC6912_USI
+#define LTC6912_USI 0
+#endif
+
+// Самый короткий шаг по таймеру: прерывание целиком, вход с сохранением регистров,
+// sequence_step, запись слова и выход. Оценка по тактам, с запасом.
+#if LTC6912_USI
+#define LTC6912_STEP_CYCLES 200  // ~170: вход и выход ~80, запись ~55
+#else
+#define LTC6912_STEP_CYCLES 2000 // ~1850: 27 digitalWrite и 16 мкс delayMicroseconds
+#endif
+#define GAIN_SEQUENCE_MIN_STEP_US \
+  ((LTC6912_STEP_CYCLES + F_CPU / 1000000UL - 1) / (F_CPU / 1000000UL)) // 25 / 250 при 8 МГц
+
+#define LTC6912_TRIGGER_PIN PB4 // Внешний запуск шага последовательности
+
+// Коды усиления LTC6912-1 для одного канала
+enum LTC6912Gain : uint8_t {
+  LTC6912_GAIN_0   = 0, // Вход отключён
+  LTC6912_GAIN_1   = 1,
+  LTC6912_GAIN_2   = 2,
+  LTC6912_GAIN_5   = 3,
+  LTC6912_GAIN_10  = 4,
+  LTC6912_GAIN_20  = 5,
+  LTC6912_GAIN_50  = 6,
+  LTC6912_GAIN_100 = 7,
+};
+
+// Слово LTC6912: канал B в старшей тетраде, канал A в младшей
+constexpr uint8_t ltc6912_word(uint8_t gain_a, uint8_t gain_b) {
+  return (uint8_t)((gain_b << 4) | (gain_a & 0x0F));
+}
+
+void ltc6912_begin();
+void ltc6912_write(uint8_t word); // Можно вызывать и при работающей последовательности
+
+// Таблица остаётся у вызывающего и должна жить, пока идёт последовательность
+void gain_sequence_set(const uint8_t *table, uint8_t length);
+// Шаг каждые step_us мкс, от GAIN_SEQUENCE_MIN_STEP_US до ~524000 при 8 МГц. false, если
+// период вне диапазона: короче прерывание не успевает, и шаги наезжают друг на друга.
+bool gain_sequence_run_timer(uint32_t step_us);
+// Шаг по каждому фронту на LTC6912_TRIGGER_PIN
+void gain_sequence_run_trigger();
+void gain_sequence_stop();
+uint8_t gain_sequence_position();   // Индекс последнего записанного слова
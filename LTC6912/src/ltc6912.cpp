@@ -0,0 +1,149 @@
+#include "ltc6912.h"
+#include <Arduino.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#if LTC6912_USI
+#define LTC6912_CS PB0
+#else
+#define LTC6912_CS   PB1 // Программный SS, также используется для LED
+#define LTC6912_SCK  PB2
+#define LTC6912_MOSI PB0
+#endif
+
+static const uint8_t *volatile sequence_table  = nullptr;
+static volatile uint8_t        sequence_length = 0;
+static volatile uint8_t        sequence_pos    = 0;
+
+#if LTC6912_USI
+// Один байт через USI, MSB первым. Каждая запись USICR переключает USCK (USITC), вторая
+// из пары ещё и сдвигает USIDR (USICLK): фронт защёлкивает бит в LTC6912, спад выводит
+// следующий.
+static inline void usi_transfer(uint8_t data) {
+  const uint8_t rise = _BV(USIWM0) | _BV(USITC);
+  const uint8_t fall = _BV(USIWM0) | _BV(USITC) | _BV(USICLK);
+
+  USIDR = data;
+  for (uint8_t i = 0; i < 8; i++) {
+    USICR = rise;
+    USICR = fall;
+  }
+}
+#else
+static void software_transfer(uint8_t data) {
+  digitalWrite(LTC6912_SCK, HIGH); // MODE3, SCK в покое высокий
+  for (int i = 7; i >= 0; i--) {
+    digitalWrite(LTC6912_SCK, LOW);
+    digitalWrite(LTC6912_MOSI, (data >> i) & 0x01);
+    delayMicroseconds(1);
+    digitalWrite(LTC6912_SCK, HIGH); // LTC6912 читает бит по фронту
+    delayMicroseconds(1);
+  }
+}
+#endif
+
+void ltc6912_begin() {
+#if LTC6912_USI
+  DDRB |= _BV(LTC6912_CS) | _BV(PB1) | _BV(PB2); // CS, DO, USCK
+  PORTB |= _BV(LTC6912_CS);
+  PORTB &= ~_BV(PB2); // MODE0
+  USICR = _BV(USIWM0); // Трёхпроводный режим, такт от USITC
+#else
+  pinMode(LTC6912_SCK, OUTPUT);
+  pinMode(LTC6912_MOSI, OUTPUT);
+  pinMode(LTC6912_CS, OUTPUT);
+  digitalWrite(LTC6912_CS, HIGH);
+#endif
+}
+
+void ltc6912_write(uint8_t word) {
+  uint8_t sreg = SREG;
+  cli(); // Прерывание последовательности тоже пишет
+
+#if LTC6912_USI
+  PORTB &= ~_BV(LTC6912_CS);
+  usi_transfer(word);
+  PORTB |= _BV(LTC6912_CS); // Слово защёлкивается по фронту CS/LD
+#else
+  digitalWrite(LTC6912_CS, LOW);
+  software_transfer(word);
+  digitalWrite(LTC6912_CS, HIGH);
+#endif
+
+  SREG = sreg;
+}
+
+// Из прерываний: следующее слово таблицы
+static void sequence_step() {
+  const uint8_t *table = sequence_table;
+  if (!table || sequence_length == 0)
+    return;
+
+  uint8_t pos = sequence_pos + 1;
+  if (pos >= sequence_length)
+    pos = 0;
+  sequence_pos = pos;
+  ltc6912_write(table[pos]);
+}
+
+void gain_sequence_set(const uint8_t *table, uint8_t length) {
+  uint8_t sreg = SREG;
+  cli();
+  sequence_table  = table;
+  sequence_length = length;
+  sequence_pos    = length ? length - 1 : 0; // Первый шаг запишет table[0]
+  SREG = sreg;
+}
+
+bool gain_sequence_run_timer(uint32_t step_us) {
+  if (step_us < GAIN_SEQUENCE_MIN_STEP_US)
+    return false;
+
+  // Timer1 в режиме CTC до OCR1C, делитель 2^(CS1-1): наименьший, при котором период
+  // умещается в 256 тактов
+  uint32_t ticks = step_us * (F_CPU / 1000000UL);
+  uint8_t  cs    = 1;
+  while (ticks > 256 && cs < 15) {
+    ticks = (ticks + 1) >> 1;
+    cs++;
+  }
+  if (ticks == 0 || ticks > 256)
+    return false;
+
+  gain_sequence_stop();
+  TCNT1  = 0;
+  OCR1C  = (uint8_t)(ticks - 1);
+  OCR1A  = (uint8_t)(ticks - 1);
+  TCCR1  = _BV(CTC1) | cs;
+  TIFR  = _BV(OCF1A);
+  TIMSK |= _BV(OCIE1A);
+  return true;
+}
+
+void gain_sequence_run_trigger() {
+  gain_sequence_stop();
+  DDRB &= ~_BV(LTC6912_TRIGGER_PIN);
+  PCMSK |= _BV(LTC6912_TRIGGER_PIN);
+  GIFR  = _BV(PCIF);
+  GIMSK |= _BV(PCIE);
+}
+
+void gain_sequence_stop() {
+  TIMSK &= ~_BV(OCIE1A);
+  TCCR1 = 0;
+  PCMSK &= ~_BV(LTC6912_TRIGGER_PIN);
+}
+
+uint8_t gain_sequence_position() {
+  return sequence_pos;
+}
+
+ISR(TIMER1_COMPA_vect) {
+  sequence_step();
+}
+
+// Любое изменение PB4, шаг только по фронту
+ISR(PCINT0_vect) {
+  if (PINB & _BV(LTC6912_TRIGGER_PIN))
+    sequence_step();
+}
@@ -1,51 +1,43 @@
 #include <Arduino.h>
-
-int ss = PB1; // Программный SS (Slave Select), также используется для LED
-int sck = PB2; // Программный SCK
-int mosi = PB0; // Программный MOSI
-
-enum SPIMode {
-  MODE0, // CPOL = 0, CPHA = 0
-  MODE1, // CPOL = 0, CPHA = 1
-  MODE2, // CPOL = 1, CPHA = 0
-  MODE3  // CPOL = 1, CPHA = 1
+#include "ltc6912.h"
+
+// Выводы LTC6912: без флагов сборки как на плате (SS PB1, SCK PB2, MOSI PB0). Флаг
+// -DLTC6912_USI=1 включает USI и МЕНЯЕТ ПРОВОДКУ: DIN на PB1, CS/LD на PB0 (ltc6912.h).
+
+// Шаг последовательности: период в мкс, 0 - по внешнему фронту на PB4
+#define GAIN_STEP_US 100000UL
+
+// Усиление обоих каналов от 1 до 100 и обратно
+static const uint8_t gain_table[] = {
+    ltc6912_word(LTC6912_GAIN_1, LTC6912_GAIN_1),
+    ltc6912_word(LTC6912_GAIN_2, LTC6912_GAIN_2),
+    ltc6912_word(LTC6912_GAIN_5, LTC6912_GAIN_5),
+    ltc6912_word(LTC6912_GAIN_10, LTC6912_GAIN_10),
+    ltc6912_word(LTC6912_GAIN_20, LTC6912_GAIN_20),
+    ltc6912_word(LTC6912_GAIN_50, LTC6912_GAIN_50),
+    ltc6912_word(LTC6912_GAIN_100, LTC6912_GAIN_100),
+    ltc6912_word(LTC6912_GAIN_50, LTC6912_GAIN_50),
+    ltc6912_word(LTC6912_GAIN_20, LTC6912_GAIN_20),
+    ltc6912_word(LTC6912_GAIN_10, LTC6912_GAIN_10),
+    ltc6912_word(LTC6912_GAIN_5, LTC6912_GAIN_5),
+    ltc6912_word(LTC6912_GAIN_2, LTC6912_GAIN_2),
 };
 
-void softwareSPITransfer(uint8_t data, SPIMode mode) {
-  bool cpol = (mode == MODE2 || mode == MODE3); // Полярность тактового сигнала
-  bool cpha = (mode == MODE1 || mode == MODE3); // Фаза тактового сигнала
-
-  digitalWrite(ss, LOW); // Активируем устройство (и включаем LED)
-  digitalWrite(sck, cpol); // Устанавливаем начальное состояние SCK
-
-  for (int i = 7; i >= 0; i--) {
-    if (!cpha) {
-      digitalWrite(mosi, (data >> i) & 0x01); // Устанавливаем бит на MOSI
-    }
-    digitalWrite(sck, !cpol); // Подаем тактовый сигнал
-    delayMicroseconds(1); // Небольшая задержка
-    if (cpha) {
-      digitalWrite(mosi, (data >> i) & 0x01); // Устанавливаем бит на MOSI
-    }
-    digitalWrite(sck, cpol); // Завершаем тактовый сигнал
-    delayMicroseconds(1); // Небольшая задержка
-  }
-
-  digitalWrite(ss, HIGH); // Деактивируем устройство (и выключаем LED)
-}
-
 // the setup routine runs once when you press reset:
 void setup() {
-  // initialize the digital pin as an output.
-  // pinMode(led, OUTPUT);
-  pinMode(sck, OUTPUT); // Настройка SCK как выход
-  pinMode(mosi, OUTPUT); // Настройка MOSI как выход
-  pinMode(ss, OUTPUT); // Настройка SS как выход
-  digitalWrite(ss, HIGH); // Устанавливаем SS в неактивное состояние (LED выключен)
+  ltc6912_begin();
+  ltc6912_write(ltc6912_word(LTC6912_GAIN_1, LTC6912_GAIN_1)); // 0x11, усиление 1 в обоих каналах
+
+  gain_sequence_set(gain_table, sizeof(gain_table));
+#if GAIN_STEP_US
+  gain_sequence_run_timer(GAIN_STEP_US);
+#else
+  gain_sequence_run_trigger();
+#endif
 }
 
 // the loop routine runs over and over again forever:
 void loop() {
-    softwareSPITransfer(0x11, MODE3); // Отправка данных 0x11 через программный SPI в режиме MODE3
-    delay(1000);
+  // Последовательность идёт из прерываний, здесь можно менять таблицу или писать
+  // ltc6912_write() напрямую по уровню сигнала
 }
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pulse pattern sequencer on TCC0: the DMAC copies one table entry into PERB and CCB[0..2]
+// on every TCC0 overflow, and the TCC takes the buffered values at the overflow after that.
+// Each entry is therefore one period of the output on PA18 (WO[2]), its pulse width the
+// CCB[2] value, with no CPU involved. A table can repeat forever (burst patterns, a fixed
+// frequency) or run once (a PPM frame). TCC0 repeats whatever it was given last, so a single
+// run is closed by one more entry of the final period with pulse width 0: the output stays
+// low afterwards.
+//
+// One linked DMAC descriptor per entry. The entries stay with the caller and can be
+// rewritten while the sequencer runs, a new value takes effect two periods later. The DMAC
+// needs about a microsecond per entry, tcc_sequencer_start refuses periods below
+// TCC_SEQ_MIN_PERIOD ticks; entries rewritten later have to keep to it as well.
+//
+// The DMAC is reset and owned by this module, nothing else may use it.
+
+#define TCC_SEQ_MAX_ENTRIES 64
+#define TCC_SEQ_DMA_CHANNEL 0
+#define TCC_SEQ_MIN_PERIOD  64 // 1.3 us at 48 MHz
+
+typedef struct {
+  uint32_t perb;   // Period - 1 in GCLK4 ticks, 24 bits
+  uint32_t ccb[3]; // Compare values, ccb[2] is the pulse width on WO[2]; 0 and 1 go to unused outputs
+} tcc_seq_entry_t;
+
+static inline tcc_seq_entry_t tcc_seq_entry(uint32_t period_ticks, uint32_t pulse_ticks) {
+  return tcc_seq_entry_t{period_ticks - 1, {0, 0, pulse_ticks}};
+}
+
+// Stream entries[0..count) into TCC0, once or in a loop. TCC0 must already be running.
+// False if count is 0 or above TCC_SEQ_MAX_ENTRIES, or a period is below TCC_SEQ_MIN_PERIOD
+// or above 24 bits.
+bool tcc_sequencer_start(const tcc_seq_entry_t *entries, uint32_t count, bool repeat);
+void tcc_sequencer_stop(); // TCC0 keeps repeating the entry it has
+// False once a single run has queued its closing entry, its last entry is on the output then
+bool tcc_sequencer_busy();
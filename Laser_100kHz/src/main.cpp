@@ -1,10 +1,25 @@
 #include <Arduino.h>
+#include "tcc_sequencer.h"
+
+// 1 streams pattern[] into TCC0 through the DMAC, 0 keeps the fixed 100 kHz output
+#define USE_SEQUENCER 1
 
 // Number to count to with PWM (TOP value). Frequency can be calculated by
 // freq = GCLK4_freq / (TCC0_prescaler * (1 + TOP_value))
 // With TOP of 479, we get a 100 kHz square wave in this example
 uint32_t period = 480 - 1;
 
+#if USE_SEQUENCER
+// Burst of four 100 ns pulses at 100 kHz, then 60 us off: one entry per output period.
+// Lives in RAM, loop() or an ISR may rewrite entries while the DMAC runs.
+static tcc_seq_entry_t pattern[] = {
+    tcc_seq_entry(480, 5),
+    tcc_seq_entry(480, 5),
+    tcc_seq_entry(480, 5),
+    tcc_seq_entry(2880, 5),
+};
+#endif
+
 void setup() {
 
   // Because we are using TCC0, limit period to 24 bits
@@ -66,8 +81,13 @@ void setup() {
   TCC0->CTRLA.reg |= (TCC_CTRLA_ENABLE);
   while (TCC0->SYNCBUSY.bit.ENABLE)
     ; // Wait for synchronization
+
+#if USE_SEQUENCER
+  // From the next overflow on, every period comes from pattern[]
+  tcc_sequencer_start(pattern, sizeof(pattern) / sizeof(pattern[0]), true);
+#endif
 }
 
 void loop() {
-  // Do nothing
-}
\ No newline at end of file
+  // Do nothing, the sequencer runs from the DMAC
+}
@@ -0,0 +1,89 @@
+#include "tcc_sequencer.h"
+#include <Arduino.h>
+
+// First descriptor of each channel and its write-back, at BASEADDR and WRBADDR
+__attribute__((aligned(16))) static DmacDescriptor base_descriptor[TCC_SEQ_DMA_CHANNEL + 1];
+__attribute__((aligned(16))) static DmacDescriptor write_back[TCC_SEQ_DMA_CHANNEL + 1];
+// One descriptor per entry, linked in order (and back to the first when repeating), plus
+// the one closing a single run
+__attribute__((aligned(16))) static DmacDescriptor links[TCC_SEQ_MAX_ENTRIES + 1];
+
+// Closing entry of a single run: the last period again, no pulse
+static tcc_seq_entry_t last_entry;
+
+static bool dmac_ready = false;
+
+static void dmac_init() {
+  PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+  PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+  DMAC->CTRL.bit.DMAENABLE = 0;
+  DMAC->CTRL.bit.SWRST     = 1;
+  while (DMAC->CTRL.bit.SWRST)
+    ;
+
+  DMAC->BASEADDR.reg = (uint32_t)base_descriptor;
+  DMAC->WRBADDR.reg  = (uint32_t)write_back;
+  DMAC->CTRL.reg     = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+  dmac_ready         = true;
+}
+
+void tcc_sequencer_stop() {
+  if (!dmac_ready)
+    return;
+
+  DMAC->CHID.reg = DMAC_CHID_ID(TCC_SEQ_DMA_CHANNEL);
+  DMAC->CHCTRLA.bit.ENABLE = 0;
+  while (DMAC->CHCTRLA.bit.ENABLE)
+    ;
+}
+
+bool tcc_sequencer_start(const tcc_seq_entry_t *entries, uint32_t count, bool repeat) {
+  if (count == 0 || count > TCC_SEQ_MAX_ENTRIES)
+    return false;
+  for (uint32_t i = 0; i < count; i++) {
+    if (entries[i].perb + 1 < TCC_SEQ_MIN_PERIOD || entries[i].perb > 0x00ffffff)
+      return false;
+  }
+  if (!dmac_ready)
+    dmac_init();
+  tcc_sequencer_stop();
+
+  // PERB, CCB[0], CCB[1], CCB[2] are consecutive words: one block of four beats per
+  // entry. Addresses with increment point past the end of the block.
+  const uint32_t beats = sizeof(tcc_seq_entry_t) / sizeof(uint32_t);
+  const uint32_t dst   = (uint32_t)&TCC0->PERB.reg + sizeof(tcc_seq_entry_t);
+  const uint32_t total = repeat ? count : count + 1;
+
+  last_entry        = entries[count - 1];
+  last_entry.ccb[2] = 0;
+
+  for (uint32_t i = 0; i < total; i++) {
+    const tcc_seq_entry_t *src = i < count ? &entries[i] : &last_entry;
+    DmacDescriptor        *d   = &links[i];
+    d->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BLOCKACT_NOACT | DMAC_BTCTRL_BEATSIZE_WORD |
+                    DMAC_BTCTRL_SRCINC | DMAC_BTCTRL_DSTINC;
+    d->BTCNT.reg    = beats;
+    d->SRCADDR.reg  = (uint32_t)src + sizeof(tcc_seq_entry_t);
+    d->DSTADDR.reg  = dst;
+    d->DESCADDR.reg = i + 1 < total ? (uint32_t)&links[i + 1] : (repeat ? (uint32_t)&links[0] : 0);
+  }
+  memcpy(&base_descriptor[TCC_SEQ_DMA_CHANNEL], &links[0], sizeof(DmacDescriptor));
+
+  // Each TCC0 overflow moves one block. CTRLA.DMAOS is 0, so every overflow requests.
+  DMAC->CHID.reg    = DMAC_CHID_ID(TCC_SEQ_DMA_CHANNEL);
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+  while (DMAC->CHCTRLA.bit.SWRST)
+    ;
+  DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) | DMAC_CHCTRLB_TRIGSRC(TCC0_DMAC_ID_OVF) | DMAC_CHCTRLB_TRIGACT_BLOCK;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+  return true;
+}
+
+bool tcc_sequencer_busy() {
+  if (!dmac_ready)
+    return false;
+
+  DMAC->CHID.reg = DMAC_CHID_ID(TCC_SEQ_DMA_CHANNEL);
+  return DMAC->CHCTRLA.bit.ENABLE;
+}
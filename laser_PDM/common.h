@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/pio.h"
 #include "pico/multicore.h"
 #include "pico/stdlib.h"
@@ -13,31 +14,56 @@
 #include "hardware/timer.h"
 #include "tusb.h"
 
+#include "pdm_decimator.h"
+#include "pdm_modulator.h"
+#include "ppm_link.h"
+#include "ppm_realtime.h"
+#include "ppm_telemetry.h"
+#include "ppm_timing.h"
+#include "ppm_trace.h"
+#include "spsc_ring.h"
+
 // Include generated header files with PIO programs
-#include "ppm.pio.h"
+#include "pdm.pio.h"
 
 #define PULSE_GEN_PIN 0
 #define PULSE_DET_PIN 1
+#define PDM_IN_PIN    PULSE_DET_PIN    // Photodiode
 #define LED_PIN       25
 
-// #define SYS_FREQ 133000
-#define SYS_FREQ 250000
+// Clock profile at boot and while the bus is active, and while it is suspended
+// (ppm_common/ppm_timing.h). Both ends of the link need the same one.
+#define SYS_FREQ_RUN  250000
+#define SYS_FREQ_IDLE 133000
 
-#if SYS_FREQ == 133000
-#define MIN_TACKT 5
-#elif SYS_FREQ == 250000
-#define MIN_TACKT 8
-#endif
+// Timing of the active profile
+#define SYS_FREQ            (ppm_timing.sys_khz)
+#define MIN_TACKT           (ppm_timing.min_tackt)
+#define PIO_FREQ            (ppm_timing.pio_freq)
+#define MIN_INTERVAL_CYCLES (ppm_timing.min_interval_cycles)
 
 #define MAX_CODE          1024
 #define MIN_PULSE_PERIOD  3.0f
 #define AUDIO_SAMPLE_RATE 48000
 
+// DMA receive ring, a ppm_link capture ring of PDM words decimated by pdm_rx_task
+#define RX_DMA_RING_BITS   10                             // 1024 words = 4 KB, 10.7 ms at 48 kHz
+#define RX_DMA_RING_SIZE   (1u << RX_DMA_RING_BITS)
+#define PDM_RX_CHUNK_WORDS 64                             // Words decimated per step
+
+// Received PCM, one sample per word, pdm_rx_task (core1) -> mic_task (core0)
+#define MIC_RING_SIZE 1024    // 21 ms at 48 kHz
+
 // Конфигурация
-#define LASER_PIN 2
-#define PDM_FREQ 3072000  // 3.072 MHz для 48kHz PCM
-#define CHANNELS 2
-#define BUFFER_SIZE 512
+#define LASER_PIN        2
+#define PDM_OSR          PDM_MOD_OSR                       // PDM bits per PCM sample
+#define PDM_FREQ         (AUDIO_SAMPLE_RATE * PDM_OSR)      // 3.072 MHz для 48kHz PCM
+#define CHANNELS         2
+#define BUFFER_SIZE      64                                // PCM samples per block, 1.33 ms at 48 kHz
+#define PDM_BUFFER_WORDS (BUFFER_SIZE * PDM_OSR / 32)
+
+// Measure the modulator at boot and print cycles per sample over UART
+// #define PDM_BENCHMARK
 
 /* Blink pattern
  * - 25 ms   : streaming data
@@ -70,31 +96,47 @@ enum
 };
 
 static const float MIN_PULSE_PERIOD_US = MIN_PULSE_PERIOD / 2;
-static const float PIO_FREQ            = SYS_FREQ * 1000.0f;
-
-static const uint16_t MIN_INTERVAL_CYCLES =
-    MIN_PULSE_PERIOD_US * (SYS_FREQ / 1000);
 
 // Main function signatures
-void first_core_main(void);     // Function for Core0 (receiver)
-void second_core_main(void);    // Function for Core1 (transmitter + interface)
+void first_core_main(void);     // Function for Core0 (USB)
+void second_core_main(void);    // Function for Core1 (PDM receiver + PDM modulator)
 
-// Statistics structure
+void setup_pdm_system(void);
+void pdm_task(void);
+void pdm_set_sample_rate(uint32_t sample_rate);
+void pdm_set_enabled(bool enabled);
+void pdm_rx_set_sample_rate(uint32_t sample_rate);
+
+extern uint32_t current_sample_rate;
+
+// Telemetry counters, streamed by statistics_task (ppm_common/ppm_telemetry.h).
+// Every field has a single writer, the core in brackets.
 typedef struct {
-    uint32_t total_pcm_received;
-    uint32_t total_ppm_convert;
-    uint32_t total_pcm_convert;
-    uint32_t total_ppm_sent;
-    uint32_t total_ppm_received;
-    uint32_t total_sent;
-    uint32_t total_received;
-    uint64_t total_summed_ppm_out;    // Sum of all PPM values at output
-    uint64_t total_summed_ppm_in;     // Sum of all PPM values at input
-    uint64_t total_summed_ppm_in_usb; // Sum of all PPM values after reception, before USB transmission
-    uint64_t total_ticks_attempt_send_to_usb;
-    uint64_t total_bytes_sent_to_usb;
+    // Throughput, free running
+    uint32_t total_pcm_received;         // [0] Speaker frames taken from the USB OUT FIFO
+    uint32_t total_pcm_blocks;           // [0] PCM blocks handed to pdm_task
+    uint32_t total_pcm_convert;          // [1] PCM blocks modulated
+    uint32_t total_pdm_sent;             // [1] PDM buffers written, silence included
+    uint32_t total_pdm_played;           // [1] PDM buffers the DMA started on fresh
+    uint32_t total_pdm_received;         // [1] PDM words taken from the RX DMA ring
+    uint32_t total_received;             // [1] PCM samples decimated into mic_ring
+    uint64_t total_bytes_sent_to_usb;    // [0] Microphone bytes handed to the IN endpoint
+    // Losses besides the underruns in audio_buffers and the rings' own counters
+    uint32_t rx_overruns;    // [1] Words overwritten before pdm_rx_task got to them
+    // Queue depths
+    ppm_tm_level_t usb_out_level;       // [0] Speaker frames in the USB OUT FIFO
+    ppm_tm_level_t rx_backlog_level;    // [1] Words in the RX DMA ring not decimated yet
+    ppm_tm_level_t mic_ring_level;      // [1] Samples
+    // Stage latencies
+    ppm_tm_probe_t spk_probe;     // [0 -> 1] First sample of a block out of the USB OUT FIFO -> block modulated
+    ppm_tm_probe_t pdm_probe;     // [1 -> 1] Block modulated -> the DMA starts playing its buffer
+    ppm_tm_probe_t mic_probe;     // [1 -> 0] Decimated into mic_ring -> written to the USB IN FIFO
+    ppm_tm_hist_t  core0_loop;    // [0] USB loop period
+    ppm_tm_hist_t  core1_loop;    // [1] Receiver and modulator loop period
 } statistics_t;
 
+#define TELEMETRY_PERIOD_MS 500    // Snapshot interval on the CDC telemetry interface
+
 // Structure for speaker double buffering
 typedef struct {
     uint16_t          ppm_buffer[(CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ / 4) / 2];    // Buffer for ready PPM values
@@ -126,24 +168,24 @@ typedef struct {
 // extern core_shared_buffer_t shared_ppm_data;
 // extern volatile bool        sem_initialized;
 
+// USB (core0) -> pcm_buffer_a/b -> modulator (core1) -> pdm_buffer_a/b -> DMA -> PIO
 typedef struct {
-    uint16_t pcm_buffer_a[BUFFER_SIZE];
-    uint16_t pcm_buffer_b[BUFFER_SIZE];
-    uint32_t pdm_buffer_a[BUFFER_SIZE/32];
-    uint32_t pdm_buffer_b[BUFFER_SIZE/32];
-    volatile bool pcm_buffer_switch;
-    volatile bool pdm_buffer_switch;
-    volatile bool pcm_ready;
-    volatile bool pdm_ready;
+    // Aligned to their size for the DMA read rings
+    uint32_t          pdm_buffer_a[PDM_BUFFER_WORDS] __attribute__((aligned(PDM_BUFFER_WORDS * sizeof(uint32_t))));
+    uint32_t          pdm_buffer_b[PDM_BUFFER_WORDS] __attribute__((aligned(PDM_BUFFER_WORDS * sizeof(uint32_t))));
+    int16_t           pcm_buffer_a[BUFFER_SIZE];
+    int16_t           pcm_buffer_b[BUFFER_SIZE];
+    volatile bool     pcm_ready[2];         // Block filled by spk_task, cleared once modulated
+    volatile bool     pdm_buffer_switch;    // PDM buffer the DMA is playing: false = a, true = b
+    volatile bool     pdm_ready;            // The other PDM buffer is free to refill
+    volatile uint32_t pcm_underruns;        // Blocks modulated from silence
+    volatile uint32_t pdm_underruns;        // Buffers replayed because pdm_task was late
 } audio_buffers_t;
 
-// Дельта-сигма модулятор второго порядка
-typedef struct {
-    int32_t integrator1;
-    int32_t integrator2;
-    int32_t prev_output;
-} delta_sigma_t;
+extern audio_buffers_t audio_buffers;
 
-delta_sigma_t ds_modulator = {0};
+extern spsc_ring_t  mic_ring;
+extern uint32_t     mic_ring_buffer[MIC_RING_SIZE];
+extern statistics_t statistics;
 
 
@@ -0,0 +1,173 @@
+#include "pdm_decimator.h"
+#include "pico/platform.h"
+#include <string.h>
+
+#define PDM_DEC_FIR_HALF  (PDM_DEC_FIR_TAPS / 2)
+
+// Output LSB in stage C accumulator units; the dither takes two such fields from one LCG word
+#define PDM_DEC_DITHER_BITS (PDM_DEC_FIR_SHIFT - 1)
+#define PDM_DEC_DITHER_MASK ((1u << PDM_DEC_DITHER_BITS) - 1)
+
+_Static_assert(PDM_DEC_OSR == 8 * PDM_DEC_CIC_R * 2, "stages do not multiply up to PDM_DEC_OSR");
+_Static_assert(32 - 2 * PDM_DEC_DITHER_BITS >= 6, "dither fields overlap or reach the weak low LCG bits");
+
+// Stage C, first half and centre of a symmetric response, DC gain 1 << PDM_DEC_FIR_SHIFT.
+// Least squares fit over 0..20 kHz to the inverse droop of stages A and B and of the
+// transmitter's linear interpolation, weight 100 on 28..48 kHz. Sum of |taps| < 2^16,
+// so the accumulator cannot overflow on the top 16 bits of the inputs. Kept in RAM with the code using it.
+static const int16_t __not_in_flash("pdm_dec") pdm_dec_fir[PDM_DEC_FIR_HALF + 1] = {
+    -11, -13, 27, 42, -48, -96, 75, 188, -105, -331, 131, 544, -143,
+    -852, 121, 1291, -25, -1927, -237, 2888, 932, -4440, -3108, 6801, 12976};
+
+// Stage A: pdm_dec_sinc[k][byte] is the contribution of a byte k bytes old, taps built at init
+static uint16_t pdm_dec_sinc[4][256];
+static bool     pdm_dec_sinc_ready = false;
+
+static void pdm_dec_build_sinc(void) {
+    uint32_t taps[32] = {1};
+    uint32_t len      = 1;
+
+    // Convolve a box of 8 ones with itself four times
+    for (int order = 0; order < 4; order++) {
+        uint32_t next[32] = {0};
+        for (uint32_t i = 0; i < len; i++) {
+            for (uint32_t j = 0; j < 8; j++) {
+                next[i + j] += taps[i];
+            }
+        }
+        len += 7;
+        memcpy(taps, next, sizeof(taps));
+    }
+
+    // Bit j of a byte k bytes old is 8k + j bits old, the LSB being the later bit
+    for (uint32_t k = 0; k < 4; k++) {
+        for (uint32_t byte = 0; byte < 256; byte++) {
+            uint32_t sum = 0;
+            for (uint32_t j = 0; j < 8; j++) {
+                if (byte & (1u << j))
+                    sum += taps[8 * k + j];
+            }
+            pdm_dec_sinc[k][byte] = (uint16_t)sum;
+        }
+    }
+    pdm_dec_sinc_ready = true;
+}
+
+void pdm_decimator_init(pdm_decimator_t *dec) {
+    if (!pdm_dec_sinc_ready)
+        pdm_dec_build_sinc();
+
+    memset(dec, 0, sizeof(*dec));
+}
+
+// One TPDF dither draw, -1..+1 output LSB with zero mean: the difference of two uniform
+// fields from disjoint bits at the top of the LCG word
+static inline int32_t pdm_dec_dither(uint32_t *state) {
+    uint32_t r = *state * 1664525u + 1013904223u;
+    *state     = r;
+    return (int32_t)(r >> (32 - PDM_DEC_DITHER_BITS)) -
+           (int32_t)((r >> (32 - 2 * PDM_DEC_DITHER_BITS)) & PDM_DEC_DITHER_MASK);
+}
+
+// Stage C input at 96 kHz, 20 bit signed, returns true with *out set on every second call.
+// The 20 x 16 bit products need 36 bits: the taps run once over the top 16 bits and once over
+// the low 4, and the sums are put together after the low one is scaled down.
+static inline bool pdm_dec_fir_push(pdm_decimator_t *dec, int32_t x, int16_t *out) {
+    uint32_t pos = dec->fir_pos;
+
+    dec->fir[pos]                    = x;
+    dec->fir[pos + PDM_DEC_FIR_TAPS] = x;
+    dec->fir_pos                     = pos + 1 == PDM_DEC_FIR_TAPS ? 0 : pos + 1;
+
+    dec->fir_odd = !dec->fir_odd;
+    if (dec->fir_odd)
+        return false;
+
+    // Oldest sample first, taps folded on the symmetry
+    const int32_t *w      = &dec->fir[dec->fir_pos];
+    int32_t        centre = w[PDM_DEC_FIR_HALF];
+    int32_t        acc    = pdm_dec_fir[PDM_DEC_FIR_HALF] * (centre >> PDM_DEC_FIR_LOW_BITS);
+    int32_t        low    = pdm_dec_fir[PDM_DEC_FIR_HALF] * (centre & PDM_DEC_FIR_LOW_MASK);
+    for (uint32_t k = 0; k < PDM_DEC_FIR_HALF; k++) {
+        int32_t pair = w[k] + w[PDM_DEC_FIR_TAPS - 1 - k];
+        acc += pdm_dec_fir[k] * (pair >> PDM_DEC_FIR_LOW_BITS);
+        low += pdm_dec_fir[k] * (pair & PDM_DEC_FIR_LOW_MASK);
+    }
+    acc += low >> PDM_DEC_FIR_LOW_BITS;
+
+    // Requantise to 16 bits with rounding and +-1 LSB TPDF dither instead of truncating
+    acc += (1 << PDM_DEC_DITHER_BITS) / 2 + pdm_dec_dither(&dec->dither);
+
+    // One bit less than the tap format: x2 for the modulator's -6 dB
+    acc >>= PDM_DEC_FIR_SHIFT - 1;
+    if (acc > INT16_MAX)
+        acc = INT16_MAX;
+    if (acc < INT16_MIN)
+        acc = INT16_MIN;
+    *out = (int16_t)acc;
+    return true;
+}
+
+uint32_t __not_in_flash_func(pdm_decimator_run)(pdm_decimator_t *dec, const uint32_t *pdm, uint32_t words, int16_t *pcm) {
+    uint32_t history = dec->history;
+    uint32_t i0      = dec->integrator[0];
+    uint32_t i1      = dec->integrator[1];
+    uint32_t i2      = dec->integrator[2];
+    uint32_t i3      = dec->integrator[3];
+    uint32_t phase   = dec->phase;
+    uint32_t samples = 0;
+
+    for (uint32_t w = 0; w < words; w++) {
+        uint32_t word = pdm[w];
+
+        for (int byte = 0; byte < 4; byte++) {
+            // Stage A: the MSB byte went out first
+            history = (history << 8) | (word >> 24);
+            word <<= 8;
+
+            uint32_t a = (uint32_t)pdm_dec_sinc[0][history & 0xFF] + pdm_dec_sinc[1][(history >> 8) & 0xFF] +
+                         pdm_dec_sinc[2][(history >> 16) & 0xFF] + pdm_dec_sinc[3][history >> 24];
+
+            // Stage B
+            i0 += a;
+            i1 += i0;
+            i2 += i1;
+            i3 += i2;
+            if (++phase < PDM_DEC_CIC_R)
+                continue;
+            phase = 0;
+
+            uint32_t y = i3;
+            for (int k = 0; k < 4; k++) {
+                uint32_t t   = y - dec->comb[k];
+                dec->comb[k] = y;
+                y            = t;
+            }
+
+            // 0 .. 2^20 for density 0 .. 1, centred, all 20 bits kept
+            int32_t x = (int32_t)y - (1 << 19);
+            if (pdm_dec_fir_push(dec, x, &pcm[samples]))
+                samples++;
+        }
+    }
+
+    dec->history       = history;
+    dec->integrator[0] = i0;
+    dec->integrator[1] = i1;
+    dec->integrator[2] = i2;
+    dec->integrator[3] = i3;
+    dec->phase         = phase;
+    return samples;
+}
+
+int32_t pdm_decimator_dither_mean(uint32_t count) {
+    uint32_t state = 0;
+    int64_t  sum   = 0;
+
+    if (count == 0)
+        return 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        sum += pdm_dec_dither(&state);
+    return (int32_t)(sum * 1024 / ((int64_t)count << PDM_DEC_DITHER_BITS));
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// PDM -> PCM decimator, 64x in three stages:
+//
+//   A  (sinc8)^4 FIR on the bit stream, one output per byte (-> 384 kHz). Evaluated as
+//      four 256 entry tables indexed by the last four bytes, no per-bit work.
+//   B  4th order CIC, R = 4 (-> 96 kHz).
+//   C  49 tap linear phase FIR, decimating by 2 (-> 48 kHz). Besides A and B it makes up
+//      for the droop of pdm_modulator's linear interpolation, 5.6 dB at 20 kHz.
+//
+// All three with the interpolation: flat to 20 kHz within 0.04 dB, -62 dB at 28 kHz, at
+// least 70 dB down from 30 kHz and 75 dB from 40 kHz. The weak spot is B's decimation,
+// where 76 kHz folds onto 20 kHz only 41 dB down (47 dB from the CIC, less C's 7.8 dB
+// lift at 20 kHz).
+//
+// Bits arrive MSB first in 32 bit words, as laser_pdm_out sends them. The output gain
+// undoes the -6 dB input scaling of pdm_modulator, a full scale 1/0 density is clamped.
+// Stage C keeps all 20 bits of stage B and rounds to 16 bits once, with TPDF dither.
+// Host loopback through pdm_modulator, 997 Hz: THD+N over 20 Hz..20 kHz about 76 dB below
+// a -6 dBFS tone, noise floor about -88 dBFS.
+
+#define PDM_DEC_OSR          64
+#define PDM_DEC_CIC_R        4
+#define PDM_DEC_FIR_TAPS     49
+#define PDM_DEC_FIR_SHIFT    14    // Q format of the stage C taps
+#define PDM_DEC_FIR_LOW_BITS 4     // Stage C input bits below the 16 the taps take in one pass
+#define PDM_DEC_FIR_LOW_MASK ((1 << PDM_DEC_FIR_LOW_BITS) - 1)
+
+typedef struct {
+    uint32_t history;                           // Last four PDM bytes, newest in the low byte
+    uint32_t integrator[4];                     // Stage B, wraps by design
+    uint32_t comb[4];
+    uint32_t phase;                             // Stage A outputs into the current stage B output
+    int32_t  fir[2 * PDM_DEC_FIR_TAPS];         // Stage C delay line, written twice so the window never wraps
+    uint32_t fir_pos;
+    bool     fir_odd;                           // Next stage C input completes an output sample
+    uint32_t dither;                            // LCG state for the output TPDF dither
+} pdm_decimator_t;
+
+void pdm_decimator_init(pdm_decimator_t *dec);
+
+// Decimate words PDM words, returns the number of samples written to pcm (words / 2 once
+// the stages are in step)
+uint32_t pdm_decimator_run(pdm_decimator_t *dec, const uint32_t *pdm, uint32_t words, int16_t *pcm);
+
+// Mean of count output dither draws from a fresh state, in 1/1024 output LSB. Should stay
+// near zero, a bias here is a DC offset on every received sample.
+int32_t pdm_decimator_dither_mean(uint32_t count);
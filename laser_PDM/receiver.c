@@ -1,10 +1,16 @@
 #include "common.h"
-#include "pico/sem.h"
 #include <pico/stdlib.h>
 
 static PIO           pio = pio0;
-static uint          sm_det;
-static volatile bool detector_running = false;
+static uint          sm_pdm_in;
+static volatile bool pdm_rx_running = false;
+
+// PDM words are streamed by DMA from the sampler RX FIFO into this ring
+static uint32_t           rx_dma_ring[RX_DMA_RING_SIZE] __attribute__((aligned(RX_DMA_RING_SIZE * sizeof(uint32_t))));
+static ppm_link_capture_t rx_capture;    // consumed counts words here
+static bool               rx_dma_ready = false;
+
+static pdm_decimator_t rx_decimator PPM_RT_CORE1_DATA;
 
 // extern statistics_t statistics;
 
@@ -77,57 +83,147 @@ static volatile bool detector_running = false;
 //     }
 // }
 
-void update_measurements() {
-    while (detector_running && !pio_sm_is_rx_fifo_empty(pio, sm_det)) {
-        uint32_t measured_width  = pio_sm_get(pio, sm_det);
-        uint32_t corrected_width = (measured_width + MIN_TACKT) - MIN_INTERVAL_CYCLES;
+// Decimate whatever the DMA has written since the last call and pass the PCM to mic_task
+void PPM_RT_FUNC(pdm_rx_task)() {
+    if (!pdm_rx_running) {
+        return;
+    }
+
+    uint32_t written = ppm_link_capture_written(&rx_capture);
 
-        if (corrected_width > 0 && corrected_width <= MAX_CODE) {
-            if (multicore_fifo_wready()) {
-                multicore_fifo_push_blocking(corrected_width);
-            }
+    // Consumer fell a whole ring behind, skip to the oldest word still intact
+    uint32_t skipped = ppm_link_capture_skip(&rx_capture, written);
+    if (skipped) {
+        statistics.rx_overruns += skipped;
+        ppm_trace(PPM_TRACE_RX_OVERRUN, skipped, 0);
+    }
+    ppm_tm_level_set(&statistics.rx_backlog_level, written - rx_capture.consumed);
+    statistics.total_pdm_received += written - rx_capture.consumed;
+
+    while (rx_capture.consumed != written) {
+        uint32_t index = rx_capture.consumed & rx_capture.mask;
+        uint32_t words = written - rx_capture.consumed;
+        if (words > RX_DMA_RING_SIZE - index)
+            words = RX_DMA_RING_SIZE - index;
+        if (words > PDM_RX_CHUNK_WORDS)
+            words = PDM_RX_CHUNK_WORDS;
+
+        // One more than words / 2, the decimator may be half a sample ahead
+        int16_t  pcm[PDM_RX_CHUNK_WORDS / 2 + 1];
+        uint32_t samples[PDM_RX_CHUNK_WORDS / 2 + 1];
+        uint32_t n = pdm_decimator_run(&rx_decimator, &rx_dma_ring[index], words, pcm);
+        rx_capture.consumed += words;
+
+        for (uint32_t i = 0; i < n; i++) {
+            samples[i] = (uint16_t)pcm[i];
         }
+
+        // Tag the first sample for the RX -> USB IN latency if none is on its way
+        if (n)
+            ppm_tm_probe_start(&statistics.mic_probe, mic_ring.head);
+        uint32_t pushed = spsc_ring_push(&mic_ring, samples, n);
+        statistics.total_received += pushed;
+        if (pushed < n)
+            ppm_trace(PPM_TRACE_MIC_OVERFLOW, n - pushed, 0);
     }
+    ppm_tm_level_set(&statistics.mic_ring_level, spsc_ring_count(&mic_ring));
+
+    // Transfer count ran out (~12 h at 48 kHz); the sampler FIFO holds words meanwhile
+    if (ppm_link_capture_done(&rx_capture)) {
+        ppm_link_capture_arm(&rx_capture, true);
+        ppm_trace(PPM_TRACE_RX_DMA_REARM, 0, 0);
+    }
+}
+
+void init_rx_dma() {
+    ppm_link_capture_init(&rx_capture, pio, sm_pdm_in, rx_dma_ring, RX_DMA_RING_BITS);
+    rx_dma_ready = true;
+}
+
+// Sample the photodiode once per PDM bit
+void pdm_rx_set_sample_rate(uint32_t sample_rate) {
+    if (!rx_dma_ready || sample_rate == 0)
+        return;
+
+    pio_sm_set_clkdiv(pio, sm_pdm_in, (float)clock_get_hz(clk_sys) / ((float)sample_rate * PDM_OSR));
 }
 
-// Initialize PIO for pulse detector
-void init_pulse_detector(float freq) {
+// Initialize PIO for the PDM sampler
+void init_pdm_sampler() {
+#ifdef PDM_BENCHMARK
+    printf("PDM decimator: dither mean %ld/1024 LSB\n", (long)pdm_decimator_dither_mean(1u << 20));
+#endif
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-conversion"
-    sm_det      = pio_claim_unused_sm(pio, true);
-    uint offset = pio_add_program(pio, &pulse_detector_program);
+    sm_pdm_in   = pio_claim_unused_sm(pio, true);
+    uint offset = pio_add_program(pio, &laser_pdm_in_program);
 #pragma GCC diagnostic pop
-    pio_sm_config c = pulse_detector_program_get_default_config(offset);
+    pio_sm_config c = laser_pdm_in_program_get_default_config(offset);
+
+    sm_config_set_in_pins(&c, PDM_IN_PIN);
+    pio_gpio_init(pio, PDM_IN_PIN);
+    pio_sm_set_consecutive_pindirs(pio, sm_pdm_in, PDM_IN_PIN, 1, false);
 
-    sm_config_set_in_pins(&c, PULSE_DET_PIN);
-    sm_config_set_jmp_pin(&c, PULSE_DET_PIN);
-    pio_gpio_init(pio, PULSE_DET_PIN);
-    pio_sm_set_consecutive_pindirs(pio, sm_det, PULSE_DET_PIN, 1, false);
+    // First bit in the MSB like laser_pdm_out, autopush every word, RX only
+    sm_config_set_in_shift(&c, false, true, 32);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
 
-    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / freq);
-    pio_sm_init(pio, sm_det, offset, &c);
+    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / PDM_FREQ);
+    pio_sm_init(pio, sm_pdm_in, offset, &c);
 }
 
-void start_detector() {
-    pio_sm_clear_fifos(pio, sm_det);
-    pio_sm_set_enabled(pio, sm_det, true);
-    detector_running = true;
+void start_pdm_rx() {
+    pio_sm_clear_fifos(pio, sm_pdm_in);
+    pdm_decimator_init(&rx_decimator);
+    ppm_link_capture_arm(&rx_capture, true);
+    pio_sm_set_enabled(pio, sm_pdm_in, true);
+    pdm_rx_running = true;
 }
 
+// Clock profile switch (ppm_common/ppm_timing.h): both PDM clkdivs divide clk_sys
+static void pdm_timing_stop(void) {
+    pdm_set_enabled(false);
+    pio_sm_set_enabled(pio, sm_pdm_in, false);
+}
+
+static void pdm_timing_start(void) {
+    pdm_set_sample_rate(current_sample_rate);
+    pdm_rx_set_sample_rate(current_sample_rate);
+    pio_sm_set_enabled(pio, sm_pdm_in, true);
+    pdm_set_enabled(true);
+}
+
+static const ppm_timing_hooks_t pdm_timing_hooks = {pdm_timing_stop, pdm_timing_start};
+
 void second_core_main() {
-    init_pulse_detector(PIO_FREQ);
-    start_detector();
+    init_pdm_sampler();
+    init_rx_dma();
+    pdm_rx_set_sample_rate(current_sample_rate);
+    start_pdm_rx();
+
+    // The DMA IRQ for the PDM output lands on this core, next to its modulator
+    setup_pdm_system();
 
+    uint32_t last_loop = ppm_tm_now();
     while (1) {
-        update_measurements();
+        pdm_rx_task();
+        pdm_task();
+        ppm_timing_task(&pdm_timing_hooks);
+
+        uint32_t now = ppm_tm_now();
+        ppm_tm_hist_add(&statistics.core1_loop, now - last_loop);
+        last_loop = now;
     }
 }
 
 int main() {
-    set_sys_clock_khz(SYS_FREQ, true);
+    ppm_timing_init(SYS_FREQ_RUN, MIN_PULSE_PERIOD_US, 2);    // Both cores take part in switches
+    ppm_rt_init(1);    // Core1 runs the receiver
     gpio_init(LED_PIN);
     gpio_set_dir(LED_PIN, GPIO_OUT);
 
+    spsc_ring_init(&mic_ring, mic_ring_buffer, MIC_RING_SIZE);
+
     multicore_reset_core1();
     sleep_ms(100);
     multicore_launch_core1(second_core_main);
@@ -1,7 +1,10 @@
 #include "common.h"
 
 // Глобальная структура, доступная обоим ядрам
-core_shared_buffer_t shared_ppm_data __attribute__((section(".scratch_x")));
+audio_buffers_t audio_buffers;
 
-// Флаг, указывающий, что обмен через семафоры инициализирован
-volatile bool sem_initialized = false;
\ No newline at end of file
+// PDM receiver -> microphone endpoint
+spsc_ring_t mic_ring;
+uint32_t    mic_ring_buffer[MIC_RING_SIZE];
+
+statistics_t statistics;
@@ -1,12 +1,12 @@
 #include "common.h"
 #include "hardware/uart.h"
-#include "pico/sem.h"
 #include "usb_descriptors.h"
 #include <bsp/board_api.h>
 #include <limits.h>
 #include <string.h>
 
-// List of supported sample rates
+// List of supported sample rates. No 88.2/96 kHz: the PDM bit rate would double to 6.1 MHz
+// and the modulator has half the cycles per sample (PDM_BENCHMARK)
 const uint32_t sample_rates[] = {44100, AUDIO_SAMPLE_RATE};
 
 uint32_t current_sample_rate = AUDIO_SAMPLE_RATE;
@@ -21,6 +21,8 @@ uint32_t current_sample_rate = AUDIO_SAMPLE_RATE;
 
 static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
 
+static ppm_tm_stream_t telemetry;    // Snapshot being sent to the CDC interface
+
 // Audio controls
 // Current states
 int8_t  mute[CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX + 1];      // +1 for master channel 0
@@ -29,10 +31,6 @@ int16_t volume[CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX + 1];    // +1 for master chan
 // Buffer for microphone data
 int32_t  mic_buf[CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ / 4];
 int16_t *mic_dst;
-// Buffer for speaker data
-// int32_t spk_buf[CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ / 4];
-// Speaker data size received in the last frame
-uint16_t spk_data_size;
 // Resolution per format
 const uint8_t resolutions_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_RESOLUTION_RX,
                                                                         CFG_TUD_AUDIO_FUNC_1_FORMAT_2_RESOLUTION_RX};
@@ -40,91 +38,131 @@ const uint8_t resolutions_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_
 uint8_t  current_resolution;
 uint16_t pcm_ticks_in_buffer = 0;
 
-// Double buffers for speaker (USB -> PPM)
-// static spk_ppm_buffer_t spk_buffers[2];
-// static volatile uint8_t current_spk_write_buffer = 0;    // Buffer for PPM preparation
-// static volatile uint8_t current_spk_read_buffer  = 0;    // Buffer for reading in timer
-
 void led_blinking_task(void);
 void spk_task(void);
 void mic_task(void);
-void audio_processing_task(void);
-
-static PIO  pio = pio1;
-static uint sm_gen;
+void statistics_task(void);
 
-uint32_t audio_frame_ticks;
+static PIO pio = pio1;
 
-static uint dma_chan_pdm;
+static int  dma_chan_pdm[2] = {-1, -1};    // Play pdm_buffer_a and pdm_buffer_b, each chained to the other
 static uint pio_sm;
 
+static pdm_modulator_t modulator PPM_RT_CORE1_DATA;
+
+// Each channel reads its buffer through a read ring, so its address is back at the start
+// when the other channel chains to it again
+#define PDM_BUFFER_RING_BITS 9
+_Static_assert(PDM_BUFFER_WORDS * sizeof(uint32_t) == 1u << PDM_BUFFER_RING_BITS, "PDM buffer does not match its DMA ring");
+
+// laser_pdm_out puts out one bit per cycle
+void pdm_set_sample_rate(uint32_t sample_rate) {
+    if (dma_chan_pdm[0] < 0 || sample_rate == 0)
+        return;
+
+    pio_sm_set_clkdiv(pio, pio_sm, (float)clock_get_hz(clk_sys) / ((float)sample_rate * PDM_OSR));
+}
+
+// Holds the output through a clock profile switch, the DMA waits on the FIFO meanwhile
+void pdm_set_enabled(bool enabled) {
+    pio_sm_set_enabled(pio, pio_sm, enabled);
+}
+
+// Invoked on core1 when a PDM buffer has been played. The hardware has already moved on
+// to the other one, so all that is left is handing the finished buffer to pdm_task.
+void __isr PPM_RT_FUNC(dma_pdm_handler)() {
+    static bool     underrun       = false;    // Traced when it starts and ends, counted in between
+    static uint32_t underrun_first = 0;        // pdm_underruns when it started
+
+    for (uint32_t i = 0; i < 2; i++) {
+        if (!dma_channel_get_irq0_status((uint)dma_chan_pdm[i]))
+            continue;
+        dma_channel_acknowledge_irq0((uint)dma_chan_pdm[i]);
+
+        // pdm_task did not refill the buffer in time, the stale one is replayed
+        if (audio_buffers.pdm_ready) {
+            if (!underrun) {
+                ppm_trace(PPM_TRACE_PDM_UNDERRUN, audio_buffers.pdm_underruns, 0);
+                underrun       = true;
+                underrun_first = audio_buffers.pdm_underruns;
+            }
+            audio_buffers.pdm_underruns++;
+        }
+        else {
+            if (underrun) {
+                ppm_trace(PPM_TRACE_PDM_RESUMED, audio_buffers.pdm_underruns - underrun_first, 0);
+                underrun = false;
+            }
+            statistics.total_pdm_played++;
+            ppm_tm_probe_end(&statistics.pdm_probe, statistics.total_pdm_played);
+        }
+
+        audio_buffers.pdm_buffer_switch = i == 0;    // a finished, b is playing
+        audio_buffers.pdm_ready         = true;
+    }
+}
+
+// PDM output on pio1, fed from pdm_buffer_a/b by two DMA channels triggering each other.
+// Called on core1 so the DMA IRQ and pdm_task share a core.
 void setup_pdm_system() {
-    // Настройка PIO для PDM вывода
-    PIO pio = pio0;
-    pio_sm = 0;
-    uint offset = pio_add_program(pio, &pdm_out_program);
-    
-    pio_sm_config c = pdm_out_program_get_default_config(offset);
+    // Both buffers start as 50 % duty, which is silence
+    for (uint32_t i = 0; i < PDM_BUFFER_WORDS; i++) {
+        audio_buffers.pdm_buffer_a[i] = 0xAAAAAAAAu;
+        audio_buffers.pdm_buffer_b[i] = 0xAAAAAAAAu;
+    }
+    audio_buffers.pdm_buffer_switch = false;
+    audio_buffers.pdm_ready         = true;    // Buffer b is free to fill
+
+#ifdef PDM_BENCHMARK
+    // One second of audio in BUFFER_SIZE blocks, before the DMA competes for the core
+    uint32_t cycles = pdm_modulator_benchmark(AUDIO_SAMPLE_RATE / BUFFER_SIZE, BUFFER_SIZE);
+    uint32_t budget = clock_get_hz(clk_sys) / AUDIO_SAMPLE_RATE;
+    printf("PDM modulator: %lu cycles/sample of %lu, %lu%% of core1\n", (unsigned long)cycles, (unsigned long)budget,
+           (unsigned long)(cycles * 100 / budget));
+#endif
+    pdm_modulator_init(&modulator);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+    pio_sm      = pio_claim_unused_sm(pio, true);
+    uint offset = pio_add_program(pio, &laser_pdm_out_program);
+#pragma GCC diagnostic pop
+
+    pio_sm_config c = laser_pdm_out_program_get_default_config(offset);
     sm_config_set_out_pins(&c, LASER_PIN, 1);
-    sm_config_set_sideset_pins(&c, LASER_PIN);
-    
-    // Настройка частоты PDM
-    float div = (float)clock_get_hz(clk_sys) / PDM_FREQ;
-    sm_config_set_clkdiv(&c, div);
-    
+
+    // MSB first, autopull refills the OSR without a stall as long as the FIFO has data
     sm_config_set_out_shift(&c, false, true, 32);
     sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
-    
-    // Инициализация GPIO
+
     pio_gpio_init(pio, LASER_PIN);
     pio_sm_set_consecutive_pindirs(pio, pio_sm, LASER_PIN, 1, true);
-    
-    // Запуск state machine
     pio_sm_init(pio, pio_sm, offset, &c);
-    pio_sm_set_enabled(pio, pio_sm, true);
-    
-    // Настройка DMA для PDM
-    dma_chan_pdm = dma_claim_unused_channel(true);
-    dma_channel_config dma_c = dma_channel_get_default_config(dma_chan_pdm);
-    
-    channel_config_set_transfer_data_size(&dma_c, DMA_SIZE_32);
-    channel_config_set_read_increment(&dma_c, true);
-    channel_config_set_write_increment(&dma_c, false);
-    channel_config_set_dreq(&dma_c, pio_get_dreq(pio, pio_sm, true));
-    channel_config_set_chain_to(&dma_c, dma_chan_pdm);  // Зацикливание
-    
-    // Настройка прерывания DMA
-    dma_channel_set_irq0_enabled(dma_chan_pdm, true);
+
+    dma_chan_pdm[0] = dma_claim_unused_channel(true);
+    dma_chan_pdm[1] = dma_claim_unused_channel(true);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        uint32_t          *buffer = i ? audio_buffers.pdm_buffer_b : audio_buffers.pdm_buffer_a;
+        dma_channel_config dma_c  = dma_channel_get_default_config((uint)dma_chan_pdm[i]);
+        channel_config_set_transfer_data_size(&dma_c, DMA_SIZE_32);
+        channel_config_set_read_increment(&dma_c, true);
+        channel_config_set_write_increment(&dma_c, false);
+        channel_config_set_ring(&dma_c, false, PDM_BUFFER_RING_BITS);
+        channel_config_set_chain_to(&dma_c, (uint)dma_chan_pdm[i ^ 1]);
+        channel_config_set_dreq(&dma_c, pio_get_dreq(pio, pio_sm, true));
+
+        dma_channel_configure((uint)dma_chan_pdm[i], &dma_c, &pio->txf[pio_sm], buffer, PDM_BUFFER_WORDS, false);
+        dma_channel_set_irq0_enabled((uint)dma_chan_pdm[i], true);
+    }
+
     irq_set_exclusive_handler(DMA_IRQ_0, dma_pdm_handler);
     irq_set_enabled(DMA_IRQ_0, true);
-    
-    // Запуск первого DMA transfer
-    dma_channel_configure(
-        dma_chan_pdm, &dma_c,
-        &pio0_hw->txf[pio_sm],
-        audio_buffers.pdm_buffer_a,
-        BUFFER_SIZE/32,
-        true
-    );
-}
 
-// Обработчик DMA прерывания
-void __isr dma_pdm_handler() {
-    if (dma_channel_get_irq0_status(dma_chan_pdm)) {
-        dma_channel_acknowledge_irq0(dma_chan_pdm);
-        
-        // Переключение буферов
-        audio_buffers.pdm_buffer_switch = !audio_buffers.pdm_buffer_switch;
-        uint32_t *next_buffer = audio_buffers.pdm_buffer_switch ? 
-                               audio_buffers.pdm_buffer_b : 
-                               audio_buffers.pdm_buffer_a;
-        
-        // Настройка следующего transfer
-        dma_channel_set_read_addr(dma_chan_pdm, next_buffer, true);
-        
-        // Сигнал для обработки в основном цикле
-        audio_buffers.pdm_ready = true;
-    }
+    pdm_set_sample_rate(current_sample_rate);
+
+    dma_channel_start((uint)dma_chan_pdm[0]);
+    pio_sm_set_enabled(pio, pio_sm, true);
 }
 
 void setup_uart() {
@@ -134,54 +172,68 @@ void setup_uart() {
     stdio_uart_init();
 }
 
-// void init_double_buffering(void) {
-//     for (int i = 0; i < 2; i++) {
-//         spk_buffers[i].size     = 0;
-//         spk_buffers[i].position = 0;
-//         spk_buffers[i].ready    = false;
-//     }
-//     current_spk_write_buffer = 0;
-//     current_spk_read_buffer  = 0;
-// }
-
-void generate_pulse(uint32_t pause_width) {
-    pio_sm_put_blocking(pio, sm_gen, pause_width);
+static bool sample_rate_supported(uint32_t sample_rate) {
+    for (uint32_t i = 0; i < N_SAMPLE_RATES; i++) {
+        if (sample_rates[i] == sample_rate)
+            return true;
+    }
+    return false;
 }
 
-uint32_t calculate_audio_frame_ticks() {
-    return 1000000 / current_sample_rate;
-}
+// Core1: refill the PDM buffer the DMA just released from the next PCM block, or with
+// silence if spk_task has none, so the PDM stream never stops
+void PPM_RT_FUNC(pdm_task)(void) {
+    static bool          pcm_read             = false;    // PCM buffer to modulate next: false = a, true = b
+    static const int16_t silence[BUFFER_SIZE] = {0};
+    static uint32_t      silent_blocks        = 0;        // Since the current underrun began, traced on exit
+    static uint32_t      overloads            = 0;        // modulator.overloads already traced
+
+    if (!audio_buffers.pdm_ready)
+        return;
+    audio_buffers.pdm_ready = false;
+
+    uint32_t *pdm_dest = audio_buffers.pdm_buffer_switch ? audio_buffers.pdm_buffer_a : audio_buffers.pdm_buffer_b;
 
-uint32_t pcm_to_pdm_advanced(uint16_t *pcm_samples, int count) {
-    uint32_t pdm_word = 0;
-    
-    for (int i = 0; i < count && i < 32; i++) {
-        // Преобразование в знаковый формат
-        int32_t pcm_signed = (int32_t)pcm_samples[i] - 32768;
-        
-        // Дельта-сигма модулятор второго порядка
-        int32_t error1 = pcm_signed - ds_modulator.prev_output;
-        ds_modulator.integrator1 += error1;
-        
-        int32_t error2 = ds_modulator.integrator1 - ds_modulator.prev_output;
-        ds_modulator.integrator2 += error2;
-        
-        // Квантование
-        int32_t output;
-        if (ds_modulator.integrator2 >= 0) {
-            output = 32767;
-            pdm_word |= (1 << i);
-        } else {
-            output = -32768;
+    if (audio_buffers.pcm_ready[pcm_read]) {
+        __dmb();    // spk_task's samples before its ready flag
+        if (silent_blocks) {
+            ppm_trace(PPM_TRACE_TX_RESUMED, silent_blocks, 0);
+            silent_blocks = 0;
         }
-        
-        ds_modulator.prev_output = output;
+        pdm_modulator_run(&modulator, pcm_read ? audio_buffers.pcm_buffer_b : audio_buffers.pcm_buffer_a, BUFFER_SIZE, pdm_dest);
+        __dmb();
+        audio_buffers.pcm_ready[pcm_read] = false;
+        pcm_read                          = !pcm_read;
+        statistics.total_pcm_convert++;
+
+        // The block is on its way out once the DMA gets to this buffer
+        if (ppm_tm_probe_end(&statistics.spk_probe, statistics.total_pcm_convert))
+            ppm_tm_probe_start(&statistics.pdm_probe, statistics.total_pdm_sent);
     }
-    
-    return pdm_word;
+    else {
+        pdm_modulator_run(&modulator, silence, BUFFER_SIZE, pdm_dest);
+        audio_buffers.pcm_underruns++;
+        if (silent_blocks++ == 0)
+            ppm_trace(PPM_TRACE_TX_UNDERRUN, 0, 0);
+    }
+    statistics.total_pdm_sent++;
+
+    if (modulator.overloads != overloads) {
+        overloads = modulator.overloads;
+        ppm_trace(PPM_TRACE_PDM_OVERLOAD, overloads, 0);
+    }
+}
+
+// Clock profile switch (ppm_common/ppm_timing.h), the PDM state machines belong to core1
+static void usb_timing_start(void) {
+    // clk_peri may follow clk_sys
+    uart_set_baudrate(UART_ID, BAUD_RATE);
 }
 
+static const ppm_timing_hooks_t usb_timing_hooks = {NULL, usb_timing_start};
 
+// Profile while the bus is active, set with "clock <kHz>" on the telemetry terminal
+static uint32_t timing_run_khz = SYS_FREQ_RUN;
 
 // Initialize PIO for pulse generator
 // void init_pulse_generator(float freq) {
@@ -254,29 +306,27 @@ void first_core_main() {
         board_init_after_tusb();
     }
 
-    TU_LOG1("Laser Audio running\r\n");
+    ppm_trace(PPM_TRACE_BOOT, clock_get_hz(clk_sys) / 1000, 0);
     stdio_init_all();
 
-    init_double_buffering();
-
-    init_pulse_generator(PIO_FREQ);
-
-    audio_frame_ticks = 1000000 / AUDIO_SAMPLE_RATE;
-
-    // Setup timer interrupt for audio sampling
-    //irq_set_exclusive_handler(TIMER_IRQ_0, timer0_irq_handler);
-    hw_set_bits(&timer_hw->inte, (1u << 0));
-    irq_set_enabled(TIMER_IRQ_0, true);
+    // PDM output and the modulator run on core1 (second_core_main)
 
-    timer_hw->alarm[0] = timer_hw->timerawl + audio_frame_ticks;
+    ppm_tm_stream_init(&telemetry, TELEMETRY_PERIOD_MS);
 
-    // Main operation loop on Core1
+    // Main operation loop on Core0
+    uint32_t last_loop = ppm_tm_now();
     while (1) {
         tud_task();
         spk_task();
-        audio_processing_task();
         mic_task();
+        statistics_task();
+        ppm_timing_task(&usb_timing_hooks);
+        ppm_trace_drain(UART_ID);
         led_blinking_task();
+
+        uint32_t now = ppm_tm_now();
+        ppm_tm_hist_add(&statistics.core0_loop, now - last_loop);
+        last_loop = now;
     }
 }
 
@@ -300,11 +350,15 @@ void tud_umount_cb(void) {
 void tud_suspend_cb(bool remote_wakeup_en) {
     (void)remote_wakeup_en;
     blink_interval_ms = BLINK_SUSPENDED;
+
+    // Nothing is streamed, the modulator only turns silence into PDM
+    ppm_timing_request(SYS_FREQ_IDLE);
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void) {
     blink_interval_ms = tud_mounted() ? BLINK_MOUNTED : BLINK_NOT_MOUNTED;
+    ppm_timing_request(timing_run_khz);
 }
 
 // Helper for clock get requests
@@ -356,10 +410,15 @@ static bool tud_audio_clock_set_request(uint8_t rhport, audio_control_request_t
     if (request->bControlSelector == AUDIO_CS_CTRL_SAM_FREQ) {
         TU_VERIFY(request->wLength == sizeof(audio_control_cur_4_t));
 
-        current_sample_rate = (uint32_t)((audio_control_cur_4_t const *)buf)->bCur;
-        audio_frame_ticks   = calculate_audio_frame_ticks();
+        uint32_t sample_rate = (uint32_t)((audio_control_cur_4_t const *)buf)->bCur;
+        TU_VERIFY(sample_rate_supported(sample_rate));
+
+        // The PDM SM divides clk_sys down to the bit rate, there is no per sample timer
+        current_sample_rate = sample_rate;
+        pdm_set_sample_rate(current_sample_rate);
+        pdm_rx_set_sample_rate(current_sample_rate);
 
-        TU_LOG1("Clock set current freq: %" PRIu32 "\r\n", current_sample_rate);
+        ppm_trace(PPM_TRACE_SAMPLE_RATE, current_sample_rate, 0);
 
         return true;
     }
@@ -415,7 +474,7 @@ static bool tud_audio_feature_unit_set_request(uint8_t rhport, audio_control_req
 
         mute[request->bChannelNumber] = ((audio_control_cur_1_t const *)buf)->bCur;
 
-        TU_LOG1("Set channel %d Mute: %d\r\n", request->bChannelNumber, mute[request->bChannelNumber]);
+        ppm_trace(PPM_TRACE_SET_MUTE, request->bChannelNumber, (uint32_t)mute[request->bChannelNumber]);
 
         return true;
     }
@@ -424,7 +483,7 @@ static bool tud_audio_feature_unit_set_request(uint8_t rhport, audio_control_req
 
         volume[request->bChannelNumber] = ((audio_control_cur_2_t const *)buf)->bCur;
 
-        TU_LOG1("Set channel %d volume: %d dB\r\n", request->bChannelNumber, volume[request->bChannelNumber] / 256);
+        ppm_trace(PPM_TRACE_SET_VOLUME, request->bChannelNumber, (uint32_t)volume[request->bChannelNumber]);
 
         return true;
     }
@@ -491,12 +550,14 @@ bool tud_audio_set_itf_cb(uint8_t rhport, tusb_control_request_t const *p_reques
     uint8_t const itf = tu_u16_low(tu_le16toh(p_request->wIndex));
     uint8_t const alt = tu_u16_low(tu_le16toh(p_request->wValue));
 
-    TU_LOG2("Set interface %d alt %d\r\n", itf, alt);
+    ppm_trace(PPM_TRACE_SET_ITF, itf, alt);
     if (ITF_NUM_AUDIO_STREAMING_SPK == itf && alt != 0)
         blink_interval_ms = BLINK_STREAMING;
 
     // Clear buffer when streaming format is changed
-    spk_data_size = 0;
+    if (ITF_NUM_AUDIO_STREAMING_SPK == itf) {
+        tud_audio_clear_ep_out_ff();
+    }
     if (alt != 0) {
         current_resolution = resolutions_per_format[alt - 1];
     }
@@ -504,24 +565,6 @@ bool tud_audio_set_itf_cb(uint8_t rhport, tusb_control_request_t const *p_reques
     return true;
 }
 
-bool tud_audio_rx_done_pre_read_cb(uint8_t rhport, uint16_t n_bytes_received, uint8_t func_id, uint8_t ep_out, uint8_t cur_alt_setting) {
-    (void)rhport;
-    (void)func_id;
-    (void)ep_out;
-    (void)cur_alt_setting;
-
-    if (!spk_buffers[current_spk_write_buffer].ready) {
-        spk_data_size = tud_audio_read(spk_buf, n_bytes_received);
-        TU_LOG1("RX done pre read callback called, received %d bytes\r\n", spk_data_size);
-        if (sem_initialized) {
-            shared_ppm_data.packet_size = spk_data_size;
-        }
-        return true;
-    }
-    TU_LOG1("RX done pre read callback called, but buffer is not ready\r\n");
-    return false;
-}
-
 bool tud_audio_tx_done_pre_load_cb(uint8_t rhport, uint8_t itf, uint8_t ep_in, uint8_t cur_alt_setting) {
     (void)rhport;
     (void)itf;
@@ -531,32 +574,47 @@ bool tud_audio_tx_done_pre_load_cb(uint8_t rhport, uint8_t itf, uint8_t ep_in, u
     return true;
 }
 
-void spk_task(void) {
-    if (spk_data_size && !spk_buffers[current_spk_write_buffer].ready) {
-        if (current_resolution == 16) {
-            int16_t  *src        = (int16_t *)spk_buf;
-            int16_t  *limit      = (int16_t *)spk_buf + spk_data_size / 2;
-            uint16_t *dst        = spk_buffers[current_spk_write_buffer].ppm_buffer;
-            uint16_t  buffer_pos = 0;
-
-            while (src < limit) {
-                int32_t left      = *src++;
-                int32_t right     = *src++;
-                int16_t mixed     = (int16_t)((left >> 1) + (right >> 1));
-                dst[buffer_pos++] = audio_to_ppm(mixed);
-            }
+// Mix USB stereo down to mono PCM blocks for the modulator. A block still owned by
+// pdm_task stalls the copy, the samples wait in the endpoint FIFO.
+void PPM_RT_FUNC(spk_task)(void) {
+    static bool     pcm_write = false;    // PCM buffer being filled: false = a, true = b
+    static uint32_t pcm_pos   = 0;
 
-            spk_buffers[current_spk_write_buffer].size     = buffer_pos;
-            spk_buffers[current_spk_write_buffer].position = 0;
-            spk_buffers[current_spk_write_buffer].ready    = true;
+    tu_fifo_t     *ff          = tud_audio_get_ep_out_ff();
+    uint16_t const frame_bytes = current_resolution == 16 ? 2 * CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_RX
+                                                          : 2 * CFG_TUD_AUDIO_FUNC_1_FORMAT_2_N_BYTES_PER_SAMPLE_RX;
 
-            current_spk_write_buffer = (uint8_t)((current_spk_write_buffer + 1) % 2);
+    ppm_tm_level_set(&statistics.usb_out_level, tu_fifo_count(ff) / frame_bytes);
+
+    while (!audio_buffers.pcm_ready[pcm_write] && tu_fifo_count(ff) >= frame_bytes) {
+        int16_t *dst = pcm_write ? audio_buffers.pcm_buffer_b : audio_buffers.pcm_buffer_a;
+
+        // Tag the block's first sample for the USB OUT -> PDM latency if none is on its way
+        if (pcm_pos == 0)
+            ppm_tm_probe_start(&statistics.spk_probe, statistics.total_pcm_blocks);
+
+        int32_t frame[2];    // Largest frame: two 32 bit slots
+        tu_fifo_read_n(ff, frame, frame_bytes);
+        if (current_resolution == 16) {
+            const int16_t *src = (const int16_t *)frame;
+            dst[pcm_pos++]     = (int16_t)((src[0] >> 1) + (src[1] >> 1));
+        }
+        else {
+            dst[pcm_pos++] = (int16_t)(((frame[0] >> 1) + (frame[1] >> 1)) >> 16);
+        }
+        statistics.total_pcm_received++;
+
+        if (pcm_pos == BUFFER_SIZE) {
+            __dmb();    // Samples before the flag
+            audio_buffers.pcm_ready[pcm_write] = true;
+            pcm_write                          = !pcm_write;
+            pcm_pos                            = 0;
+            statistics.total_pcm_blocks++;
         }
-        spk_data_size = 0;
     }
 }
 
-void mic_task(void) {
+void PPM_RT_FUNC(mic_task)(void) {
     static absolute_time_t last_fill_time;
 
     if (!tud_audio_mounted() || current_resolution != 16) {
@@ -572,54 +630,28 @@ void mic_task(void) {
         last_fill_time = get_absolute_time();
     }
 
-    while (multicore_fifo_rvalid() && (pcm_ticks_in_buffer < packet_size_bytes)) {
-        uint32_t ppm_value = multicore_fifo_pop_blocking();
-        int16_t  pcm       = ppm_to_audio(ppm_value);
-        *mic_dst++         = pcm;
-        pcm_ticks_in_buffer += 2;
+    // Decimated samples from pdm_rx_task on core1
+    uint32_t *src;
+    uint32_t  available = spsc_ring_read_span(&mic_ring, &src);
+    uint32_t  wanted    = (packet_size_bytes - pcm_ticks_in_buffer) / 2u;
+    uint32_t  n         = available < wanted ? available : wanted;
+    for (uint32_t i = 0; i < n; i++) {
+        *mic_dst++ = (int16_t)src[i];
     }
+    spsc_ring_release(&mic_ring, n);
+    pcm_ticks_in_buffer = (uint16_t)(pcm_ticks_in_buffer + n * 2u);
 
     // Check sending conditions:
     bool buffer_full     = (pcm_ticks_in_buffer >= packet_size_bytes);
     bool timeout_expired = absolute_time_diff_us(last_fill_time, get_absolute_time()) >= 1000;
 
     if (buffer_full || (pcm_ticks_in_buffer > 0 && timeout_expired)) {
-        tud_audio_write((uint8_t *)mic_buf, pcm_ticks_in_buffer);
+        ppm_tm_probe_end(&statistics.mic_probe, mic_ring.tail);
+        statistics.total_bytes_sent_to_usb += tud_audio_write((uint8_t *)mic_buf, pcm_ticks_in_buffer);
         pcm_ticks_in_buffer = 0;
     }
 }
 
-void audio_processing_task() {
-    static uint32_t sample_counter = 0;
-    
-    // Обработка PCM -> PDM когда готовы новые данные
-    if (audio_buffers.pcm_ready) {
-        uint16_t *pcm_source = audio_buffers.pcm_buffer_switch ? 
-                              audio_buffers.pcm_buffer_a : 
-                              audio_buffers.pcm_buffer_b;
-        
-        uint32_t *pdm_dest = audio_buffers.pdm_buffer_switch ? 
-                            audio_buffers.pdm_buffer_a : 
-                            audio_buffers.pdm_buffer_b;
-        
-        // Преобразование PCM в PDM
-        for (int i = 0; i < BUFFER_SIZE/32; i++) {
-            pdm_dest[i] = pcm_to_pdm_advanced(&pcm_source[i * 32], 32);
-        }
-        
-        // Переключение буферов
-        audio_buffers.pcm_buffer_switch = !audio_buffers.pcm_buffer_switch;
-        audio_buffers.pcm_ready = false;
-        
-        sample_counter++;
-    }
-    
-    // Мониторинг производительности
-    if (sample_counter % 1000 == 0) {
-        printf("Processed %lu buffers\n", sample_counter);
-    }
-}
-
 //--------------------------------------------------------------------+
 // BLINKING TASK
 //--------------------------------------------------------------------+
@@ -635,3 +667,49 @@ void led_blinking_task(void) {
     board_led_write(led_state);
     led_state = 1 - led_state;
 }
+
+//--------------------------------------------------------------------+
+// TELEMETRY TASK
+//--------------------------------------------------------------------+
+static void statistics_build(ppm_tm_text_t *text) {
+    const statistics_t *st = &statistics;
+
+    ppm_tm_printf(text, "rate %lu\r\n", (unsigned long)current_sample_rate);
+    ppm_tm_printf(text, "clock %lu run=%lu switches=%lu\r\n", (unsigned long)SYS_FREQ, (unsigned long)timing_run_khz,
+                  (unsigned long)ppm_timing.switches);
+    ppm_tm_printf(text, "count pcm_in=%lu pcm_blocks=%lu pcm_modulated=%lu pdm_out=%lu pdm_played=%lu pdm_in=%lu samples_in=%lu usb_in_bytes=%llu\r\n",
+                  (unsigned long)st->total_pcm_received, (unsigned long)st->total_pcm_blocks,
+                  (unsigned long)st->total_pcm_convert, (unsigned long)st->total_pdm_sent,
+                  (unsigned long)st->total_pdm_played, (unsigned long)st->total_pdm_received,
+                  (unsigned long)st->total_received, (unsigned long long)st->total_bytes_sent_to_usb);
+    ppm_tm_printf(text, "drop pcm_underrun=%lu pdm_underrun=%lu overload=%lu rx_overrun=%lu mic_overflow=%lu mic_underflow=%lu\r\n",
+                  (unsigned long)audio_buffers.pcm_underruns, (unsigned long)audio_buffers.pdm_underruns,
+                  (unsigned long)modulator.overloads, (unsigned long)st->rx_overruns,
+                  (unsigned long)mic_ring.overflows, (unsigned long)mic_ring.underflows);
+
+    ppm_tm_print_level(text, "usb_out", &st->usb_out_level);
+    ppm_tm_print_level(text, "rx_backlog", &st->rx_backlog_level);
+    ppm_tm_print_level(text, "mic_ring", &st->mic_ring_level);
+
+    ppm_tm_print_hist(text, "usb_out_to_modulated", &st->spk_probe.latency);
+    ppm_tm_print_hist(text, "modulated_to_dma", &st->pdm_probe.latency);
+    ppm_tm_print_hist(text, "rx_to_usb_in", &st->mic_probe.latency);
+    ppm_tm_print_hist(text, "core0_loop", &st->core0_loop);
+    ppm_tm_print_hist(text, "core1_loop", &st->core1_loop);
+}
+
+// Terminal commands:
+//   clock <kHz>    switch to another clock profile (ppm_common/ppm_timing.h). Watch the pdm
+//                  underruns, the modulator may not keep up at the slower ones.
+static void statistics_command(const char *line) {
+    if (strncmp(line, "clock ", 6) == 0) {
+        uint32_t sys_khz = (uint32_t)strtoul(line + 6, NULL, 10);
+        if (ppm_timing_request(sys_khz))
+            timing_run_khz = sys_khz;
+    }
+}
+
+// Text snapshots on the CDC interface, whenever a terminal has it open
+void statistics_task(void) {
+    ppm_tm_stream_task(&telemetry, statistics_build, statistics_command);
+}
@@ -102,7 +102,7 @@ extern "C" {
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_CDC    0
+#define CFG_TUD_CDC    1
 #define CFG_TUD_MSC    0
 #define CFG_TUD_HID    0
 #define CFG_TUD_MIDI   0
@@ -172,6 +172,15 @@ extern "C" {
 // Size of control request buffer
 #define CFG_TUD_AUDIO_FUNC_1_CTRL_BUF_SZ 64
 
+//--------------------------------------------------------------------
+// CDC CLASS DRIVER CONFIGURATION
+//--------------------------------------------------------------------
+
+// Telemetry only flows to the host, a snapshot goes out in several FIFO loads
+#define CFG_TUD_CDC_RX_BUFSIZE 64
+#define CFG_TUD_CDC_TX_BUFSIZE 512
+#define CFG_TUD_CDC_EP_BUFSIZE 64
+
 #ifdef __cplusplus
 }
 #endif
@@ -73,7 +73,7 @@ uint8_t const *tud_descriptor_device_cb(void) {
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
-#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + CFG_TUD_AUDIO * TUD_AUDIO_HEADSET_STEREO_DESC_LEN)
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + CFG_TUD_AUDIO * TUD_AUDIO_HEADSET_STEREO_DESC_LEN + CFG_TUD_CDC * TUD_CDC_DESC_LEN)
 
 #if CFG_TUSB_MCU == OPT_MCU_LPC175X_6X || CFG_TUSB_MCU == OPT_MCU_LPC177X_8X || CFG_TUSB_MCU == OPT_MCU_LPC40XX
 // LPC 17xx and 40xx endpoint type (bulk/interrupt/iso) are fixed by its number
@@ -81,6 +81,9 @@ uint8_t const *tud_descriptor_device_cb(void) {
 #define EPNUM_AUDIO_IN  0x03
 #define EPNUM_AUDIO_OUT 0x03
 #define EPNUM_AUDIO_INT 0x01
+#define EPNUM_CDC_NOTIF 0x04
+#define EPNUM_CDC_OUT   0x05
+#define EPNUM_CDC_IN    0x05
 
 #elif CFG_TUSB_MCU == OPT_MCU_CXD56
 // CXD56 USB driver has fixed endpoint type (bulk/interrupt/iso) and direction (IN/OUT) by its number
@@ -88,12 +91,18 @@ uint8_t const *tud_descriptor_device_cb(void) {
 // #define EPNUM_AUDIO_IN    0x01
 // #define EPNUM_AUDIO_OUT   0x02
 // #define EPNUM_AUDIO_INT   0x03
+// #define EPNUM_CDC_NOTIF   0x06
+// #define EPNUM_CDC_OUT     0x05
+// #define EPNUM_CDC_IN      0x04
 
 #elif CFG_TUSB_MCU == OPT_MCU_NRF5X
 // ISO endpoints for NRF5x are fixed to 0x08 (0x88)
 #define EPNUM_AUDIO_IN  0x08
 #define EPNUM_AUDIO_OUT 0x08
 #define EPNUM_AUDIO_INT 0x01
+#define EPNUM_CDC_NOTIF 0x02
+#define EPNUM_CDC_OUT   0x03
+#define EPNUM_CDC_IN    0x03
 
 #elif defined(TUD_ENDPOINT_ONE_DIRECTION_ONLY)
 // MCUs that don't support a same endpoint number with different direction IN and OUT defined in tusb_mcu.h
@@ -101,11 +110,17 @@ uint8_t const *tud_descriptor_device_cb(void) {
 #define EPNUM_AUDIO_IN  0x01
 #define EPNUM_AUDIO_OUT 0x02
 #define EPNUM_AUDIO_INT 0x03
+#define EPNUM_CDC_NOTIF 0x04
+#define EPNUM_CDC_OUT   0x05
+#define EPNUM_CDC_IN    0x06
 
 #else
 #define EPNUM_AUDIO_IN  0x01
 #define EPNUM_AUDIO_OUT 0x01
 #define EPNUM_AUDIO_INT 0x02
+#define EPNUM_CDC_NOTIF 0x03
+#define EPNUM_CDC_OUT   0x04
+#define EPNUM_CDC_IN    0x04
 #endif
 
 uint8_t const desc_configuration[] =
@@ -114,7 +129,10 @@ uint8_t const desc_configuration[] =
         TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
 
         // Interface number, string index, EP Out & EP In address, EP size
-        TUD_AUDIO_HEADSET_STEREO_DESCRIPTOR(2, EPNUM_AUDIO_OUT, EPNUM_AUDIO_IN | 0x80, EPNUM_AUDIO_INT | 0x80)};
+        TUD_AUDIO_HEADSET_STEREO_DESCRIPTOR(2, EPNUM_AUDIO_OUT, EPNUM_AUDIO_IN | 0x80, EPNUM_AUDIO_INT | 0x80),
+
+        // Interface number, string index, EP notification address and size, EP data address (out, in) and size
+        TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 6, EPNUM_CDC_NOTIF | 0x80, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN | 0x80, CFG_TUD_CDC_EP_BUFSIZE)};
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
 // Application return pointer to descriptor
@@ -146,6 +164,7 @@ char const *string_desc_arr[] =
         NULL,                          // 3: Serials will use unique ID if possible
         "Laser Speakers",              // 4: Audio Interface
         "Laser Microphone",            // 5: Audio Interface
+        "Laser Telemetry",             // 6: CDC Interface
 };
 
 static uint16_t _desc_str[32 + 1];
@@ -7,67 +7,33 @@
 import numpy as np
 import matplotlib.pyplot as plt
 
+from ppm_sim import Link
+
 # Константы из C кода
 INT16_MIN = -32768
 INT16_MAX = 32767
 INT24_MIN = -8388608
 INT24_MAX = 8388607
 
+# Формулы прошивки (ppm_codec.h), 10-битные коды как в моно-режиме
+LINK = Link(channels=1)
+
 def audio_to_ppm(audio_sample):
     """Преобразование 16-битного PCM в 10-битное значение для PPM"""
-    # Сдвиг от знакового диапазона [-32768, 32767] к беззнаковому [0, 65535]
-    unsigned_sample = int(audio_sample) + 32768
-    
-    # Масштабирование от 16-бит (0-65535) к 10-бит (0-1023)
-    # Используем округление для лучшей точности
-    return (unsigned_sample * 1023 + 32767) // 65535
+    return int(LINK.encode_s16([np.clip(audio_sample, INT16_MIN, INT16_MAX)])[0])
 
 def audio24_to_ppm(audio_sample):
     """Преобразование 24-битного PCM в 10-битное значение для PPM"""
-    # Убеждаемся, что это валидное 24-битное значение
-    audio_sample = int(audio_sample)
-    
-    # Ограничиваем диапазон 24-битными значениями
-    if audio_sample > INT24_MAX:
-        audio_sample = INT24_MAX
-    elif audio_sample < INT24_MIN:
-        audio_sample = INT24_MIN
-    
-    # Сдвиг от знакового диапазона [-8388608, 8388607] к беззнаковому [0, 16777215]
-    unsigned_sample = audio_sample + 8388608
-    
-    # Масштабирование от 24-бит (0-16777215) к 10-бит (0-1023)
-    return (unsigned_sample * 1023 + 8388607) // 16777215
+    # 24 бита выровнены влево в 32-битном слоте, как в UAC2
+    return int(LINK.encode_s32([np.clip(audio_sample, INT24_MIN, INT24_MAX) << 8])[0])
 
 def ppm_to_audio(ppm_value):
-    """Преобразование 10-битного PPM обратно в 16-битное PCM"""
-    # Ограничиваем диапазон
-    ppm_value &= 0x3FF  # 0-1023
-    
-    # Масштабирование от 10-бит (0-1023) к 16-бит (0-65535)
-    unsigned_sample = (ppm_value * 65535 + 511) // 1023
-    
-    # Сдвиг обратно к знаковому диапазону
-    return int(unsigned_sample) - 32768
+    """Преобразование 10-битного PPM обратно в 16-битное PCM (центр шага квантования)"""
+    return int(LINK.decode_s16([ppm_value])[0])
 
 def ppm_to_audio24(ppm_value):
-    """Преобразование 10-битного PPM обратно в 24-битное PCM"""
-    # Ограничиваем диапазон
-    ppm_value &= 0x3FF  # 0-1023
-    
-    # Масштабирование от 10-бит (0-1023) к 24-бит (0-16777215)
-    unsigned_sample = (ppm_value * 16777215 + 511) // 1023
-    
-    # Сдвиг обратно к знаковому диапазону
-    signed_sample = unsigned_sample - 8388608
-    
-    # Ограничиваем результат 24-битным диапазоном
-    if signed_sample > INT24_MAX:
-        signed_sample = INT24_MAX
-    elif signed_sample < INT24_MIN:
-        signed_sample = INT24_MIN
-        
-    return signed_sample
+    """Преобразование 10-битного PPM обратно в 24-битное PCM (центр шага квантования)"""
+    return int(LINK.decode_s32([ppm_value])[0] >> 8)
 
 def test_conversion_accuracy():
     """Тестирование точности преобразования"""
@@ -109,20 +75,7 @@ def generate_ramp_signal(duration=1.0, sample_rate=48000, bits=16):
 
 def simulate_transmission(ramp_signal, bits=16):
     """Симуляция передачи через PPM"""
-    transmitted = []
-    
-    for sample in ramp_signal:
-        sample = int(sample)  # Убеждаемся, что это целое число
-        if bits == 16:
-            ppm = audio_to_ppm(sample)
-            reconstructed = ppm_to_audio(ppm)
-        else:  # 24-bit
-            ppm = audio24_to_ppm(sample)
-            reconstructed = ppm_to_audio24(ppm)
-            
-        transmitted.append(reconstructed)
-    
-    return np.array(transmitted, dtype=np.int32)  # Используем int32 для больших значений
+    return simulate_transmission_with_ppm(ramp_signal, bits)[0]
 
 def plot_results(t, original, transmitted, bits=16):
     """Визуализация результатов"""
@@ -240,22 +193,15 @@ def analyze_ppm_distribution(ppm_values):
 
 def simulate_transmission_with_ppm(ramp_signal, bits=16):
     """Симуляция передачи через PPM с сохранением PPM значений"""
-    transmitted = []
-    ppm_values = []
-    
-    for sample in ramp_signal:
-        sample = int(sample)
-        if bits == 16:
-            ppm = audio_to_ppm(sample)
-            reconstructed = ppm_to_audio(ppm)
-        else:  # 24-bit
-            ppm = audio24_to_ppm(sample)
-            reconstructed = ppm_to_audio24(ppm)
-        
-        ppm_values.append(ppm)
-        transmitted.append(reconstructed)
-    
-    return np.array(transmitted, dtype=np.int32), np.array(ppm_values)
+    samples = np.asarray(ramp_signal, dtype=np.int32)
+    if bits == 16:
+        ppm_values = LINK.encode_s16(samples)
+        transmitted = LINK.decode_s16(ppm_values).astype(np.int32)
+    else:  # 24-bit
+        ppm_values = LINK.encode_s32(samples << 8)
+        transmitted = LINK.decode_s32(ppm_values) >> 8
+
+    return transmitted, ppm_values.astype(np.int32)
 
 def print_conversion_table(bits=16, num_samples=20):
     """Печать таблицы преобразования для анализа"""
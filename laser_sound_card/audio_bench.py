@@ -0,0 +1,449 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Loopback benchmark of the laser sound card, built on audio_test.py
+
+Plays a periodic test signal through the card (speaker -> laser -> microphone)
+for every combination of sample rate, resolution, host buffer size and clock
+profile, and measures from the recording:
+
+    latency    round trip, from the cross-correlation with the signal sent
+    drift      slope of the latency over the run, in ppm
+    slips      latency steps of a sample or more (frames lost or repeated)
+    THD+N      residual of the sine half of each period after the fitted gain
+    glitches   1 ms windows whose residual stands out, merged into events
+    dropouts   1 ms windows with (almost) nothing received, merged into events
+
+Each period of the signal is half band-limited noise (sharp correlation peak)
+and half a 997 Hz sine. The recording is processed period by period while the
+stream runs, so a run of several hours keeps only the results in memory.
+
+With --telemetry the CDC telemetry interface is read alongside (see
+ppm_telemetry.h and statistics_build in transmitter.c): the firmware's drop
+counters are reported as the change over each case, the queue levels and stage
+latency histograms as they stand at its end, and --clock cases switch the
+clock profile with the 'clock' command.
+
+Results go to stdout as a table and, with --out, to a JSON lines file with one
+object per case, for comparing firmware builds:
+
+    python3 audio_bench.py -d "Laser" --rates 48000 96000 --bits 16 24 \\
+        --blocksizes 0 256 --duration 60 --telemetry /dev/ttyACM0 --out run.jsonl
+"""
+
+import argparse
+import itertools
+import json
+import queue
+import subprocess
+import sys
+import threading
+import time
+
+import numpy as np
+import sounddevice as sd
+from scipy import signal
+
+from audio_test import AudioTester
+
+DTYPES = {16: ("int16", 32767), 24: ("int32", 2147483647)}  # 24 bit in a 4 byte subslot
+
+
+class PeriodicSignal:
+    """One period of the test signal, repeated for the whole run"""
+
+    def __init__(self, rate, period_s=1.0, amplitude=0.25, frequency=997, seed=0):
+        n = int(rate * period_s)
+        half = n // 2
+        rng = np.random.default_rng(seed)
+
+        # Noise limited to 0.4 fs, peak at the amplitude
+        spectrum = np.fft.rfft(rng.standard_normal(half))
+        spectrum[int(0.4 * half) :] = 0
+        noise = np.fft.irfft(spectrum, half)
+        noise *= amplitude / np.max(np.abs(noise))
+
+        t = np.arange(n - half) / rate
+        sine = amplitude * np.sin(2 * np.pi * frequency * t)
+
+        self.rate = rate
+        self.samples = np.concatenate((noise, sine))
+        self.sine = slice(half, n)
+        self.spectrum = np.fft.rfft(self.samples)
+
+    def __len__(self):
+        return len(self.samples)
+
+    def shifted(self, fraction):
+        """The period delayed by a fraction of a sample, exact since the signal is periodic"""
+        k = np.arange(len(self.spectrum))
+        return np.fft.irfft(self.spectrum * np.exp(-2j * np.pi * k * fraction / len(self)), len(self))
+
+
+def peak(corr, index):
+    """Sub-sample position of the correlation peak at index (parabola through 3 points)"""
+    if 0 < index < len(corr) - 1:
+        a, b, c = corr[index - 1], corr[index], corr[index + 1]
+        if a - 2 * b + c != 0:
+            return index + 0.5 * (a - c) / (a - 2 * b + c)
+    return float(index)
+
+
+def runs(mask):
+    """Number of runs of True in mask"""
+    return int(np.count_nonzero(np.diff(np.concatenate(([0], mask.astype(np.int8)))) == 1))
+
+
+class Telemetry:
+    """Snapshots from the CDC telemetry interface, read in the background"""
+
+    def __init__(self, port):
+        import serial  # pyserial
+
+        self.port = serial.Serial(port, timeout=0.1)  # USB CDC, the baud rate does not matter
+        self.lock = threading.Condition()
+        self.latest = None
+        self.running = True
+        self.thread = threading.Thread(target=self._run, daemon=True)
+        self.thread.start()
+
+    def _run(self):
+        pending = None
+        buffer = b""
+        while self.running:
+            buffer += self.port.read(512)
+            *lines, buffer = buffer.split(b"\n")
+            for raw in lines:
+                line = raw.decode("ascii", "replace").strip()
+                if line.startswith("# snapshot"):
+                    pending = {"sequence": int(line.split()[2])}
+                elif pending is not None and not line:
+                    with self.lock:
+                        self.latest = pending
+                        self.lock.notify_all()
+                    pending = None
+                elif pending is not None:
+                    parse_line(pending, line)
+
+    def snapshot(self, timeout=3.0):
+        """The next snapshot to arrive, None if none came"""
+        with self.lock:
+            last = self.latest["sequence"] if self.latest else None
+            self.lock.wait_for(lambda: self.latest and self.latest["sequence"] != last, timeout)
+            return self.latest if self.latest and self.latest["sequence"] != last else None
+
+    def command(self, line):
+        self.port.write((line + "\r\n").encode("ascii"))
+
+    def close(self):
+        self.running = False
+        self.thread.join()
+        self.port.close()
+
+
+def parse_line(snapshot, line):
+    """One line of statistics_build into snapshot"""
+    words = line.split()
+    if not words:
+        return
+    kind, rest = words[0], words[1:]
+    if kind == "level" and len(rest) >= 3:
+        snapshot[f"level.{rest[0]}"] = int(rest[1])
+        snapshot[f"level.{rest[0]}.peak"] = int(rest[2].split("=")[1])
+    elif kind == "hist" and len(rest) >= 3:
+        snapshot[f"hist.{rest[0]}"] = {
+            "n": int(rest[1].split("=")[1]),
+            "max_us": int(rest[2].split("=")[1]),
+            "bins": [int(b) for b in rest[3:]],
+        }
+    else:
+        for word in rest:
+            key, _, value = word.partition("=")
+            name = f"{kind}.{key}" if value else kind
+            try:
+                snapshot[name] = int(value or key)
+            except ValueError:
+                pass
+
+
+def telemetry_change(start, end):
+    """Counters as the change over the case, levels and histograms as they stand at its end"""
+    if not start or not end:
+        return None
+    result = {}
+    for key, value in end.items():
+        if key.startswith(("count.", "drop.", "conceal.")) and key in start:
+            change = value - start[key]
+            result[key] = change + (1 << 32) if change < 0 else change  # 32 bit counters wrapped
+        elif key.startswith(("level.", "hist.", "mic_rs.")) or key in ("rate", "clock", "clock.run", "clock.switches"):
+            result[key] = value
+    return result
+
+
+class LinkBenchmark(AudioTester):
+    """One case: play the periodic signal, measure period by period as the recording comes in"""
+
+    def __init__(self, device_name=None, period_s=1.0, search_ms=20, glitch_factor=6.0, **kwargs):
+        super().__init__(device_name=device_name, **kwargs)
+        self.period_s = period_s
+        self.search_ms = search_ms
+        self.glitch_factor = glitch_factor
+
+    def run_case(self, rate, bits, blocksize, duration):
+        dtype, full_scale = DTYPES[bits]
+        test = PeriodicSignal(rate, self.period_s)
+        period = len(test)
+        out = np.round(test.samples * full_scale).astype(dtype)
+
+        info = sd.query_devices(self.device_id)
+        in_channels = min(info["max_input_channels"], 2)
+        out_channels = min(info["max_output_channels"], 2)
+        chunks = queue.Queue()
+        host = {"input_overflow": 0, "input_underflow": 0, "output_underflow": 0, "output_overflow": 0}
+
+        def callback(indata, outdata, frames, when, status):
+            for flag in host:
+                if getattr(status, flag):
+                    host[flag] += 1
+            index = (callback.pos + np.arange(frames)) % period
+            outdata[:] = out[index, None]
+            callback.pos += frames
+            chunks.put(indata.copy())
+
+        callback.pos = 0
+        stream = sd.Stream(
+            device=self.device_id,
+            channels=(in_channels, out_channels),
+            samplerate=rate,
+            dtype=dtype,
+            blocksize=blocksize,
+            callback=callback,
+        )
+        analysis = PeriodAnalysis(test, full_scale, self.search_ms, self.glitch_factor)
+        with stream:
+            end = time.monotonic() + duration
+            while time.monotonic() < end:
+                try:
+                    analysis.feed(chunks.get(timeout=1.0))
+                except queue.Empty:
+                    pass
+        while not chunks.empty():
+            analysis.feed(chunks.get())
+
+        result = analysis.result()
+        result["host"] = dict(host, latency_in_ms=stream.latency[0] * 1000, latency_out_ms=stream.latency[1] * 1000)
+        return result
+
+
+class PeriodAnalysis:
+    """Latency, drift, THD+N, glitches and dropouts from the recording, one period at a time"""
+
+    def __init__(self, test, full_scale, search_ms, glitch_factor):
+        self.test = test
+        self.full_scale = full_scale
+        self.search = int(test.rate * search_ms / 1000)
+        self.window = test.rate // 1000
+        self.glitch_factor = glitch_factor
+
+        self.buffer = np.zeros((0, 0))
+        self.base = 0  # Recording index of buffer[0]
+        self.channel = None
+        self.delays = []  # Samples, one per period
+        self.error = None
+        self.periods = 0
+        self.thd_n = []
+        self.glitches = self.dropouts = 0
+        self.glitch_ms = self.dropout_ms = 0
+
+    def feed(self, chunk):
+        chunk = chunk.astype(np.float64) / self.full_scale
+        self.buffer = chunk if self.buffer.size == 0 else np.concatenate((self.buffer, chunk))
+        if self.channel is None and not self._lock():
+            return
+        while self.channel is not None and self._period():
+            pass
+
+    def _lock(self):
+        """Find the channel with the signal and the initial delay, from the first two periods"""
+        n = len(self.test)
+        if len(self.buffer) < 2 * n:
+            return False
+        ref = self.test.samples
+        best = None
+        for ch in range(self.buffer.shape[1]):
+            corr = signal.correlate(self.buffer[: 2 * n, ch], ref, mode="valid", method="fft")
+            norm = np.sqrt(np.sum(ref**2) * np.sum(self.buffer[: 2 * n, ch] ** 2) / 2)
+            score = np.max(corr) / norm if norm > 0 else 0
+            if best is None or score > best[0]:
+                best = (score, ch, corr)
+        score, ch, corr = best
+        if score < 0.3:
+            self.error = f"no signal (correlation {score:.2f})"
+            drop = len(self.buffer) - n  # Keep looking, the link may still be locking
+            self.buffer = self.buffer[drop:]
+            self.base += drop
+            return False
+
+        # First peak: later ones are the same delay one period on. The delay is below a
+        # period, so the period this one started at follows from the position.
+        first = int(np.argmax(corr >= 0.5 * np.max(corr)))
+        first = max(0, first - 2) + int(np.argmax(corr[max(0, first - 2) : first + 3]))
+        position = self.base + peak(corr, first)
+        self.channel = ch
+        self.error = None
+        self.delays.append(position % n)
+        self.next = int(position // n) + 1
+        return True
+
+    def _period(self):
+        """Measure the next period if the recording covers it. False when it does not yet."""
+        n = len(self.test)
+        expect = self.next * n + self.delays[-1]
+        start = int(np.floor(expect)) - self.search
+        if start + n + 2 * self.search > self.base + len(self.buffer):
+            return False
+
+        seg = self.buffer[start - self.base : start - self.base + n + 2 * self.search, self.channel]
+        corr = signal.correlate(seg, self.test.samples, mode="valid", method="fft")
+        delay = start + peak(corr, int(np.argmax(corr))) - self.next * n
+        self.delays.append(delay)
+
+        # The period as received against the period as sent, shifted and scaled to it
+        whole = int(np.floor(delay))
+        got = self.buffer[self.next * n + whole - self.base : self.next * n + whole - self.base + n, self.channel]
+        ref = self.test.shifted(delay - whole)
+        gain = np.dot(got, ref) / np.dot(ref, ref)
+        residual = got - gain * ref
+        s = self.test.sine
+        self.thd_n.append(np.sqrt(np.mean(residual[s] ** 2) / np.mean((gain * ref[s]) ** 2)))
+
+        w = self.window
+        m = n // w * w
+        res_rms = np.sqrt(np.mean(residual[:m].reshape(-1, w) ** 2, axis=1))
+        got_rms = np.sqrt(np.mean(got[:m].reshape(-1, w) ** 2, axis=1))
+        ref_rms = np.sqrt(np.mean((gain * ref[:m]).reshape(-1, w) ** 2, axis=1))
+        floor = max(self.glitch_factor * np.median(res_rms), 1e-3)
+        glitch = res_rms > floor
+        dropout = got_rms < 0.1 * ref_rms
+        self.glitches += runs(glitch & ~dropout)
+        self.dropouts += runs(dropout)
+        self.glitch_ms += int(np.count_nonzero(glitch & ~dropout))
+        self.dropout_ms += int(np.count_nonzero(dropout))
+        self.periods += 1
+        self.next += 1
+
+        # Keep what the next period and its search window need
+        keep = self.next * n + whole - 2 * self.search
+        if keep > self.base:
+            self.buffer = self.buffer[keep - self.base :]
+            self.base = keep
+        return True
+
+    def result(self):
+        rate = self.test.rate
+        if not self.periods:
+            return {"error": self.error or "recording too short"}
+
+        delays = np.array(self.delays)
+        seconds = np.arange(len(delays)) * len(self.test) / rate
+        drift = np.polyfit(seconds, delays, 1)[0] / rate * 1e6 if len(delays) > 2 else 0.0
+        steps = np.diff(delays)
+        slips = int(np.count_nonzero(np.abs(steps - np.median(steps)) >= 0.5))
+        thd_n = np.array(self.thd_n)
+        return {
+            "periods": self.periods,
+            "channel": self.channel,
+            "latency_ms": float(delays[0] * 1000 / rate),
+            "latency_ms_median": float(np.median(delays) * 1000 / rate),
+            "latency_ms_min": float(np.min(delays) * 1000 / rate),
+            "latency_ms_max": float(np.max(delays) * 1000 / rate),
+            "drift_ppm": float(drift),
+            "slips": slips,
+            "thd_n_db_median": float(20 * np.log10(np.median(thd_n))),
+            "thd_n_db_worst": float(20 * np.log10(np.max(thd_n))),
+            "glitches": self.glitches,
+            "glitch_ms": self.glitch_ms,
+            "dropouts": self.dropouts,
+            "dropout_ms": self.dropout_ms,
+        }
+
+
+def firmware_revision():
+    """git describe of the tree the benchmark runs from, to tag the results"""
+    try:
+        return subprocess.run(
+            ["git", "describe", "--always", "--dirty"], capture_output=True, text=True, check=True
+        ).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Loopback benchmark of the laser sound card")
+    parser.add_argument("--device", "-d", type=str, help="Audio device name or index")
+    parser.add_argument("--rates", type=int, nargs="+", default=[48000], help="Sample rates")
+    parser.add_argument("--bits", type=int, nargs="+", choices=sorted(DTYPES), default=[16], help="Resolutions")
+    parser.add_argument("--blocksizes", type=int, nargs="+", default=[0], help="Host buffer sizes in frames, 0: default")
+    parser.add_argument("--clocks", type=int, nargs="+", default=[None], help="Clock profiles in kHz (needs --telemetry)")
+    parser.add_argument("--duration", "-t", type=float, default=30.0, help="Seconds per case")
+    parser.add_argument("--period", type=float, default=1.0, help="Test signal period in s, above the latency")
+    parser.add_argument("--repeat", type=int, default=1, help="Runs of every case")
+    parser.add_argument("--telemetry", metavar="PORT", help="CDC telemetry port of the card")
+    parser.add_argument("--out", metavar="FILE", help="Append one JSON object per case to FILE")
+    parser.add_argument("--label", default="", help="Free text stored with every result")
+    args = parser.parse_args()
+
+    bench = LinkBenchmark(device_name=args.device, period_s=args.period)
+    if bench.device_id is None:
+        sys.exit("No device selected")
+    if args.clocks != [None] and not args.telemetry:
+        sys.exit("--clocks needs --telemetry")
+
+    telemetry = Telemetry(args.telemetry) if args.telemetry else None
+    out = open(args.out, "a", encoding="utf-8") if args.out else None
+    revision = firmware_revision()
+
+    print(f"{'clock':>7} {'rate':>6} {'bits':>4} {'block':>5}  {'lat ms':>7} {'drift':>7} {'slips':>5} "
+          f"{'THD+N':>6} {'glitch':>6} {'drop':>5}  {'link lost':>9}")
+    try:
+        cases = itertools.product(range(args.repeat), args.clocks, args.rates, args.bits, args.blocksizes)
+        for run, clock, rate, bits, blocksize in cases:
+            case = {"clock_khz": clock, "rate": rate, "bits": bits, "blocksize": blocksize,
+                    "duration_s": args.duration, "run": run}
+            record = {"case": case, "time": time.strftime("%Y-%m-%dT%H:%M:%S"), "revision": revision,
+                      "label": args.label}
+
+            if clock is not None:
+                telemetry.command(f"clock {clock}")
+                telemetry.snapshot()
+            start = telemetry.snapshot() if telemetry else None
+            try:
+                record["link"] = bench.run_case(rate, bits, blocksize, args.duration)
+            except Exception as e:  # An unsupported rate or format fails the case, not the run
+                record["link"] = {"error": str(e)}
+            end = telemetry.snapshot() if telemetry else None
+            record["telemetry"] = telemetry_change(start, end)
+
+            link = record["link"]
+            tm = record["telemetry"] or {}
+            if "error" in link:
+                print(f"{clock or '-':>7} {rate:>6} {bits:>4} {blocksize:>5}  {link['error']}")
+            else:
+                print(f"{clock or '-':>7} {rate:>6} {bits:>4} {blocksize:>5}  {link['latency_ms_median']:7.2f} "
+                      f"{link['drift_ppm']:7.2f} {link['slips']:5d} {link['thd_n_db_median']:6.1f} "
+                      f"{link['glitches']:6d} {link['dropouts']:5d}  {tm.get('drop.rx_lost', '-'):>9}")
+            sys.stdout.flush()
+            if out:
+                out.write(json.dumps(record) + "\n")
+                out.flush()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if telemetry:
+            telemetry.close()
+        if out:
+            out.close()
+
+
+if __name__ == "__main__":
+    main()
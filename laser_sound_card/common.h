@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/pio.h"
 #include "pico/multicore.h"
 #include "pico/stdlib.h"
@@ -13,26 +14,125 @@
 #include "hardware/timer.h"
 #include "tusb.h"
 
-// Include generated header files with PIO programs
-#include "ppm.pio.h"
-
-#define PULSE_GEN_PIN 0
-#define PULSE_DET_PIN 1
-#define LED_PIN       25
+// Stereo doubles the symbol rate, one bit less keeps the longest symbol inside a slot
+#if CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX == 2
+#define PPM_CODE_BITS 9
+#endif
 
-// #define SYS_FREQ 133000
-#define SYS_FREQ 250000
+#include "ppm_calibration.h"
+#include "ppm_link.h"
+#include "ppm_realtime.h"
+#include "ppm_telemetry.h"
+#include "ppm_timing.h"
+#include "ppm_trace.h"
+#include "ppm_codec.h"
+#include "spsc_ring.h"
+
+#define LED_PIN 25
+
+// Link lanes: generator/detector pairs run side by side, lane k on PPM_LANE_GEN_PINS[k] and
+// PPM_LANE_DET_PINS[k]. Frame i goes out on lane i % PPM_LANES, so every lane carries its
+// own blocks at 1/PPM_LANES of the symbol rate and the slot of one block per lane holds
+// PPM_FRAMES_PER_SLOT frames. The spare symbol time buys longer codes or higher rates.
+// Generators sit on pio1, detectors on pio0, four SMs each.
+#ifndef PPM_LANES
+#define PPM_LANES 1
+#endif
+#define PPM_LANES_MAX     4
+#define PPM_LANE_GEN_PINS {0, 2, 4, 6}
+#define PPM_LANE_DET_PINS {1, 3, 5, 7}
+
+// Clock profile at boot and while the bus is active, and while it is suspended
+// (ppm_common/ppm_timing.h). Both ends of the link need the same one.
+#define SYS_FREQ_RUN  250000
+#define SYS_FREQ_IDLE 133000
+
+// Pause resolution. pulse_detector tests the pin every other cycle, so by default both ends
+// count pauses in steps of two PIO cycles. PPM_FINE_DETECTOR adds pulse_detector_late one
+// cycle behind it, their counts add up to single cycles, and pulse_generator_fine counts
+// single cycles as well: the same codes in half the time, or a bit more per code in the
+// same time. Both ends of the link need the same setting.
+#ifndef PPM_FINE_DETECTOR
+#define PPM_FINE_DETECTOR 0
+#endif
+#if PPM_FINE_DETECTOR
+#define PPM_CYCLES_PER_COUNT 1
+#else
+#define PPM_CYCLES_PER_COUNT 2
+#endif
+#define PPM_COUNT_SCALE (2 / PPM_CYCLES_PER_COUNT)    // The profiles give two cycle counts
 
-#if SYS_FREQ == 133000
-#define MIN_TACKT 5
-#elif SYS_FREQ == 250000
-#define MIN_TACKT 8
+#if PPM_LANES < 1 || PPM_LANES * PPM_COUNT_SCALE > PPM_LANES_MAX
+#error "PPM_LANES: one detector SM per lane on pio0, two with PPM_FINE_DETECTOR"
 #endif
 
-#define MAX_CODE          1024
+// Timing of the active profile, in pause counts
+#define SYS_FREQ            (ppm_timing.sys_khz)
+#define MIN_TACKT           (ppm_timing.min_tackt * PPM_COUNT_SCALE)
+#define PIO_FREQ            (ppm_timing.pio_freq)
+#define MIN_INTERVAL_CYCLES (ppm_timing.min_interval_cycles * PPM_COUNT_SCALE)
+
+#define MAX_CODE          (1 << PPM_CODE_BITS)
 #define MIN_PULSE_PERIOD  3.0f
 #define AUDIO_SAMPLE_RATE 48000
 
+// Link symbols. Data codes are 0..MAX_CODE-1, two reserved widths sit above them:
+// idle keeps the link clocked when there is no audio, sync marks the start of a block.
+// pulse_generator spends PPM_CYCLES_PER_COUNT PIO cycles per pause count, so the longest
+// symbol is PPM_CYCLES_PER_COUNT * (MIN_INTERVAL_CYCLES + PPM_SYNC_CODE) cycles: 8 us at
+// 250 MHz with 9 bit stereo codes against a 10.1 us slot at 48 kHz, 12 us with 10 bit mono
+// codes against 19.6 us. The fine detector halves the code part. 88.2/96 kHz halve the
+// slot, they are offered with two lanes or more.
+#define PPM_IDLE_CODE      (MAX_CODE + 48)
+#define PPM_SYNC_CODE      (MAX_CODE + 96)
+#define PPM_CODE_TOLERANCE 16    // Detector error accepted around each reserved width
+
+// Link blocks: sync, PPM_SYNC_INTERVAL frames (L, R in stereo), then a check symbol with the
+// CRC-8 of the data codes (ppm_block_crc). A pulse lost or gained anywhere in a block fails
+// the check or the length, the receiver drops that block and locks again at the next sync.
+// Up to PPM_CONCEAL_BLOCKS lost slots in a row are bridged by interpolation, longer
+// gaps are left to mic_task. A slot with only some of its lanes lost is filled in from the
+// lanes that made it.
+#define PPM_LINK_CHANNELS  CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX    // 1: L+R downmix, 2: interleaved L/R
+#define PPM_SYNC_INTERVAL  32                                    // Frames per block
+#define PPM_CONCEAL_BLOCKS 4                                     // Slots, 2.7 ms at 48 kHz on one lane
+
+#define PPM_FRAMES_PER_BLOCK      PPM_SYNC_INTERVAL
+#define PPM_CODES_PER_BLOCK       (PPM_LINK_CHANNELS * PPM_SYNC_INTERVAL)
+#define PPM_SYMBOLS_PER_BLOCK     (PPM_CODES_PER_BLOCK + 2)    // Sync and check symbol included
+#define PPM_MAX_SYMBOLS_PER_FRAME (PPM_LINK_CHANNELS + 2)      // A frame may open and close a block
+#define PPM_FRAMES_PER_SLOT       (PPM_FRAMES_PER_BLOCK * PPM_LANES)
+
+// Ring elements carry one frame: the left code in the low half, the right code in the high half
+#define PPM_FRAME(left, right) ((uint32_t)(left) | ((uint32_t)(right) << 16))
+#define PPM_FRAME_LEFT(frame)  ((frame) & 0xFFFFu)
+#define PPM_FRAME_RIGHT(frame) ((frame) >> 16)
+
+// DMA transmit ring (pause widths fed to pulse_generator by a paced DMA channel)
+#define TX_DMA_RING_BITS 10                            // 1024 words = 4 KB, ~10 ms of stereo at 48 kHz
+#define TX_DMA_RING_SIZE (1u << TX_DMA_RING_BITS)
+#define TX_DMA_RING_MASK (TX_DMA_RING_SIZE - 1)
+#define TX_DMA_LEAD_MIN  16                            // Pad with idle symbols below this lead
+#define TX_DMA_LEAD_MAX  (TX_DMA_RING_SIZE / 2)        // Never write further ahead than this
+
+// Asynchronous speaker feedback: the host rate is steered so that the queued speaker
+// samples (USB FIFO + spk_ring + TX DMA lead) settle at this depth
+#define SPK_FB_TARGET_MS 2       // Target queue depth in ms of audio
+#define SPK_FB_SETTLE_MS 1000    // Time to correct a depth error of one sample
+
+// Microphone clock recovery: mic_ring fills at the far transmitter's clock and drains at
+// the host's. mic_task resamples between the two with a read rate trimmed by a PI loop on
+// the ring depth, so the depth holds at the target instead of drifting into an overflow
+// or underrun.
+#define MIC_RS_TARGET_MS    3       // Target depth in ms of audio, rides out a gap of PPM_CONCEAL_BLOCKS
+#define MIC_RS_SETTLE_MS    1000    // Proportional path: time to correct a depth error
+#define MIC_RS_INTEGRATE_MS 4000    // Integral path, 4x the settle time for a critically damped loop
+#define MIC_RS_MAX_PPM      1000    // Trim limit, well beyond both crystals' tolerance
+
+// DMA receive ring, a ppm_link capture ring of raw pulse_detector counts read by update_measurements
+#define RX_DMA_RING_BITS 10    // 1024 words = 4 KB
+#define RX_DMA_RING_SIZE (1u << RX_DMA_RING_BITS)
+
 /* Blink pattern
  * - 25 ms   : streaming data
  * - 250 ms  : device not mounted
@@ -64,58 +164,60 @@ enum
 };
 
 static const float MIN_PULSE_PERIOD_US = MIN_PULSE_PERIOD / 2;
-static const float PIO_FREQ            = SYS_FREQ * 1000.0f;
-
-static const uint16_t MIN_INTERVAL_CYCLES =
-    MIN_PULSE_PERIOD_US * (SYS_FREQ / 1000);
 
 // Main function signatures
 void first_core_main(void);     // Function for Core0 (receiver)
 void second_core_main(void);    // Function for Core1 (transmitter + interface)
 
-// Statistics structure
+// Telemetry counters, streamed by statistics_task (ppm_common/ppm_telemetry.h).
+// Every field has a single writer, the core in brackets.
 typedef struct {
-    uint32_t total_pcm_received;
-    uint32_t total_ppm_convert;
-    uint32_t total_pcm_convert;
-    uint32_t total_ppm_sent;
-    uint32_t total_ppm_received;
-    uint32_t total_sent;
-    uint32_t total_received;
-    uint64_t total_summed_ppm_out;    // Sum of all PPM values at output
-    uint64_t total_summed_ppm_in;     // Sum of all PPM values at input
-    uint64_t total_summed_ppm_in_usb; // Sum of all PPM values after reception, before USB transmission
-    uint64_t total_ticks_attempt_send_to_usb;
-    uint64_t total_bytes_sent_to_usb;
+    // Throughput, free running
+    uint32_t total_pcm_received;         // [0] Speaker frames taken from the USB OUT FIFO
+    uint32_t total_ppm_sent;             // [0] Symbols queued for the pulse generator, sync and idle included
+    uint32_t total_ppm_received;         // [1] Captures taken from the RX DMA ring
+    uint32_t total_received;             // [1] Frames decoded into mic_ring
+    uint64_t total_bytes_sent_to_usb;    // [0] Microphone bytes handed to the IN endpoint
+    // Losses, ring overflows and underflows are counted by the rings themselves
+    uint32_t tx_idle_symbols;      // [0] Idle symbols padded in while spk_ring was empty
+    uint32_t tx_overruns;          // [0] TX DMA ran past the queued symbols and replayed old ones
+    uint32_t rx_overruns;          // [1] Captures overwritten before update_measurements got to them
+    uint32_t rx_sync_errors;         // [1] Blocks cut short by the next sync
+    uint32_t rx_crc_errors;          // [1] Complete blocks failing their check symbol
+    uint32_t rx_lost_blocks;         // [1] Blocks dropped for any reason, missed syncs included
+    uint32_t rx_concealed_frames;    // [1] Frames interpolated across lost blocks
+    uint32_t rx_bad_symbols;         // [1] Widths matching no symbol
+    uint32_t rx_detector_slips;      // [1] PPM_FINE_DETECTOR pairs found on different pauses, restarted
+    bool     rx_calibrated;          // [1] A stored calibration for the current clock profile is in use
+    uint32_t mic_padded_frames;      // [0] USB frames completed with concealed samples
+    // Microphone clock recovery
+    int32_t  mic_rs_trim;      // [0] Read rate - 1 in Q0.32, positive when the far transmitter runs fast
+    uint32_t mic_rs_primes;    // [0] Waits for mic_ring to refill to its target depth
+    // Queue depths
+    ppm_tm_level_t usb_out_level;       // [0] Speaker frames in the USB OUT FIFO
+    ppm_tm_level_t spk_ring_level;      // [0] Frames
+    ppm_tm_level_t tx_lead_level;       // [0] Symbols queued ahead of the TX DMA
+    ppm_tm_level_t rx_backlog_level;    // [1] Captures in the RX DMA ring not decoded yet
+    ppm_tm_level_t mic_ring_level;      // [1] Frames
+    // Stage latencies
+    ppm_tm_probe_t spk_probe;     // [0 -> 0] Out of the USB OUT FIFO -> out of spk_ring into the TX DMA ring
+    ppm_tm_probe_t tx_probe;      // [0 -> 0] Into the TX DMA ring -> fetched by the DMA, a PIO FIFO ahead of the pulse
+    ppm_tm_probe_t mic_probe;     // [1 -> 0] Decoded from the RX DMA ring -> written to the USB IN FIFO
+    ppm_tm_hist_t  core0_loop;    // [0] USB loop period
+    ppm_tm_hist_t  core1_loop;    // [1] Receiver loop period
 } statistics_t;
 
-// Structure for speaker double buffering
-typedef struct {
-    uint16_t          ppm_buffer[(CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ / 4) / 2];    // Buffer for ready PPM values
-    volatile uint16_t size;                                                           // Number of PPM values in buffer
-    volatile uint16_t position;                                                       // Current position for reading
-    volatile bool     ready;                                                          // Buffer ready for use
-} spk_ppm_buffer_t;
-
-// Structure for microphone double buffering
-typedef struct {
-    int32_t           pcm_buffer[CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ / 4];    // Buffer for PCM data
-    volatile uint16_t size;                                                    // Data size in buffer
-    volatile uint16_t position;                                                // Current position for writing (changed from int)
-    volatile bool     ready;                                                   // Buffer ready for transmission
-} mic_pcm_buffer_t;
+#define TELEMETRY_PERIOD_MS 500    // Snapshot interval on the CDC telemetry interface
 
-// Structure for data exchange between cores
-typedef struct {
-    uint32_t          buffer[2][48];
-    volatile uint16_t size[2];
-    volatile uint16_t packet_size;
-    volatile uint8_t  write_index;
-    volatile uint8_t  read_index;
-    semaphore_t       sem_empty;
-    semaphore_t       sem_full;
-} core_shared_buffer_t;
+// Inter-core sample rings (storage lives in shared_variables.c)
+#define SPK_RING_BITS 10    // Speaker PCM -> PPM frames -> TX DMA feeder
+#define SPK_RING_SIZE (1u << SPK_RING_BITS)
+#define MIC_RING_BITS 10    // Receiver (core1) -> decoded PPM frames -> mic_task (core0)
+#define MIC_RING_SIZE (1u << MIC_RING_BITS)
 
 // Declaration of shared variables
-extern core_shared_buffer_t shared_ppm_data;
-extern volatile bool        sem_initialized;
+extern spsc_ring_t  spk_ring;
+extern spsc_ring_t  mic_ring;
+extern statistics_t statistics;
+
+void init_shared_rings(void);
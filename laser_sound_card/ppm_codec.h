@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+// PCM <-> PPM code conversion.
+//
+// A PPM code is the offset-binary value of the top PPM_CODE_BITS of a sample, so every
+// supported resolution converts with one add/xor and one shift, no multiply or divide.
+// Decoding returns the centre of the quantisation step. Anything modelling the link on
+// the host has to mirror these formulas bit for bit.
+
+#ifndef PPM_CODE_BITS
+#define PPM_CODE_BITS 10
+#endif
+#define PPM_CODE_MAX  ((1u << PPM_CODE_BITS) - 1)
+
+// 16 bit samples in 16 bit slots
+static inline uint32_t ppm_encode_s16(int32_t sample) {
+    return (uint32_t)(sample + 32768) >> (16 - PPM_CODE_BITS);
+}
+
+static inline int16_t ppm_decode_s16(uint32_t code) {
+    if (code > PPM_CODE_MAX)
+        code = PPM_CODE_MAX;
+    return (int16_t)((int32_t)(code << (16 - PPM_CODE_BITS)) - 32768 + (1 << (15 - PPM_CODE_BITS)));
+}
+
+// 24 bit samples left justified in 32 bit slots (UAC2 subslot of 4 bytes)
+static inline uint32_t ppm_encode_s32(int32_t sample) {
+    return ((uint32_t)sample ^ 0x80000000u) >> (32 - PPM_CODE_BITS);
+}
+
+static inline int32_t ppm_decode_s32(uint32_t code) {
+    if (code > PPM_CODE_MAX)
+        code = PPM_CODE_MAX;
+    return (int32_t)(((code << (32 - PPM_CODE_BITS)) ^ 0x80000000u) | (1u << (31 - PPM_CODE_BITS)));
+}
+
+// Fine codes carry the fraction an interpolation leaves between two codes: a 16 bit
+// offset-binary value whose top PPM_CODE_BITS are the code. ppm_code_to_fine returns the
+// centre of the step, so decoding a fine code taken from a code matches the decoders above.
+static inline uint32_t ppm_code_to_fine(uint32_t code) {
+    if (code > PPM_CODE_MAX)
+        code = PPM_CODE_MAX;
+    return (code << (16 - PPM_CODE_BITS)) | (1u << (15 - PPM_CODE_BITS));
+}
+
+static inline int16_t ppm_fine_to_s16(uint32_t fine) {
+    return (int16_t)((int32_t)fine - 32768);
+}
+
+static inline int32_t ppm_fine_to_s32(uint32_t fine) {
+    return (int32_t)((fine << 16) ^ 0x80000000u);
+}
+
+// Link block check: CRC-8, polynomial 0x07, over the data codes of a block, PPM_CODE_BITS
+// per code MSB first, starting from PPM_CRC_INIT. Bitwise, so the hot paths stay clear of
+// a flash table.
+#define PPM_CRC_INIT 0xFFu
+
+static inline uint32_t ppm_block_crc(uint32_t crc, uint32_t code) {
+    for (int32_t bit = PPM_CODE_BITS - 1; bit >= 0; bit--) {
+        uint32_t feedback = ((code >> bit) ^ (crc >> 7)) & 1u;
+        crc               = ((crc << 1) & 0xFFu) ^ (0x07u & (0u - feedback));
+    }
+    return crc;
+}
@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Host model of the laser link, bit exact with the firmware
+
+Mirrors the code conversion of ppm_codec.h, the block framing and CRC of
+transmitter.c and the symbol decoding, block check and concealment of
+receiver.c, on whole numpy arrays. The constants are read from the firmware
+headers (ppm_codec.h, common.h, ppm_timing.c), so the model follows them
+without edits.
+
+Between the two ends sits a channel model in detector counts: Gaussian timing
+jitter, pulses lost at random, and a calibration error (the receiver
+correcting with a different MIN_TACKT than the one the detector shows).
+
+    python3 ppm_sim.py --jitter 0 0.5 1 2 --miss 0 1e-5 1e-4 --seconds 10
+
+sweeps every combination and prints the block loss and SNR of each. One lane
+is modelled; the resampler of mic_task is taken at its nominal rate, which
+passes codes through unchanged.
+"""
+
+import argparse
+import itertools
+import os
+import re
+import sys
+
+import numpy as np
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+COMMON = os.path.join(HERE, "..", "ppm_common")
+
+
+def read_defines(*headers):
+    """Every '#define NAME value' of the headers, first one wins (#ifndef defaults)"""
+    defines = {}
+    pattern = re.compile(r"^\s*#define\s+(\w+)\s+([^/\n]+?)\s*(?://.*)?$")
+    for header in headers:
+        with open(header, encoding="utf-8") as f:
+            for line in f:
+                match = pattern.match(line)
+                if match and match.group(1) not in defines:
+                    defines[match.group(1)] = match.group(2)
+    return defines
+
+
+def resolve(defines, name, seen=()):
+    """Integer value of a define made of numbers, other defines and + - * / << >>"""
+    expr = re.sub(r"\b(0x[0-9A-Fa-f]+|\d+)[uUlL]*\b", r"\1", defines[name])
+    for ident in set(re.findall(r"\b[A-Za-z_]\w*\b", expr)):
+        if ident in seen:
+            raise ValueError(f"{name}: recursive define")
+        expr = re.sub(rf"\b{ident}\b", str(resolve(defines, ident, seen + (name,))), expr)
+    return int(eval(expr.replace("/", "//"), {"__builtins__": {}}))
+
+
+def read_profiles(source):
+    """sys_khz -> min_tackt from the ppm_timing_profiles table"""
+    with open(source, encoding="utf-8") as f:
+        return {int(khz): int(tackt) for khz, tackt in re.findall(r"\{\s*(\d+)\s*,\s*(\d+)\s*,\s*\d+\s*,", f.read())}
+
+
+class Link:
+    """Firmware constants and the codec, vectorised"""
+
+    def __init__(self, channels=2, sys_khz=250000, fine_detector=False, min_pulse_period_us=1.5):
+        codec = read_defines(os.path.join(HERE, "ppm_codec.h"))
+        d = read_defines(os.path.join(HERE, "common.h"), os.path.join(HERE, "ppm_codec.h"))
+        if channels == 1:
+            d["PPM_CODE_BITS"] = codec["PPM_CODE_BITS"]  # common.h sets 9 bits for stereo only
+        self.code_bits = resolve(d, "PPM_CODE_BITS")
+        self.code_max = (1 << self.code_bits) - 1
+        self.max_code = resolve(d, "MAX_CODE")
+        self.crc_init = resolve(d, "PPM_CRC_INIT")
+        self.idle_code = resolve(d, "PPM_IDLE_CODE")
+        self.sync_code = resolve(d, "PPM_SYNC_CODE")
+        self.tolerance = resolve(d, "PPM_CODE_TOLERANCE")
+        self.frames_per_block = resolve(d, "PPM_SYNC_INTERVAL")
+        self.conceal_blocks = resolve(d, "PPM_CONCEAL_BLOCKS")
+
+        self.channels = channels
+        self.codes_per_block = channels * self.frames_per_block
+        self.symbols_per_block = self.codes_per_block + 2
+
+        # Timing of the profile in pause counts, as MIN_TACKT and MIN_INTERVAL_CYCLES
+        scale = 2 if fine_detector else 1
+        tackt = read_profiles(os.path.join(COMMON, "ppm_timing.c"))
+        if sys_khz not in tackt:
+            raise ValueError(f"no timing profile for {sys_khz} kHz")
+        self.min_tackt = tackt[sys_khz] * scale
+        pulse = resolve(read_defines(os.path.join(COMMON, "ppm_link.h")), "PPM_LINK_PULSE_COUNTS")
+        self.min_interval = (int(np.float32(min_pulse_period_us) * (np.float32(sys_khz) / np.float32(1000))) - pulse) * scale
+
+    # ppm_codec.h
+
+    def encode_s16(self, samples):
+        return (np.asarray(samples, np.int32) + 32768).astype(np.uint32) >> (16 - self.code_bits)
+
+    def decode_s16(self, codes):
+        codes = np.minimum(np.asarray(codes, np.uint32), self.code_max).astype(np.int32)
+        return ((codes << (16 - self.code_bits)) - 32768 + (1 << (15 - self.code_bits))).astype(np.int16)
+
+    def encode_s32(self, samples):
+        return (np.asarray(samples, np.int32).view(np.uint32) ^ np.uint32(0x80000000)) >> (32 - self.code_bits)
+
+    def decode_s32(self, codes):
+        codes = np.minimum(np.asarray(codes, np.uint32), self.code_max)
+        value = (codes << np.uint32(32 - self.code_bits)) ^ np.uint32(0x80000000)
+        return (value | np.uint32(1 << (31 - self.code_bits))).view(np.int32)
+
+    def block_crc(self, codes):
+        """CRC of each row of codes, ppm_block_crc from PPM_CRC_INIT"""
+        codes = np.asarray(codes, np.uint32)
+        crc = np.full(codes.shape[0], self.crc_init, np.uint32)
+        for column in codes.T:
+            for bit in range(self.code_bits - 1, -1, -1):
+                feedback = ((column >> bit) ^ (crc >> 7)) & 1
+                crc = ((crc << 1) & 0xFF) ^ (0x07 * feedback)
+        return crc
+
+    # transmitter.c
+
+    def frames_from_samples(self, samples, bits=16):
+        """(n, 2) samples (s16, or 24 bit left justified in s32) -> (n, channels) codes"""
+        samples = np.asarray(samples, np.int32)
+        encode = self.encode_s16 if bits == 16 else self.encode_s32
+        if self.channels == 2:
+            return encode(samples)
+        return encode((samples[:, 0] >> 1) + (samples[:, 1] >> 1))[:, None]
+
+    def transmit(self, frames):
+        """Codes -> pause widths in counts: sync, the block's codes, check symbol per block"""
+        frames = np.asarray(frames, np.uint32)
+        blocks = len(frames) // self.frames_per_block
+        codes = frames[: blocks * self.frames_per_block].reshape(blocks, self.codes_per_block)
+        symbols = np.empty((blocks, self.symbols_per_block), np.int64)
+        symbols[:, 0] = self.sync_code
+        symbols[:, 1:-1] = codes
+        symbols[:, -1] = self.block_crc(codes)
+        return symbols.ravel() + self.min_interval
+
+    # receiver.c
+
+    def receive(self, raw, rx_tackt=None):
+        """
+        Raw detector counts -> (frames, received, concealed): the codes delivered to
+        mic_ring per frame slot from the first sync on, and how each slot was filled
+        """
+        tackt = self.min_tackt if rx_tackt is None else rx_tackt
+        width = np.asarray(raw, np.int64) + tackt - self.min_interval
+
+        idle = np.abs(width - self.idle_code) <= self.tolerance
+        width = width[~idle]
+        sync = np.abs(width - self.sync_code) <= self.tolerance
+        syncs = np.flatnonzero(sync)
+        empty = np.zeros((0, self.channels), np.uint32), np.zeros(0, bool), np.zeros(0, bool)
+        if len(syncs) == 0:
+            return empty
+
+        # Block numbers as the receiver counts them, from the symbols between syncs
+        between = np.diff(syncs) - 1
+        blocks = np.maximum((between + 1 + self.symbols_per_block // 2) // self.symbols_per_block, 1)
+        seq = np.concatenate(([0], np.cumsum(blocks)))
+
+        # Good blocks: the codes and the check in full before the next sync, every code in
+        # range, CRC matching
+        n = self.codes_per_block + 1
+        room = np.append(between, len(width) - syncs[-1] - 1)
+        whole = room >= n
+        syncs, seq = syncs[whole], seq[whole]
+        block = width[syncs[:, None] + 1 + np.arange(n)]
+        in_range = np.all((block >= -self.tolerance) & (block < self.max_code + self.tolerance), axis=1)
+        codes = np.clip(block, 0, self.code_max).astype(np.uint32)
+        good = in_range & (self.block_crc(codes[:, :-1]) == codes[:, -1])
+        codes, seq = codes[good, :-1], seq[good]
+        if len(seq) == 0:
+            return empty
+
+        # Slots by block number, block 0 opened by the first sync
+        frames = np.zeros((seq[-1] + 1, self.frames_per_block, self.channels), np.uint32)
+        received = np.zeros((seq[-1] + 1, self.frames_per_block), bool)
+        frames[seq] = codes.reshape(len(seq), self.frames_per_block, self.channels)
+        received[seq] = True
+        frames = frames.reshape(-1, self.channels)
+        received = received.ravel()
+
+        concealed = np.zeros_like(received)
+        self._conceal(frames, concealed, seq)
+        return frames, received, concealed
+
+    def _conceal(self, frames, concealed, seq):
+        """rx_conceal: a straight line in 16.16 over gaps of up to PPM_CONCEAL_BLOCKS"""
+        gap = np.diff(seq) - 1
+        short = (gap > 0) & (gap <= self.conceal_blocks)
+        if not np.any(short):
+            return
+        fpb = self.frames_per_block
+        first = seq[:-1][short] * fpb + fpb  # First frame lost
+        count = gap[short] * fpb
+        last = frames[first - 1].astype(np.int64) << 16
+        nxt = frames[first + count].astype(np.int64) << 16
+        delta = nxt - last
+        step = np.sign(delta) * (np.abs(delta) // (count + 1)[:, None])  # C division, towards zero
+
+        index = np.repeat(first, count) + np.arange(count.sum()) - np.repeat(np.cumsum(count) - count, count)
+        j = (index - np.repeat(first, count) + 1)[:, None]
+        frames[index] = (np.repeat(last, count, axis=0) + j * np.repeat(step, count, axis=0) + 0x8000) >> 16
+        concealed[index] = True
+
+
+class Channel:
+    """Detector counts for the transmitted widths"""
+
+    def __init__(self, link, jitter=0.0, miss=0.0, cal_error=0, seed=None):
+        self.link = link
+        self.jitter = jitter  # Standard deviation, counts
+        self.miss = miss  # Probability of a pulse lost
+        self.cal_error = cal_error  # Detector offset the calibration does not know about, counts
+        self.rng = np.random.default_rng(seed)
+
+    def __call__(self, widths):
+        raw = np.asarray(widths, np.int64) - self.link.min_tackt + self.cal_error
+        if self.jitter > 0:
+            raw = raw + np.rint(self.rng.normal(0, self.jitter, len(raw))).astype(np.int64)
+        if self.miss > 0:
+            # The pulse closing a pause is lost: the detector counts on through the next pause
+            lost = np.flatnonzero(self.rng.random(len(raw) - 1) < self.miss)
+            lost = lost[np.diff(lost, prepend=-2) > 1]  # One in a row, a run is the same case again
+            raw[lost + 1] += raw[lost] + self.link.min_tackt
+            raw = np.delete(raw, lost)
+        return raw
+
+
+def simulate(link, samples, channel, bits=16):
+    """Samples through the link, returns the codes sent and Link.receive's result"""
+    sent = link.frames_from_samples(samples, bits)
+    return (sent,) + link.receive(channel(link.transmit(sent)))
+
+
+def test_signal(seconds, rate=48000, bits=16, seed=0):
+    """Two tones plus a little noise, stereo"""
+    t = np.arange(int(seconds * rate)) / rate
+    rng = np.random.default_rng(seed)
+    full = (1 << (bits - 1)) - 1
+    left = 0.6 * np.sin(2 * np.pi * 997 * t) + 0.01 * rng.standard_normal(len(t))
+    right = 0.6 * np.sin(2 * np.pi * 3001 * t) + 0.01 * rng.standard_normal(len(t))
+    samples = np.clip(np.stack([left, right], axis=1) * full, -full - 1, full).astype(np.int32)
+    return samples << 8 if bits == 24 else samples
+
+
+def measure(link, sent, frames, received, concealed):
+    """Blocks lost, frames not delivered and SNR of what was delivered against what was sent"""
+    n = len(sent) - len(sent) % link.frames_per_block
+    if len(frames) == 0:
+        return 1.0, 1.0, float("-inf")
+    pad = n - min(n, len(frames))  # Blocks lost at the end
+    frames = np.concatenate((frames[:n], np.zeros((pad, link.channels), np.uint32)))
+    received = np.concatenate((received[:n], np.zeros(pad, bool)))
+    valid = received | np.concatenate((concealed[:n], np.zeros(pad, bool)))
+
+    blocks = received.reshape(-1, link.frames_per_block)[:, 0]
+    a = link.decode_s16(sent[:n]).astype(np.float64)
+    b = link.decode_s16(frames).astype(np.float64)
+    error = (a - b)[valid]
+    snr = 10 * np.log10(np.mean(a[valid] ** 2) / np.mean(error**2)) if np.any(error) else float("inf")
+    return 1 - np.mean(blocks), 1 - np.mean(valid), snr
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Sweep the laser link model")
+    parser.add_argument("--seconds", type=float, default=10.0, help="Signal length per case")
+    parser.add_argument("--channels", type=int, choices=(1, 2), default=2, help="PPM_LINK_CHANNELS")
+    parser.add_argument("--bits", type=int, choices=(16, 24), default=16, help="Sample resolution")
+    parser.add_argument("--sys-khz", type=int, default=250000, help="Timing profile")
+    parser.add_argument("--fine", action="store_true", help="PPM_FINE_DETECTOR")
+    parser.add_argument("--jitter", type=float, nargs="+", default=[0.0, 0.5, 1.0, 2.0], help="Counts RMS")
+    parser.add_argument("--miss", type=float, nargs="+", default=[0.0, 1e-5, 1e-4, 1e-3], help="Pulse loss")
+    parser.add_argument("--cal-error", type=int, nargs="+", default=[0], help="Counts")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    link = Link(args.channels, args.sys_khz, args.fine)
+    samples = test_signal(args.seconds, bits=args.bits)
+    print(f"{len(samples)} frames, {link.code_bits} bit codes, {args.channels} channel(s), "
+          f"min interval {link.min_interval}, tackt {link.min_tackt}", file=sys.stderr)
+    print(f"{'jitter':>7} {'miss':>8} {'cal':>4} {'blocks lost':>12} {'undelivered':>12} {'SNR dB':>8}")
+
+    for jitter, miss, cal in itertools.product(args.jitter, args.miss, args.cal_error):
+        channel = Channel(link, jitter, miss, cal, args.seed)
+        lost, undelivered, snr = measure(link, *simulate(link, samples, channel, args.bits))
+        print(f"{jitter:7.2f} {miss:8.1e} {cal:4d} {lost:12.2e} {undelivered:12.2e} {snr:8.2f}")
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
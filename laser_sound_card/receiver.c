@@ -1,137 +1,530 @@
 #include "common.h"
-#include "pico/sem.h"
 #include <pico/stdlib.h>
 
-static PIO           pio = pio0;
-static uint          sm_det;
+static PIO const     pio = pio0;
 static volatile bool detector_running = false;
 
-// extern statistics_t statistics;
-
-// void update_measurements() {
-//     static uint16_t buffer_pos       = 0;
-//     static uint8_t  current_buffer   = 0;
-//     static bool     buffer_acquired  = false;
-//     //static uint32_t last_packet_size = 192;    // Начальный размер по умолчанию
-
-//     // Получаем текущий размер пакета от первого ядра
-//     // if (sem_initialized) {
-//     //     // Храним актуальный размер пакета для межъядерного обмена
-//     //     last_packet_size = shared_ppm_data.packet_size > 0 ? shared_ppm_data.packet_size : last_packet_size;
-//     // }
-
-//     while (detector_running && !pio_sm_is_rx_fifo_empty(pio, sm_det)) {
-//         uint32_t measured_width  = pio_sm_get(pio, sm_det);
-//         uint16_t corrected_width = (uint16_t)(measured_width + MIN_TACKT) - MIN_INTERVAL_CYCLES;
-//         statistics.total_received++;
-
-//         if (corrected_width > 0 && corrected_width <= MAX_CODE) {
-//             statistics.total_ppm_received++;
-//             statistics.total_summed_ppm_in += corrected_width;
-//             // Если система семафоров инициализирована
-//             if (sem_initialized) {
-//                 // Если буфер ещё не получен - пробуем получить пустой буфер
-//                 if (!buffer_acquired) {
-//                     if (sem_try_acquire(&shared_ppm_data.sem_empty)) {
-//                         // Получен пустой буфер
-//                         current_buffer  = shared_ppm_data.write_index;
-//                         buffer_pos      = 0;
-//                         buffer_acquired = true;
-//                     }
-//                 }
-
-//                 // Записываем данные, если буфер доступен
-//                 if (buffer_acquired) {
-//                     shared_ppm_data.buffer[current_buffer][buffer_pos++] = corrected_width;
-
-//                     // Если буфер заполнен до размера пакета, уведомляем другое ядро
-//                     if (/*buffer_pos >= last_packet_size / 4 ||*/ buffer_pos >= 48) {    // Делим на 4 для стерео 16 бит
-//                         shared_ppm_data.size[current_buffer] = buffer_pos;
-//                         shared_ppm_data.write_index          = (uint8_t)((current_buffer + 1) % 2);
-//                         sem_release(&shared_ppm_data.sem_full);
-//                         buffer_acquired = false;
-//                     }
-//                 }
-//             }
-//             // Иначе используем старый механизм FIFO
-//             else if (multicore_fifo_wready()) {
-//                 multicore_fifo_push_blocking(corrected_width);
-//             }
-//         }
-//     }
-
-//     // Если буфер частично заполнен и давно не было данных,
-//     // отправляем то что есть (по таймауту)
-//     if (buffer_acquired && buffer_pos > 0) {
-//         static uint32_t last_update_time = 0;
-//         uint32_t        current_time     = time_us_32();
-
-//         // Исправление во второй части функции (по таймауту)
-//         if (current_time - last_update_time > 5000) {    // 5 мс
-//             shared_ppm_data.size[current_buffer] = buffer_pos;
-//             shared_ppm_data.write_index          = (uint8_t)((current_buffer + 1) % 2);
-//             sem_release(&shared_ppm_data.sem_full);
-//             buffer_acquired  = false;
-//             last_update_time = current_time;
-//         }
-//     }
-// }
-
-void update_measurements() {
-    while (detector_running && !pio_sm_is_rx_fifo_empty(pio, sm_det)) {
-        uint32_t measured_width  = pio_sm_get(pio, sm_det);
-        uint32_t corrected_width = (measured_width + MIN_TACKT) - MIN_INTERVAL_CYCLES;
-
-        if (corrected_width > 0 && corrected_width <= MAX_CODE) {
-            if (multicore_fifo_wready()) {
-                multicore_fifo_push_blocking(corrected_width);
+static const uint rx_lane_pins[PPM_LANES_MAX] = PPM_LANE_DET_PINS;
+
+// One detector (a pair with PPM_FINE_DETECTOR), its capture ring and its block receiver
+typedef struct {
+    uint               sm;
+    ppm_link_capture_t capture;
+#if PPM_FINE_DETECTOR
+    uint               sm_late;
+    ppm_link_capture_t capture_late;    // Read at capture.consumed, its own count unused
+#endif
+    // Block receiver, see the link blocks in common.h
+    uint16_t block[PPM_CODES_PER_BLOCK];    // Data codes of the open block
+    int32_t  codes;                         // Codes in block, -1: no block open
+    uint32_t crc;                           // Over block so far
+    bool     locked;                        // A sync was seen since the detector started
+    bool     block_done;                    // The block opened by the last sync was delivered
+    uint32_t symbols_since_sync;            // Idle symbols not counted
+    uint32_t lost;                          // Blocks lost since the lane last filled a slot
+    uint32_t last_seq;                      // Slot the lane last filled
+} rx_lane_t;
+
+static rx_lane_t rx_lanes[PPM_LANES];
+
+// Captures are streamed by DMA from each detector RX FIFO into its ring
+static uint32_t rx_dma_rings[PPM_LANES][RX_DMA_RING_SIZE] __attribute__((aligned(RX_DMA_RING_SIZE * sizeof(uint32_t))));
+
+#if PPM_FINE_DETECTOR
+// pulse_detector_late of each lane and its ring, filled in step with the one above
+static uint32_t rx_dma_rings_late[PPM_LANES][RX_DMA_RING_SIZE]
+    __attribute__((aligned(RX_DMA_RING_SIZE * sizeof(uint32_t))));
+static uint det_offset;
+static uint det_late_offset;
+#endif
+
+// Raw count -> pause width offsets from the 'T' sweep, MIN_TACKT everywhere if uncalibrated
+static int8_t rx_cal[PPM_CAL_WIDTHS] PPM_RT_CORE1_DATA;
+
+// Slot being assembled: frame i travelled on lane i % PPM_LANES. It is delivered once every
+// lane filled its part, or early when a lane comes round again, the missing lanes concealed.
+static uint32_t rx_slot[PPM_FRAMES_PER_SLOT];
+static uint32_t rx_slot_lanes   = 0;                                        // Lanes in rx_slot, bit per lane
+static uint32_t rx_slot_claim   = 0;                                        // Sequence number the lanes in it put on it
+static uint32_t rx_slot_seq     = 0;                                        // Last slot delivered
+static uint32_t rx_slot_missing = 0;                                        // Lanes missing from it, traced on change
+static uint32_t rx_last_frame   = PPM_FRAME(MAX_CODE / 2, MAX_CODE / 2);    // Interpolation start
+
+#define RX_ALL_LANES ((1u << PPM_LANES) - 1)
+#define RX_LANE_STEP 8    // Captures taken from a lane before the next one, keeps the lanes level
+
+#if PPM_FINE_DETECTOR
+static void rx_detector_restart(rx_lane_t *lane);
+#endif
+
+// Total number of captures written by the DMA since it was armed. The fine detector's
+// captures are complete once both rings have them.
+static inline uint32_t rx_dma_written(const rx_lane_t *lane) {
+    uint32_t written = ppm_link_capture_written(&lane->capture);
+#if PPM_FINE_DETECTOR
+    uint32_t late = ppm_link_capture_written(&lane->capture_late);
+    if (late < written)
+        written = late;
+#endif
+    return written;
+}
+
+static inline uint32_t rx_lane_index(const rx_lane_t *lane) {
+    return (uint32_t)(lane - rx_lanes);
+}
+
+static uint32_t rx_lane_dma_mask(const rx_lane_t *lane) {
+#if PPM_FINE_DETECTOR
+    return (1u << lane->capture.chan) | (1u << lane->capture_late.chan);
+#else
+    return 1u << lane->capture.chan;
+#endif
+}
+
+// Started together with rx_lane_dma_mask
+static void rx_dma_arm(rx_lane_t *lane) {
+    ppm_link_capture_arm(&lane->capture, false);
+#if PPM_FINE_DETECTOR
+    ppm_link_capture_arm(&lane->capture_late, false);
+#endif
+}
+
+// Hand frames to mic_ring, which counts what does not fit. Returns the frames taken.
+static uint32_t PPM_RT_FUNC(rx_deliver)(const uint32_t *frames, uint32_t n) {
+    uint32_t pushed = spsc_ring_push(&mic_ring, frames, n);
+    if (pushed < n)
+        ppm_trace(PPM_TRACE_MIC_OVERFLOW, n - pushed, 0);
+    return pushed;
+}
+
+// Bridge the lost slots with a straight line per channel, from the last frame delivered
+// to the first frame of the slot that ends the gap
+static void PPM_RT_FUNC(rx_conceal)(uint32_t next, uint32_t slots) {
+    uint32_t frames = slots * PPM_FRAMES_PER_SLOT;
+    int32_t  left   = (int32_t)PPM_FRAME_LEFT(rx_last_frame) << 16;
+    int32_t  right  = (int32_t)PPM_FRAME_RIGHT(rx_last_frame) << 16;
+    int32_t  dleft  = (((int32_t)PPM_FRAME_LEFT(next) << 16) - left) / (int32_t)(frames + 1);
+    int32_t  dright = (((int32_t)PPM_FRAME_RIGHT(next) << 16) - right) / (int32_t)(frames + 1);
+
+    uint32_t out[PPM_FRAMES_PER_BLOCK];
+    for (uint32_t done = 0; done < frames; done += PPM_FRAMES_PER_BLOCK) {
+        for (uint32_t i = 0; i < PPM_FRAMES_PER_BLOCK; i++) {
+            left += dleft;
+            right += dright;
+            out[i] = PPM_FRAME((uint32_t)(left + 0x8000) >> 16, (uint32_t)(right + 0x8000) >> 16);
+        }
+        statistics.rx_concealed_frames += rx_deliver(out, PPM_FRAMES_PER_BLOCK);
+    }
+}
+
+// Frames of the lanes missing from the slot: a straight line per channel from the frame in
+// front to the next one that arrived, held at the end of the slot. Returns the frames filled.
+static uint32_t PPM_RT_FUNC(rx_slot_fill)(void) {
+    uint32_t prev   = rx_last_frame;
+    uint32_t filled = 0;
+
+    for (uint32_t p = 0; p < PPM_FRAMES_PER_SLOT; p++) {
+        if (rx_slot_lanes & (1u << (p % PPM_LANES))) {
+            prev = rx_slot[p];
+            continue;
+        }
+
+        uint32_t q = p + 1;
+        while (q < PPM_FRAMES_PER_SLOT && !(rx_slot_lanes & (1u << (q % PPM_LANES))))
+            q++;
+        uint32_t next  = q < PPM_FRAMES_PER_SLOT ? rx_slot[q] : prev;
+        int32_t  steps = (int32_t)(q - p + 1);
+        int32_t  left  = (int32_t)PPM_FRAME_LEFT(prev);
+        int32_t  right = (int32_t)PPM_FRAME_RIGHT(prev);
+
+        left += ((int32_t)PPM_FRAME_LEFT(next) - left) / steps;
+        right += ((int32_t)PPM_FRAME_RIGHT(next) - right) / steps;
+        prev = rx_slot[p] = PPM_FRAME(left, right);
+        filled++;
+    }
+    return filled;
+}
+
+// Deliver the slot: fill in the missing lanes, conceal the slots lost in front of it
+static void PPM_RT_FUNC(rx_slot_close)(void) {
+    uint32_t seq  = rx_slot_claim;
+    int32_t  lost = (int32_t)(seq - rx_slot_seq - 1);
+    if (lost < 0) {
+        lost = 0;
+        seq  = rx_slot_seq + 1;
+    }
+
+    uint32_t missing = RX_ALL_LANES & ~rx_slot_lanes;
+    if (missing)
+        statistics.rx_concealed_frames += rx_slot_fill();
+    if (missing != rx_slot_missing) {
+        ppm_trace(PPM_TRACE_RX_LANES_MISSING, missing, rx_slot_lanes);
+        rx_slot_missing = missing;
+    }
+
+    if (lost) {
+        if (lost <= PPM_CONCEAL_BLOCKS) {
+            rx_conceal(rx_slot[0], (uint32_t)lost);
+            ppm_trace(PPM_TRACE_RX_CONCEALED, (uint32_t)lost * PPM_FRAMES_PER_SLOT, (uint32_t)lost);
+        }
+        else {
+            ppm_trace(PPM_TRACE_RX_CONCEALED, 0, (uint32_t)lost);
+        }
+    }
+
+    // Tag the first frame for the RX -> USB IN latency if none is on its way
+    ppm_tm_probe_start(&statistics.mic_probe, mic_ring.head);
+    statistics.total_received += rx_deliver(rx_slot, PPM_FRAMES_PER_SLOT);
+    rx_last_frame = rx_slot[PPM_FRAMES_PER_SLOT - 1];
+
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        if (rx_slot_lanes & (1u << i)) {
+            rx_lanes[i].last_seq = seq;
+            rx_lanes[i].lost     = 0;
+        }
+    }
+    rx_slot_seq   = seq;
+    rx_slot_lanes = 0;
+}
+
+// A block passed its check: put its frames in their places in the slot
+static void PPM_RT_FUNC(rx_block_good)(rx_lane_t *lane) {
+    uint32_t i   = rx_lane_index(lane);
+    uint32_t bit = 1u << i;
+    uint32_t seq = lane->last_seq + 1 + lane->lost;
+
+    // The lane is a block ahead of the others, the slot will not fill
+    if (rx_slot_lanes & bit)
+        rx_slot_close();
+    if (rx_slot_lanes == 0 || (int32_t)(seq - rx_slot_claim) < 0)
+        rx_slot_claim = seq;
+
+    uint32_t *dst = &rx_slot[i];
+    for (uint32_t f = 0; f < PPM_FRAMES_PER_BLOCK; f++) {
+#if PPM_LINK_CHANNELS == 2
+        *dst = PPM_FRAME(lane->block[2 * f], lane->block[2 * f + 1]);
+#else
+        *dst = lane->block[f];
+#endif
+        dst += PPM_LANES;
+    }
+
+    rx_slot_lanes |= bit;
+    if (rx_slot_lanes == RX_ALL_LANES)
+        rx_slot_close();
+}
+
+// Take one corrected width
+static void PPM_RT_FUNC(rx_symbol)(rx_lane_t *lane, int32_t width) {
+    if (width >= PPM_IDLE_CODE - PPM_CODE_TOLERANCE && width <= PPM_IDLE_CODE + PPM_CODE_TOLERANCE)
+        return;
+
+    if (width >= PPM_SYNC_CODE - PPM_CODE_TOLERANCE && width <= PPM_SYNC_CODE + PPM_CODE_TOLERANCE) {
+        if (lane->locked) {
+            if (lane->codes >= 0) {
+                statistics.rx_sync_errors++;
+                ppm_trace(PPM_TRACE_RX_SYNC_ERROR, lane->symbols_since_sync, rx_lane_index(lane));
             }
+            // Blocks since the last sync, rounded, at least the one it opened. Those not
+            // delivered are lost, a missed sync loses the block behind it as well.
+            uint32_t blocks = (lane->symbols_since_sync + 1 + PPM_SYMBOLS_PER_BLOCK / 2) / PPM_SYMBOLS_PER_BLOCK;
+            if (blocks == 0)
+                blocks = 1;
+            if (lane->block_done)
+                blocks--;
+            lane->lost += blocks;
+            statistics.rx_lost_blocks += blocks;
+        }
+        else {
+            // First block of the lane fills the next slot
+            lane->last_seq = rx_slot_seq;
+            lane->lost     = 0;
+        }
+        lane->locked             = true;
+        lane->block_done         = false;
+        lane->codes              = 0;
+        lane->crc                = PPM_CRC_INIT;
+        lane->symbols_since_sync = 0;
+        return;
+    }
+    lane->symbols_since_sync++;
+
+    // The block cannot pass its check any more, wait for the next sync
+    if (width < -PPM_CODE_TOLERANCE || width >= MAX_CODE + PPM_CODE_TOLERANCE) {
+        statistics.rx_bad_symbols++;
+        lane->codes = -1;
+        return;
+    }
+    if (lane->codes < 0)
+        return;
+
+    // Detector error around the edges of the code range
+    uint32_t code = width < 0 ? 0 : (uint32_t)width;
+    if (code > PPM_CODE_MAX)
+        code = PPM_CODE_MAX;
+
+    if (lane->codes < PPM_CODES_PER_BLOCK) {
+        lane->block[lane->codes++] = (uint16_t)code;
+        lane->crc                  = ppm_block_crc(lane->crc, code);
+        return;
+    }
+
+    // Check symbol
+    lane->codes = -1;
+    if (code != lane->crc) {
+        statistics.rx_crc_errors++;
+        ppm_trace(PPM_TRACE_RX_CRC_ERROR, code, lane->crc);
+        return;
+    }
+    lane->block_done = true;
+    rx_block_good(lane);
+}
+
+// Decode up to n of the captures written for a lane. Returns true if it has more waiting.
+static bool PPM_RT_FUNC(rx_lane_take)(rx_lane_t *lane, uint32_t *written, uint32_t n) {
+    ppm_link_capture_t *capture      = &lane->capture;
+    int32_t             tackt        = MIN_TACKT;
+    int32_t             min_interval = MIN_INTERVAL_CYCLES;
+
+    while (capture->consumed != *written && n--) {
+        uint32_t measured_width = ppm_link_capture_at(capture, capture->consumed);
+#if PPM_FINE_DETECTOR
+        // Both counted the same pause one cycle apart. Further apart, one of them missed a
+        // pulse and they have been counting different pauses since.
+        uint32_t late = ppm_link_capture_at(&lane->capture_late, capture->consumed);
+        if (measured_width - late + 1 > 2) {
+            statistics.rx_detector_slips++;
+            ppm_trace(PPM_TRACE_RX_DET_SLIP, measured_width, late);
+            rx_detector_restart(lane);
+            *written = 0;
+            return false;
+        }
+        measured_width += late;
+#endif
+        int32_t corrected_width = (int32_t)ppm_cal_correct(rx_cal, measured_width, tackt) - min_interval;
+        capture->consumed++;
+        rx_symbol(lane, corrected_width);
+    }
+    return capture->consumed != *written;
+}
+
+void PPM_RT_FUNC(update_measurements)() {
+    if (!detector_running) {
+        return;
+    }
+
+    uint32_t written[PPM_LANES];
+    uint32_t backlog = 0;
+
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        rx_lane_t *lane = &rx_lanes[i];
+        written[i]      = rx_dma_written(lane);
+
+        // Consumer fell a whole ring behind, skip to the oldest capture still intact
+        uint32_t skipped = ppm_link_capture_skip(&lane->capture, written[i]);
+        if (skipped) {
+            statistics.rx_overruns += skipped;
+            ppm_trace(PPM_TRACE_RX_OVERRUN, skipped, i);
+            // The skipped captures count towards the blocks lost, the open block is one of them
+            lane->symbols_since_sync += skipped;
+            lane->codes = -1;
+        }
+        backlog += written[i] - lane->capture.consumed;
+    }
+    ppm_tm_level_set(&statistics.rx_backlog_level, backlog);
+    statistics.total_ppm_received += backlog;
+
+    // Lanes in small steps, so blocks sent together reach the slot together
+    bool more = true;
+    while (more) {
+        more = false;
+        for (uint32_t i = 0; i < PPM_LANES; i++) {
+            if (rx_lane_take(&rx_lanes[i], &written[i], RX_LANE_STEP))
+                more = true;
+        }
+    }
+    ppm_tm_level_set(&statistics.mic_ring_level, spsc_ring_count(&mic_ring));
+
+    // Transfer count ran out (~12 h at the stereo 48 kHz symbol rate); the detector FIFO holds captures meanwhile
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        rx_lane_t *lane = &rx_lanes[i];
+        if (ppm_link_capture_done(&lane->capture)) {
+            rx_dma_arm(lane);
+            dma_start_channel_mask(rx_lane_dma_mask(lane));
+            ppm_trace(PPM_TRACE_RX_DMA_REARM, i, 0);
         }
     }
 }
 
-// Initialize PIO for pulse detector
-void init_pulse_detector(float freq) {
+void init_rx_dma() {
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        rx_lane_t *lane = &rx_lanes[i];
+        ppm_link_capture_init(&lane->capture, pio, lane->sm, rx_dma_rings[i], RX_DMA_RING_BITS);
+#if PPM_FINE_DETECTOR
+        ppm_link_capture_init(&lane->capture_late, pio, lane->sm_late, rx_dma_rings_late[i], RX_DMA_RING_BITS);
+#endif
+    }
+}
+
+// Initialize PIO for the pulse detector of every lane, RX only, DMA drains it
+void init_pulse_detector(uint32_t pio_hz) {
+    uint offset = ppm_link_load(pio, PPM_LINK_DETECTOR);
+#if PPM_FINE_DETECTOR
+    det_offset      = offset;
+    det_late_offset = ppm_link_load(pio, PPM_LINK_DETECTOR_LATE);
+#endif
+
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        rx_lane_t *lane = &rx_lanes[i];
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+        lane->sm = pio_claim_unused_sm(pio, true);
+#pragma GCC diagnostic pop
+        ppm_link_init(pio, lane->sm, PPM_LINK_DETECTOR, offset, rx_lane_pins[i], pio_hz, true);
+
+#if PPM_FINE_DETECTOR
+        // Same pin, same settings, one cycle behind
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-conversion"
-    sm_det      = pio_claim_unused_sm(pio, true);
-    uint offset = pio_add_program(pio, &pulse_detector_program);
+        lane->sm_late = pio_claim_unused_sm(pio, true);
 #pragma GCC diagnostic pop
-    pio_sm_config c = pulse_detector_program_get_default_config(offset);
+        ppm_link_init(pio, lane->sm_late, PPM_LINK_DETECTOR_LATE, det_late_offset, rx_lane_pins[i], pio_hz, true);
+#endif
+    }
+}
+
+// Stored calibration profiles come from the two cycle detector, the fine one runs on the
+// fallback until the 'T' sweep learns to count single cycles
+static bool rx_cal_load(void) {
+#if PPM_FINE_DETECTOR
+    for (uint32_t i = 0; i < PPM_CAL_WIDTHS; i++) {
+        rx_cal[i] = (int8_t)MIN_TACKT;
+    }
+    return false;
+#else
+    return ppm_cal_load(SYS_FREQ, rx_cal, MIN_TACKT);
+#endif
+}
 
-    sm_config_set_in_pins(&c, PULSE_DET_PIN);
-    sm_config_set_jmp_pin(&c, PULSE_DET_PIN);
-    pio_gpio_init(pio, PULSE_DET_PIN);
-    pio_sm_set_consecutive_pindirs(pio, sm_det, PULSE_DET_PIN, 1, false);
+static uint32_t rx_lane_sm_mask(const rx_lane_t *lane) {
+#if PPM_FINE_DETECTOR
+    return (1u << lane->sm) | (1u << lane->sm_late);
+#else
+    return 1u << lane->sm;
+#endif
+}
 
-    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / freq);
-    pio_sm_init(pio, sm_det, offset, &c);
+static void rx_lane_reset(rx_lane_t *lane) {
+    pio_sm_clear_fifos(pio, lane->sm);
+#if PPM_FINE_DETECTOR
+    pio_sm_clear_fifos(pio, lane->sm_late);
+#endif
+    lane->codes  = -1;
+    lane->locked = false;
+    lane->lost   = 0;
+    rx_dma_arm(lane);
 }
 
+// All lanes start on the same cycle, a fine pair has to wait for the same edges
 void start_detector() {
-    pio_sm_clear_fifos(pio, sm_det);
-    pio_sm_set_enabled(pio, sm_det, true);
+    uint32_t sm_mask  = 0;
+    uint32_t dma_mask = 0;
+
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        rx_lane_reset(&rx_lanes[i]);
+        sm_mask |= rx_lane_sm_mask(&rx_lanes[i]);
+        dma_mask |= rx_lane_dma_mask(&rx_lanes[i]);
+    }
+    rx_slot_lanes = 0;
+
+    dma_start_channel_mask(dma_mask);
+    pio_enable_sm_mask_in_sync(pio, sm_mask);
     detector_running = true;
 }
 
+// Clear the detector state. The fine pair also goes back to the top of its programs, they
+// have to run from the same point to stay one cycle apart.
+static void rx_detector_reset(rx_lane_t *lane) {
+    pio_sm_restart(pio, lane->sm);
+#if PPM_FINE_DETECTOR
+    pio_sm_exec(pio, lane->sm, pio_encode_jmp(det_offset));
+    pio_sm_restart(pio, lane->sm_late);
+    pio_sm_exec(pio, lane->sm_late, pio_encode_jmp(det_late_offset));
+#endif
+}
+
+static void rx_lane_stop(rx_lane_t *lane) {
+    pio_set_sm_mask_enabled(pio, rx_lane_sm_mask(lane), false);
+    dma_channel_abort(lane->capture.chan);
+#if PPM_FINE_DETECTOR
+    dma_channel_abort(lane->capture_late.chan);
+#endif
+}
+
+// Clock profile switch (ppm_common/ppm_timing.h): captures count cycles of the old clock
+static void rx_timing_stop(void) {
+    detector_running = false;
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        rx_lane_stop(&rx_lanes[i]);
+    }
+}
+
+static void rx_timing_start(void) {
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        rx_lane_t *lane = &rx_lanes[i];
+        ppm_link_set_clkdiv(pio, lane->sm, PIO_FREQ);
+#if PPM_FINE_DETECTOR
+        ppm_link_set_clkdiv(pio, lane->sm_late, PIO_FREQ);
+#endif
+        rx_detector_reset(lane);
+    }
+    statistics.rx_calibrated = rx_cal_load();
+    start_detector();
+}
+
+#if PPM_FINE_DETECTOR
+// The pair slipped apart, the captures in flight and the open block of the lane are lost
+static void rx_detector_restart(rx_lane_t *lane) {
+    rx_lane_stop(lane);
+    rx_detector_reset(lane);
+    rx_lane_reset(lane);
+    dma_start_channel_mask(rx_lane_dma_mask(lane));
+    pio_enable_sm_mask_in_sync(pio, rx_lane_sm_mask(lane));
+}
+#endif
+
+static const ppm_timing_hooks_t rx_timing_hooks = {rx_timing_stop, rx_timing_start};
+
 void second_core_main() {
     init_pulse_detector(PIO_FREQ);
+    init_rx_dma();
+    statistics.rx_calibrated = rx_cal_load();
     start_detector();
 
+    uint32_t last_loop = ppm_tm_now();
     while (1) {
         update_measurements();
+        ppm_timing_task(&rx_timing_hooks);
+
+        uint32_t now = ppm_tm_now();
+        ppm_tm_hist_add(&statistics.core1_loop, now - last_loop);
+        last_loop = now;
     }
 }
 
 int main() {
-    set_sys_clock_khz(SYS_FREQ, true);
+    ppm_timing_init(SYS_FREQ_RUN, MIN_PULSE_PERIOD_US, 2);    // Both cores take part in switches
+    ppm_rt_init(1);    // Core1 runs the receiver
     gpio_init(LED_PIN);
     gpio_set_dir(LED_PIN, GPIO_OUT);
 
+    init_shared_rings();
+
     multicore_reset_core1();
     sleep_ms(100);
     multicore_launch_core1(second_core_main);
 
     first_core_main();
     return 0;
-}
\ No newline at end of file
+}
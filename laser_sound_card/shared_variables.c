@@ -1,7 +1,16 @@
 #include "common.h"
 
-// Глобальная структура, доступная обоим ядрам
-core_shared_buffer_t shared_ppm_data __attribute__((section(".scratch_x")));
+// Ring storage in main SRAM, accessed by both cores
+static uint32_t spk_ring_buffer[SPK_RING_SIZE];
+static uint32_t mic_ring_buffer[MIC_RING_SIZE];
 
-// Флаг, указывающий, что обмен через семафоры инициализирован
-volatile bool sem_initialized = false;
\ No newline at end of file
+spsc_ring_t spk_ring;
+spsc_ring_t mic_ring;
+
+statistics_t statistics;
+
+// Must run before core1 is launched
+void init_shared_rings(void) {
+    spsc_ring_init(&spk_ring, spk_ring_buffer, SPK_RING_SIZE);
+    spsc_ring_init(&mic_ring, mic_ring_buffer, MIC_RING_SIZE);
+}
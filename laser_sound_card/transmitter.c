@@ -1,13 +1,12 @@
 #include "common.h"
 #include "hardware/uart.h"
-#include "pico/sem.h"
 #include "usb_descriptors.h"
 #include <bsp/board_api.h>
 #include <limits.h>
 #include <string.h>
 
-// List of supported sample rates
-const uint32_t sample_rates[] = {44100, AUDIO_SAMPLE_RATE};
+// List of supported sample rates, given to the host as far as the link carries them
+const uint32_t sample_rates[] = {44100, AUDIO_SAMPLE_RATE, 88200, 96000};
 
 uint32_t current_sample_rate = AUDIO_SAMPLE_RATE;
 
@@ -21,38 +20,87 @@ uint32_t current_sample_rate = AUDIO_SAMPLE_RATE;
 
 static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
 
+static ppm_tm_stream_t telemetry;    // Snapshot being sent to the CDC interface
+
 // Audio controls
 // Current states
 int8_t  mute[CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX + 1];      // +1 for master channel 0
 int16_t volume[CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX + 1];    // +1 for master channel 0
 
 // Buffer for microphone data
-int32_t  mic_buf[CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ / 4];
-int16_t *mic_dst;
-// Buffer for speaker data
-int32_t spk_buf[CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ / 4];
-// Speaker data size received in the last frame
-uint16_t spk_data_size;
+int32_t mic_buf[CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ / 4];
 // Resolution per format
 const uint8_t resolutions_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_RESOLUTION_RX,
                                                                         CFG_TUD_AUDIO_FUNC_1_FORMAT_2_RESOLUTION_RX};
-// Current resolution, update on format change
-uint8_t  current_resolution;
-uint16_t pcm_ticks_in_buffer = 0;
-
-// Double buffers for speaker (USB -> PPM)
-static spk_ppm_buffer_t spk_buffers[2];
-static volatile uint8_t current_spk_write_buffer = 0;    // Buffer for PPM preparation
-static volatile uint8_t current_spk_read_buffer  = 0;    // Buffer for reading in timer
+// Resolution of the speaker and microphone streams, update on format change
+uint8_t spk_resolution;
+uint8_t mic_resolution;
+const uint8_t mic_resolutions_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_RESOLUTION_TX,
+                                                                            CFG_TUD_AUDIO_FUNC_1_FORMAT_2_RESOLUTION_TX};
+// Highest rate each format's endpoints are sized for (tusb_config.h)
+static const uint32_t max_rate_per_format[CFG_TUD_AUDIO_FUNC_1_N_FORMATS] = {CFG_TUD_AUDIO_FUNC_1_FORMAT_1_MAX_SAMPLE_RATE,
+                                                                             CFG_TUD_AUDIO_FUNC_1_FORMAT_2_MAX_SAMPLE_RATE};
+// Active alt settings, 0 while not streaming
+static uint8_t spk_alt = 0;
+static uint8_t mic_alt = 0;
+
+// Codecs for the active alt settings, picked in tud_audio_set_itf_cb
+typedef void (*spk_convert_fn)(const void *pcm, uint32_t frames, uint32_t *dst);
+typedef void (*mic_convert_fn)(const uint32_t *frames, uint32_t count, void *pcm);
+
+static void spk_convert_s16(const void *pcm, uint32_t frames, uint32_t *dst);
+static void spk_convert_s32(const void *pcm, uint32_t frames, uint32_t *dst);
+static void mic_convert_s16(const uint32_t *frames, uint32_t count, void *pcm);
+static void mic_convert_s32(const uint32_t *frames, uint32_t count, void *pcm);
+
+static spk_convert_fn spk_convert     = spk_convert_s16;
+static uint16_t       spk_frame_bytes = 2 * CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_RX;
+static mic_convert_fn mic_convert     = mic_convert_s16;
+static uint16_t       mic_frame_bytes = PPM_LINK_CHANNELS * CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_TX;
+
+// Microphone packetizer state
+static volatile bool     mic_streaming      = false;    // Mic alt setting != 0
+static volatile uint32_t mic_frames_pending = 0;        // SOFs not served by mic_task yet
+static uint32_t          mic_rate_phase     = 0;        // Sample-rate remainder carried between frames
+
+// Microphone resampler (mic_task). The read position in mic_ring is counted in frames with a
+// 32 bit fraction and advances by 1 + mic_rs_trim per output frame.
+#define MIC_RS_SILENCE   PPM_FRAME(0x8000, 0x8000)    // Fine frame of digital silence
+#define MIC_RS_MAX_TRIM  (MIC_RS_MAX_PPM * 4295)      // Q0.32
+#define MIC_RS_MAX_FRAME (CFG_TUD_AUDIO_FUNC_1_MAX_SAMPLE_RATE / 1000 + 1)
+
+static uint32_t mic_rs_prev     = MIC_RS_SILENCE;    // Fine frames either side of the read position
+static uint32_t mic_rs_next     = MIC_RS_SILENCE;
+static uint32_t mic_rs_frac     = 0;                 // Read position between them, Q0.32
+static int32_t  mic_rs_integral = 0;                 // Integral path of the trim, Q0.32
+static int32_t  mic_rs_depth    = 0;                 // Filtered mic_ring depth, 8 fractional bits
+static bool     mic_rs_priming  = true;              // Held until mic_ring is back at its target depth
 
 void led_blinking_task(void);
 void spk_task(void);
 void mic_task(void);
+void tx_dma_task(void);
+void feedback_task(void);
+void statistics_task(void);
+
+static PIO const pio = pio1;
 
-static PIO  pio = pio1;
-static uint sm_gen;
+static const uint tx_lane_pins[PPM_LANES_MAX] = PPM_LANE_GEN_PINS;
 
-uint32_t audio_frame_ticks;
+// One generator SM, the DMA channel feeding it and the blocks it carries
+typedef struct {
+    uint     sm;
+    int      chan;
+    uint32_t write_pos;       // Next ring index to fill
+    uint32_t written;         // Symbols queued, free running
+    uint32_t fetched_base;    // Symbols fetched by the DMA before its current transfer count
+    uint32_t block_frames;    // Frames sent since the last sync symbol
+    uint32_t block_crc;       // Over the data codes of the current block
+} tx_lane_t;
+
+static tx_lane_t tx_lanes[PPM_LANES];
+static uint32_t  tx_lane_next = 0;    // Lane of the next frame
+static uint      gen_offset;
 
 void setup_uart() {
     uart_init(UART_ID, BAUD_RATE);
@@ -61,79 +109,357 @@ void setup_uart() {
     stdio_uart_init();
 }
 
-void init_double_buffering(void) {
-    for (int i = 0; i < 2; i++) {
-        spk_buffers[i].size     = 0;
-        spk_buffers[i].position = 0;
-        spk_buffers[i].ready    = false;
-    }
-    current_spk_write_buffer = 0;
-    current_spk_read_buffer  = 0;
-}
-
 void generate_pulse(uint32_t pause_width) {
-    pio_sm_put_blocking(pio, sm_gen, pause_width);
+    ppm_link_put_blocking(pio, tx_lanes[0].sm, pause_width);
 }
 
-uint32_t calculate_audio_frame_ticks() {
-    return 1000000 / current_sample_rate;
+
+static uint32_t tx_lane_sm_mask(void) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        mask |= 1u << tx_lanes[i].sm;
+    }
+    return mask;
 }
 
-// Initialize PIO for pulse generator
-void init_pulse_generator(float freq) {
+#if PPM_FINE_DETECTOR
+#define TX_GENERATOR PPM_LINK_GENERATOR_FINE
+#else
+#define TX_GENERATOR PPM_LINK_GENERATOR
+#endif
+
+// Initialize PIO for the pulse generator of every lane, started on the same cycle
+void init_pulse_generator(uint32_t pio_hz) {
+    gen_offset = ppm_link_load(pio, TX_GENERATOR);
+
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        tx_lane_t *lane = &tx_lanes[i];
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-conversion"
-    sm_gen      = pio_claim_unused_sm(pio, true);
-    uint offset = pio_add_program(pio, &pulse_generator_program);
+        lane->sm = pio_claim_unused_sm(pio, true);
 #pragma GCC diagnostic pop
-    pio_sm_config c = pulse_generator_program_get_default_config(offset);
+        ppm_link_init(pio, lane->sm, TX_GENERATOR, gen_offset, tx_lane_pins[i], pio_hz, false);
+    }
+    pio_enable_sm_mask_in_sync(pio, tx_lane_sm_mask());
+}
+
+// Transmit DMA rings, one per lane: hold complete pause widths (MIN_INTERVAL_CYCLES + symbol
+// code). Each lane's DMA channel reads its ring with address wrapping, all paced by one DMA
+// timer at the lane symbol rate, so the CPU only has to keep the write positions ahead of
+// the DMA read positions.
+static uint32_t tx_dma_rings[PPM_LANES][TX_DMA_RING_SIZE] __attribute__((aligned(TX_DMA_RING_SIZE * sizeof(uint32_t))));
+static int      tx_dma_timer     = -1;
+static bool     tx_underrun      = false;    // Padding with idle symbols, traced on entry and exit
+static bool     tx_suspended     = false;    // Link held stopped while the bus is suspended
+static uint32_t tx_underrun_idle = 0;        // statistics.tx_idle_symbols when the underrun began
+
+// Find X/Y (16 bit each) so that clk_sys * X / Y is as close as possible to the lane symbol
+// rate, sample_rate * PPM_SYMBOLS_PER_BLOCK / PPM_FRAMES_PER_SLOT (99 kHz for one stereo lane
+// at 48 kHz)
+void tx_dma_set_sample_rate(uint32_t sample_rate) {
+    if (tx_dma_timer < 0 || sample_rate == 0)
+        return;
+
+    uint64_t clk_hz   = (uint64_t)clock_get_hz(clk_sys) * PPM_FRAMES_PER_SLOT;
+    uint64_t rate     = (uint64_t)sample_rate * PPM_SYMBOLS_PER_BLOCK;
+    uint32_t best_num = 1;
+    uint32_t best_den = 0xFFFF;
+    uint64_t best_err = UINT64_MAX;
+
+    for (uint32_t num = 1; num <= 0xFFFF; num++) {
+        uint64_t den = (clk_hz * num + rate / 2) / rate;
+        if (den > 0xFFFF)
+            break;
+        if (den < num)
+            continue;
+
+        // |clk * num / den - rate| scaled by den
+        int64_t  diff = (int64_t)(clk_hz * num) - (int64_t)(rate * den);
+        uint64_t err  = (uint64_t)(diff < 0 ? -diff : diff) * 0xFFFF / den;
+        if (err < best_err) {
+            best_err = err;
+            best_num = num;
+            best_den = (uint32_t)den;
+        }
+    }
+
+    dma_timer_set_fraction((uint)tx_dma_timer, (uint16_t)best_num, (uint16_t)best_den);
+}
+
+static inline uint32_t *tx_lane_ring(const tx_lane_t *lane) {
+    return tx_dma_rings[lane - tx_lanes];
+}
+
+static inline uint32_t tx_dma_read_pos(const tx_lane_t *lane) {
+    return (uint32_t)((dma_hw->ch[lane->chan].read_addr - (uintptr_t)tx_lane_ring(lane)) / sizeof(uint32_t)) &
+           TX_DMA_RING_MASK;
+}
 
-    // Setup pins for PIO
-    sm_config_set_set_pins(&c, PULSE_GEN_PIN, 1);
-    pio_gpio_init(pio, PULSE_GEN_PIN);
-    pio_sm_set_consecutive_pindirs(pio, sm_gen, PULSE_GEN_PIN, 1, true);
+// Symbols fetched by a lane's DMA, free running like lane->written
+static inline uint32_t tx_lane_fetched(const tx_lane_t *lane) {
+    return lane->fetched_base + (0xFFFFFFFF - dma_hw->ch[lane->chan].transfer_count);
+}
+
+// Number of pause widths queued ahead of a lane's DMA, negative once the DMA has run past
+// the write position and is replaying old ring contents
+static inline int32_t tx_lane_lead(const tx_lane_t *lane) {
+    return (int32_t)(lane->written - tx_lane_fetched(lane));
+}
+
+// Number of pause widths queued ahead of the DMA, all lanes
+static inline uint32_t tx_dma_lead(void) {
+    uint32_t lead = 0;
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        int32_t ahead = tx_lane_lead(&tx_lanes[i]);
+        lead += ahead > 0 ? (uint32_t)ahead : 0;
+    }
+    return lead;
+}
 
-    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / freq);
+static inline void tx_dma_put(tx_lane_t *lane, uint32_t code) {
+    tx_lane_ring(lane)[lane->write_pos] = MIN_INTERVAL_CYCLES + code;
+    lane->write_pos                     = (lane->write_pos + 1) & TX_DMA_RING_MASK;
+    lane->written++;
+    statistics.total_ppm_sent++;
+}
 
-    pio_sm_init(pio, sm_gen, offset, &c);
-    pio_sm_set_enabled(pio, sm_gen, true);
+static inline void tx_dma_put_code(tx_lane_t *lane, uint32_t code) {
+    tx_dma_put(lane, code);
+    lane->block_crc = ppm_block_crc(lane->block_crc, code);
 }
 
-uint16_t audio_to_ppm(int16_t audio_sample) {
-    return (uint16_t)(((int64_t)audio_sample + 32768) * 1024 / 65536);
+// Queue one frame on a lane, in stereo as L, R. A sync symbol opens every block, the check
+// symbol closes it.
+static inline uint32_t tx_dma_put_frame(tx_lane_t *lane, uint32_t frame) {
+    uint32_t symbols = PPM_LINK_CHANNELS;
+    if (lane->block_frames == 0) {
+        tx_dma_put(lane, PPM_SYNC_CODE);
+        lane->block_crc = PPM_CRC_INIT;
+        symbols++;
+    }
+    tx_dma_put_code(lane, PPM_FRAME_LEFT(frame));
+#if PPM_LINK_CHANNELS == 2
+    tx_dma_put_code(lane, PPM_FRAME_RIGHT(frame));
+#endif
+    if (++lane->block_frames == PPM_FRAMES_PER_BLOCK) {
+        tx_dma_put(lane, lane->block_crc);
+        lane->block_frames = 0;
+        symbols++;
+    }
+    return symbols;
 }
 
-int16_t ppm_to_audio(uint32_t ppm_value) {
-    ppm_value &= 0x3FF;
-    return (int16_t)(((int64_t)ppm_value * 65536 / 1024) - 32768);
+static void tx_dma_start(tx_lane_t *lane) {
+    lane->fetched_base += 0xFFFFFFFF;    // The whole previous transfer count was used
+    dma_channel_set_read_addr((uint)lane->chan, &tx_lane_ring(lane)[tx_dma_read_pos(lane)], false);
+    dma_channel_set_trans_count((uint)lane->chan, 0xFFFFFFFF, true);
 }
-void timer0_irq_handler() {
-    if (timer_hw->intr & (1u << 0)) {
-        timer_hw->intr = 1u << 0;
 
-        uint32_t ppm_value;
+static void tx_lane_fill_idle(tx_lane_t *lane) {
+    uint32_t *ring = tx_lane_ring(lane);
+    for (uint32_t i = 0; i < TX_DMA_RING_SIZE; i++) {
+        ring[i] = MIN_INTERVAL_CYCLES + PPM_IDLE_CODE;
+    }
+}
 
-        if (spk_buffers[current_spk_read_buffer].ready &&
-            spk_buffers[current_spk_read_buffer].position < spk_buffers[current_spk_read_buffer].size) {
+// Idle symbols all round, the write position a minimum lead ahead of the DMA and a new
+// block on every lane. The DMA may be running, its position is taken after the fill.
+static void tx_lane_reset(tx_lane_t *lane) {
+    tx_lane_fill_idle(lane);
+    uint32_t fetched   = tx_lane_fetched(lane);    // Equals the read position modulo the ring
+    lane->written      = fetched + TX_DMA_LEAD_MIN;
+    lane->write_pos    = lane->written & TX_DMA_RING_MASK;
+    lane->block_frames = 0;
+}
 
-            ppm_value = MIN_INTERVAL_CYCLES +
-                        spk_buffers[current_spk_read_buffer].ppm_buffer[spk_buffers[current_spk_read_buffer].position++];
+void init_tx_dma(void) {
+    tx_dma_timer = dma_claim_unused_timer(true);
+    tx_dma_set_sample_rate(current_sample_rate);
+
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        tx_lane_t *lane = &tx_lanes[i];
+
+        lane->chan           = dma_claim_unused_channel(true);
+        dma_channel_config c = dma_channel_get_default_config((uint)lane->chan);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_ring(&c, false, TX_DMA_RING_BITS + 2);    // Wrap read address on the ring (size in bytes)
+        channel_config_set_dreq(&c, dma_get_timer_dreq((uint)tx_dma_timer));
+
+        dma_channel_configure((uint)lane->chan, &c, &pio->txf[lane->sm], tx_dma_rings[i], 0xFFFFFFFF, false);
+        // Not started yet, the live transfer count only loads on the trigger
+        tx_lane_fill_idle(lane);
+        lane->fetched_base = 0;
+        lane->written      = TX_DMA_LEAD_MIN;
+        lane->write_pos    = TX_DMA_LEAD_MIN;
+        lane->block_frames = 0;
+        mask |= 1u << lane->chan;
+    }
+    tx_lane_next = 0;
+    dma_start_channel_mask(mask);
+}
 
-            if (spk_buffers[current_spk_read_buffer].position >= spk_buffers[current_spk_read_buffer].size) {
-                spk_buffers[current_spk_read_buffer].ready    = false;
-                spk_buffers[current_spk_read_buffer].position = 0;
-                spk_buffers[current_spk_read_buffer].size     = 0;
+// Move speaker frames into the DMA rings, frame i to lane i % PPM_LANES, keeping a minimum
+// lead of idle symbols on every lane
+void PPM_RT_FUNC(tx_dma_task)(void) {
+    uint32_t lead[PPM_LANES];
+    uint32_t total    = 0;
+    uint32_t shortest = UINT32_MAX;
+    bool     overrun  = false;
 
-                current_spk_read_buffer = (uint8_t)((current_spk_read_buffer + 1) % 2);
-            }
+    if (tx_suspended)
+        return;
+
+    for (uint32_t k = 0; k < PPM_LANES; k++) {
+        // At 48 kHz the transfer count runs out after ~12 h, restart in place
+        if (!dma_channel_is_busy((uint)tx_lanes[k].chan)) {
+            tx_dma_start(&tx_lanes[k]);
+            ppm_trace(PPM_TRACE_TX_DMA_RESTART, k, 0);
         }
-        else {
-            ppm_value = MIN_INTERVAL_CYCLES;
+        int32_t ahead = tx_lane_lead(&tx_lanes[k]);
+        if (ahead < 0) {
+            ppm_trace(PPM_TRACE_TX_OVERRUN, (uint32_t)-ahead, k);
+            overrun = true;
+        }
+    }
+
+    // The loop stalled for longer than the queued lead: the DMA has been replaying stale
+    // symbols. Start every lane over from idle and a new block to keep frames striped in order.
+    if (overrun) {
+        for (uint32_t k = 0; k < PPM_LANES; k++) {
+            tx_lane_reset(&tx_lanes[k]);
+        }
+        tx_lane_next = 0;
+        statistics.tx_overruns++;
+    }
+
+    for (uint32_t k = 0; k < PPM_LANES; k++) {
+        int32_t ahead = tx_lane_lead(&tx_lanes[k]);
+        lead[k]       = ahead > 0 ? (uint32_t)ahead : 0;
+        total += lead[k];
+    }
+
+    // Every symbol queued but not ahead of the DMA has been fetched
+    ppm_tm_probe_end(&statistics.tx_probe, statistics.total_ppm_sent - total);
+
+    uint32_t *src;
+    uint32_t  span;
+    while (lead[tx_lane_next] + PPM_MAX_SYMBOLS_PER_FRAME <= TX_DMA_LEAD_MAX &&
+           (span = spsc_ring_read_span(&spk_ring, &src)) != 0) {
+        // Index in src of the frame tagged by spk_task, if it is in this span
+        uint32_t probe = statistics.spk_probe.armed ? statistics.spk_probe.position - spk_ring.tail : UINT32_MAX;
+
+        uint32_t i = 0;
+        while (i < span && lead[tx_lane_next] + PPM_MAX_SYMBOLS_PER_FRAME <= TX_DMA_LEAD_MAX) {
+            // Hand the tagged frame on to the TX probe at its first symbol
+            if (i == probe && ppm_tm_probe_end(&statistics.spk_probe, spk_ring.tail + i + 1))
+                ppm_tm_probe_start(&statistics.tx_probe, statistics.total_ppm_sent);
+
+            uint32_t k       = tx_lane_next;
+            uint32_t symbols = tx_dma_put_frame(&tx_lanes[k], src[i++]);
+            lead[k] += symbols;
+            total += symbols;
+            tx_lane_next = k + 1 < PPM_LANES ? k + 1 : 0;
+        }
+        spsc_ring_release(&spk_ring, i);
+    }
+
+    for (uint32_t k = 0; k < PPM_LANES; k++) {
+        if (lead[k] < shortest)
+            shortest = lead[k];
+    }
+
+    // Underrun: keep the lanes clocked with idle symbols (dropped by the receiver, block
+    // position is not affected)
+    if (shortest < TX_DMA_LEAD_MIN) {
+        if (!tx_underrun) {
+            ppm_trace(PPM_TRACE_TX_UNDERRUN, shortest, 0);
+            tx_underrun      = true;
+            tx_underrun_idle = statistics.tx_idle_symbols;
+        }
+        for (uint32_t k = 0; k < PPM_LANES; k++) {
+            while (lead[k] < TX_DMA_LEAD_MIN) {
+                tx_dma_put(&tx_lanes[k], PPM_IDLE_CODE);
+                statistics.tx_idle_symbols++;
+                lead[k]++;
+                total++;
+            }
         }
+    }
+    else if (tx_underrun) {
+        ppm_trace(PPM_TRACE_TX_RESUMED, statistics.tx_idle_symbols - tx_underrun_idle, 0);
+        tx_underrun = false;
+    }
+    ppm_tm_level_set(&statistics.tx_lead_level, total);
+}
+
+// Clock profile switch (ppm_common/ppm_timing.h). Queued widths carry the old minimum
+// interval, so the link starts over from idle symbols and a new block.
+static void tx_timing_stop(void) {
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        hw_clear_bits(&dma_hw->ch[tx_lanes[i].chan].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);    // Pause, keep the read position
+    }
+    pio_set_sm_mask_enabled(pio, tx_lane_sm_mask(), false);
+}
+
+static void tx_timing_start(void) {
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        tx_lane_t *lane = &tx_lanes[i];
+        ppm_link_set_clkdiv(pio, lane->sm, PIO_FREQ);
+        pio_sm_clear_fifos(pio, lane->sm);
+        pio_sm_restart(pio, lane->sm);
+        pio_sm_exec(pio, lane->sm, pio_encode_jmp(gen_offset));    // Lanes in step again
+        tx_lane_reset(lane);
+    }
+    tx_lane_next = 0;
+    tx_dma_set_sample_rate(current_sample_rate);
+
+    // clk_peri may follow clk_sys
+    uart_set_baudrate(UART_ID, BAUD_RATE);
+
+    // Symbols do not fit their slots at the suspend profile, the resume switch restarts
+    if (tx_suspended)
+        return;
+
+    for (uint32_t i = 0; i < PPM_LANES; i++) {
+        hw_set_bits(&dma_hw->ch[tx_lanes[i].chan].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
+    }
+    pio_enable_sm_mask_in_sync(pio, tx_lane_sm_mask());
+}
+
+static const ppm_timing_hooks_t tx_timing_hooks = {tx_timing_stop, tx_timing_start};
+
+// Profile while the bus is active, set with "clock <kHz>" on the telemetry terminal
+static uint32_t timing_run_khz = SYS_FREQ_RUN;
+
+// The longest symbol, PPM_CYCLES_PER_COUNT * (MIN_INTERVAL_CYCLES + PPM_SYNC_CODE) cycles,
+// has to fit its lane symbol time at the sample rate
+static bool link_rate_fits(uint32_t sys_khz, uint32_t sample_rate) {
+    uint64_t counts = (uint64_t)ppm_timing_min_interval(sys_khz) * PPM_COUNT_SCALE + PPM_SYNC_CODE;
+    uint64_t cycles = PPM_CYCLES_PER_COUNT * counts;
+    return cycles * sample_rate * PPM_SYMBOLS_PER_BLOCK <= (uint64_t)sys_khz * 1000u * PPM_FRAMES_PER_SLOT;
+}
+
+// A profile has to carry the default rate and the one being streamed
+static bool timing_profile_fits(uint32_t sys_khz) {
+    return link_rate_fits(sys_khz, AUDIO_SAMPLE_RATE) && link_rate_fits(sys_khz, current_sample_rate);
+}
+
+// The host sets the clock and the alt settings independently, neither may leave a stream
+// on endpoints that are too small for the rate
+static bool alt_rate_fits(uint8_t alt, uint32_t sample_rate) {
+    return alt == 0 || sample_rate <= max_rate_per_format[alt - 1];
+}
 
-        generate_pulse(ppm_value);
-        timer_hw->alarm[0] = timer_hw->timerawl + audio_frame_ticks;
+static bool sample_rate_supported(uint32_t sample_rate) {
+    for (uint32_t i = 0; i < N_SAMPLE_RATES; i++) {
+        if (sample_rates[i] == sample_rate)
+            return link_rate_fits(timing_run_khz, sample_rate);
     }
+    return false;
 }
 
 void first_core_main() {
@@ -149,28 +475,35 @@ void first_core_main() {
         board_init_after_tusb();
     }
 
-    TU_LOG1("Laser Audio running\r\n");
-    stdio_init_all();
+    // Microphone packets are paced by SOF
+    tud_sof_cb_enable(true);
 
-    init_double_buffering();
+    ppm_trace(PPM_TRACE_BOOT, clock_get_hz(clk_sys) / 1000, 0);
+    stdio_init_all();
 
     init_pulse_generator(PIO_FREQ);
 
-    audio_frame_ticks = 1000000 / AUDIO_SAMPLE_RATE;
-
-    // Setup timer interrupt for audio sampling
-    irq_set_exclusive_handler(TIMER_IRQ_0, timer0_irq_handler);
-    hw_set_bits(&timer_hw->inte, (1u << 0));
-    irq_set_enabled(TIMER_IRQ_0, true);
+    // Pulses are clocked out by DMA, no per-sample interrupt
+    init_tx_dma();
 
-    timer_hw->alarm[0] = timer_hw->timerawl + audio_frame_ticks;
+    ppm_tm_stream_init(&telemetry, TELEMETRY_PERIOD_MS);
 
-    // Main operation loop on Core1
+    // Main operation loop on Core0
+    uint32_t last_loop = ppm_tm_now();
     while (1) {
         tud_task();
         spk_task();
+        tx_dma_task();
+        feedback_task();
         mic_task();
+        statistics_task();
+        ppm_timing_task(&tx_timing_hooks);
+        ppm_trace_drain(UART_ID);
         led_blinking_task();
+
+        uint32_t now = ppm_tm_now();
+        ppm_tm_hist_add(&statistics.core0_loop, now - last_loop);
+        last_loop = now;
     }
 }
 
@@ -194,11 +527,18 @@ void tud_umount_cb(void) {
 void tud_suspend_cb(bool remote_wakeup_en) {
     (void)remote_wakeup_en;
     blink_interval_ms = BLINK_SUSPENDED;
+
+    // Nothing is streamed, the link only carries idle symbols. If even those do not fit
+    // their slots at the idle profile, the link stays stopped until resume.
+    tx_suspended = !timing_profile_fits(SYS_FREQ_IDLE);
+    ppm_timing_request(SYS_FREQ_IDLE);
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void) {
     blink_interval_ms = tud_mounted() ? BLINK_MOUNTED : BLINK_NOT_MOUNTED;
+    tx_suspended      = false;
+    ppm_timing_request(timing_run_khz);
 }
 
 // Helper for clock get requests
@@ -213,18 +553,23 @@ static bool tud_audio_clock_get_request(uint8_t rhport, audio_control_request_t
             return tud_audio_buffer_and_schedule_control_xfer(rhport, (tusb_control_request_t const *)request, &curf, sizeof(curf));
         }
         else if (request->bRequest == AUDIO_CS_REQ_RANGE) {
-            audio_control_range_4_n_t(N_SAMPLE_RATES) rangef =
-                {
-                    .wNumSubRanges = tu_htole16(N_SAMPLE_RATES)};
-            TU_LOG1("Clock get %d freq ranges\r\n", N_SAMPLE_RATES);
+            audio_control_range_4_n_t(N_SAMPLE_RATES) rangef;
+            uint16_t n = 0;
             for (uint8_t i = 0; i < N_SAMPLE_RATES; i++) {
-                rangef.subrange[i].bMin = (int32_t)sample_rates[i];
-                rangef.subrange[i].bMax = (int32_t)sample_rates[i];
-                rangef.subrange[i].bRes = 0;
-                TU_LOG1("Range %d (%d, %d, %d)\r\n", i, (int)rangef.subrange[i].bMin, (int)rangef.subrange[i].bMax, (int)rangef.subrange[i].bRes);
+                if (!sample_rate_supported(sample_rates[i]))
+                    continue;
+                rangef.subrange[n].bMin = (int32_t)sample_rates[i];
+                rangef.subrange[n].bMax = (int32_t)sample_rates[i];
+                rangef.subrange[n].bRes = 0;
+                TU_LOG1("Range %d (%d, %d, %d)\r\n", n, (int)rangef.subrange[n].bMin, (int)rangef.subrange[n].bMax, (int)rangef.subrange[n].bRes);
+                n++;
             }
+            rangef.wNumSubRanges = tu_htole16(n);
+            TU_LOG1("Clock get %d freq ranges\r\n", n);
 
-            return tud_audio_buffer_and_schedule_control_xfer(rhport, (tusb_control_request_t const *)request, &rangef, sizeof(rangef));
+            // Only the subranges filled in
+            uint16_t length = (uint16_t)(sizeof(rangef.wNumSubRanges) + n * sizeof(rangef.subrange[0]));
+            return tud_audio_buffer_and_schedule_control_xfer(rhport, (tusb_control_request_t const *)request, &rangef, length);
         }
     }
     else if (request->bControlSelector == AUDIO_CS_CTRL_CLK_VALID &&
@@ -250,10 +595,16 @@ static bool tud_audio_clock_set_request(uint8_t rhport, audio_control_request_t
     if (request->bControlSelector == AUDIO_CS_CTRL_SAM_FREQ) {
         TU_VERIFY(request->wLength == sizeof(audio_control_cur_4_t));
 
-        current_sample_rate = (uint32_t)((audio_control_cur_4_t const *)buf)->bCur;
-        audio_frame_ticks   = calculate_audio_frame_ticks();
+        uint32_t sample_rate = (uint32_t)((audio_control_cur_4_t const *)buf)->bCur;
+        TU_VERIFY(sample_rate_supported(sample_rate));
+        TU_VERIFY(alt_rate_fits(spk_alt, sample_rate) && alt_rate_fits(mic_alt, sample_rate));
+
+        // The DMA timer divides clk_sys by a 16/16 bit fraction, within ~1 ppm of every
+        // rate on every profile, the feedback endpoint takes care of the rest
+        current_sample_rate = sample_rate;
+        tx_dma_set_sample_rate(current_sample_rate);
 
-        TU_LOG1("Clock set current freq: %" PRIu32 "\r\n", current_sample_rate);
+        ppm_trace(PPM_TRACE_SAMPLE_RATE, current_sample_rate, 0);
 
         return true;
     }
@@ -309,7 +660,7 @@ static bool tud_audio_feature_unit_set_request(uint8_t rhport, audio_control_req
 
         mute[request->bChannelNumber] = ((audio_control_cur_1_t const *)buf)->bCur;
 
-        TU_LOG1("Set channel %d Mute: %d\r\n", request->bChannelNumber, mute[request->bChannelNumber]);
+        ppm_trace(PPM_TRACE_SET_MUTE, request->bChannelNumber, (uint32_t)mute[request->bChannelNumber]);
 
         return true;
     }
@@ -318,7 +669,7 @@ static bool tud_audio_feature_unit_set_request(uint8_t rhport, audio_control_req
 
         volume[request->bChannelNumber] = ((audio_control_cur_2_t const *)buf)->bCur;
 
-        TU_LOG1("Set channel %d volume: %d dB\r\n", request->bChannelNumber, volume[request->bChannelNumber] / 256);
+        ppm_trace(PPM_TRACE_SET_VOLUME, request->bChannelNumber, (uint32_t)volume[request->bChannelNumber]);
 
         return true;
     }
@@ -374,8 +725,14 @@ bool tud_audio_set_itf_close_EP_cb(uint8_t rhport, tusb_control_request_t const
     uint8_t const itf = tu_u16_low(tu_le16toh(p_request->wIndex));
     uint8_t const alt = tu_u16_low(tu_le16toh(p_request->wValue));
 
-    if (ITF_NUM_AUDIO_STREAMING_SPK == itf && alt == 0)
+    if (ITF_NUM_AUDIO_STREAMING_SPK == itf && alt == 0) {
         blink_interval_ms = BLINK_MOUNTED;
+        spk_alt           = 0;
+    }
+    if (ITF_NUM_AUDIO_STREAMING_MIC == itf && alt == 0) {
+        mic_streaming = false;
+        mic_alt       = 0;
+    }
 
     return true;
 }
@@ -385,37 +742,41 @@ bool tud_audio_set_itf_cb(uint8_t rhport, tusb_control_request_t const *p_reques
     uint8_t const itf = tu_u16_low(tu_le16toh(p_request->wIndex));
     uint8_t const alt = tu_u16_low(tu_le16toh(p_request->wValue));
 
-    TU_LOG2("Set interface %d alt %d\r\n", itf, alt);
+    ppm_trace(PPM_TRACE_SET_ITF, itf, alt);
+    TU_VERIFY(alt_rate_fits(alt, current_sample_rate));
+    if (ITF_NUM_AUDIO_STREAMING_SPK == itf)
+        spk_alt = alt;
+    if (ITF_NUM_AUDIO_STREAMING_MIC == itf)
+        mic_alt = alt;
+
     if (ITF_NUM_AUDIO_STREAMING_SPK == itf && alt != 0)
         blink_interval_ms = BLINK_STREAMING;
+    if (ITF_NUM_AUDIO_STREAMING_MIC == itf) {
+        mic_frames_pending = 0;
+        mic_rate_phase     = 0;
+        mic_streaming      = alt != 0;
+    }
 
     // Clear buffer when streaming format is changed
-    spk_data_size = 0;
-    if (alt != 0) {
-        current_resolution = resolutions_per_format[alt - 1];
+    if (ITF_NUM_AUDIO_STREAMING_SPK == itf) {
+        tud_audio_clear_ep_out_ff();
+    }
+    if (ITF_NUM_AUDIO_STREAMING_SPK == itf && alt != 0) {
+        spk_resolution  = resolutions_per_format[alt - 1];
+        spk_convert     = spk_resolution == 16 ? spk_convert_s16 : spk_convert_s32;
+        spk_frame_bytes = spk_resolution == 16 ? 2 * CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_RX
+                                               : 2 * CFG_TUD_AUDIO_FUNC_1_FORMAT_2_N_BYTES_PER_SAMPLE_RX;
+    }
+    if (ITF_NUM_AUDIO_STREAMING_MIC == itf && alt != 0) {
+        mic_resolution  = mic_resolutions_per_format[alt - 1];
+        mic_convert     = mic_resolution == 16 ? mic_convert_s16 : mic_convert_s32;
+        mic_frame_bytes = mic_resolution == 16 ? PPM_LINK_CHANNELS * CFG_TUD_AUDIO_FUNC_1_FORMAT_1_N_BYTES_PER_SAMPLE_TX
+                                               : PPM_LINK_CHANNELS * CFG_TUD_AUDIO_FUNC_1_FORMAT_2_N_BYTES_PER_SAMPLE_TX;
     }
 
     return true;
 }
 
-bool tud_audio_rx_done_pre_read_cb(uint8_t rhport, uint16_t n_bytes_received, uint8_t func_id, uint8_t ep_out, uint8_t cur_alt_setting) {
-    (void)rhport;
-    (void)func_id;
-    (void)ep_out;
-    (void)cur_alt_setting;
-
-    if (!spk_buffers[current_spk_write_buffer].ready) {
-        spk_data_size = tud_audio_read(spk_buf, n_bytes_received);
-        TU_LOG1("RX done pre read callback called, received %d bytes\r\n", spk_data_size);
-        if (sem_initialized) {
-            shared_ppm_data.packet_size = spk_data_size;
-        }
-        return true;
-    }
-    TU_LOG1("RX done pre read callback called, but buffer is not ready\r\n");
-    return false;
-}
-
 bool tud_audio_tx_done_pre_load_cb(uint8_t rhport, uint8_t itf, uint8_t ep_in, uint8_t cur_alt_setting) {
     (void)rhport;
     (void)itf;
@@ -425,134 +786,282 @@ bool tud_audio_tx_done_pre_load_cb(uint8_t rhport, uint8_t itf, uint8_t ep_in, u
     return true;
 }
 
-void spk_task(void) {
-    if (spk_data_size && !spk_buffers[current_spk_write_buffer].ready) {
-        if (current_resolution == 16) {
-            int16_t  *src        = (int16_t *)spk_buf;
-            int16_t  *limit      = (int16_t *)spk_buf + spk_data_size / 2;
-            uint16_t *dst        = spk_buffers[current_spk_write_buffer].ppm_buffer;
-            uint16_t  buffer_pos = 0;
+// Convert whole stereo frames to one packed PPM frame each, a mono link carries L+R
+static void PPM_RT_FUNC(spk_convert_s16)(const void *pcm, uint32_t frames, uint32_t *dst) {
+    const int16_t *src = (const int16_t *)pcm;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        int32_t left  = *src++;
+        int32_t right = *src++;
+#if PPM_LINK_CHANNELS == 2
+        dst[i] = PPM_FRAME(ppm_encode_s16(left), ppm_encode_s16(right));
+#else
+        dst[i] = ppm_encode_s16((left >> 1) + (right >> 1));
+#endif
+    }
+}
 
-            while (src < limit) {
-                int32_t left      = *src++;
-                int32_t right     = *src++;
-                int16_t mixed     = (int16_t)((left >> 1) + (right >> 1));
-                dst[buffer_pos++] = audio_to_ppm(mixed);
-            }
+static void PPM_RT_FUNC(spk_convert_s32)(const void *pcm, uint32_t frames, uint32_t *dst) {
+    const int32_t *src = (const int32_t *)pcm;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        int32_t left  = *src++;
+        int32_t right = *src++;
+#if PPM_LINK_CHANNELS == 2
+        dst[i] = PPM_FRAME(ppm_encode_s32(left), ppm_encode_s32(right));
+#else
+        dst[i] = ppm_encode_s32((left >> 1) + (right >> 1));
+#endif
+    }
+}
 
-            spk_buffers[current_spk_write_buffer].size     = buffer_pos;
-            spk_buffers[current_spk_write_buffer].position = 0;
-            spk_buffers[current_spk_write_buffer].ready    = true;
+// The mic converters take fine frames from the resampler, see ppm_code_to_fine
+static void PPM_RT_FUNC(mic_convert_s16)(const uint32_t *frames, uint32_t count, void *pcm) {
+    int16_t *dst = (int16_t *)pcm;
 
-            current_spk_write_buffer = (uint8_t)((current_spk_write_buffer + 1) % 2);
-        }
-        spk_data_size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        *dst++ = ppm_fine_to_s16(PPM_FRAME_LEFT(frames[i]));
+#if PPM_LINK_CHANNELS == 2
+        *dst++ = ppm_fine_to_s16(PPM_FRAME_RIGHT(frames[i]));
+#endif
     }
 }
 
-void mic_task(void) {
-    static absolute_time_t last_fill_time;
+static void PPM_RT_FUNC(mic_convert_s32)(const uint32_t *frames, uint32_t count, void *pcm) {
+    int32_t *dst = (int32_t *)pcm;
 
-    if (!tud_audio_mounted() || current_resolution != 16) {
-        return;
+    for (uint32_t i = 0; i < count; i++) {
+        *dst++ = ppm_fine_to_s32(PPM_FRAME_LEFT(frames[i]));
+#if PPM_LINK_CHANNELS == 2
+        *dst++ = ppm_fine_to_s32(PPM_FRAME_RIGHT(frames[i]));
+#endif
     }
+}
 
-    const uint16_t packet_size_bytes = 96;
+// Convert speaker audio directly out of the endpoint FIFO into the TX ring.
+// If the ring is full the data stays in the FIFO until the TX side catches up.
+void PPM_RT_FUNC(spk_task)(void) {
+    tu_fifo_t     *ff          = tud_audio_get_ep_out_ff();
+    uint16_t const frame_bytes = spk_frame_bytes;
 
-    // Initialize on first call or after sending
-    if (pcm_ticks_in_buffer == 0) {
-        memset(mic_buf, 0, packet_size_bytes);
-        mic_dst        = (int16_t *)mic_buf;
-        last_fill_time = get_absolute_time();
-    }
+    ppm_tm_level_set(&statistics.usb_out_level, tu_fifo_count(ff) / frame_bytes);
+
+    while (1) {
+        tu_fifo_buffer_info_t info;
+        tu_fifo_get_read_info(ff, &info);
+
+        uint32_t *dst;
+        uint32_t  span = spsc_ring_write_span(&spk_ring, &dst);
+        if (span == 0 || info.len_lin + info.len_wrap < frame_bytes)
+            break;
+
+        // Tag the next frame for the USB OUT -> TX latency if none is on its way
+        ppm_tm_probe_start(&statistics.spk_probe, spk_ring.head);
+
+        uint32_t frames = info.len_lin / frame_bytes;
+        if (frames == 0) {
+            // Frame split across the FIFO wrap, pull it through a bounce buffer
+            int32_t frame[2];    // Largest frame: two 32 bit slots
+            tu_fifo_read_n(ff, frame, frame_bytes);
+            spk_convert(frame, 1, dst);
+            spsc_ring_commit(&spk_ring, 1);
+            statistics.total_pcm_received++;
+            continue;
+        }
 
-    while (multicore_fifo_rvalid() && (pcm_ticks_in_buffer < packet_size_bytes)) {
-        uint32_t ppm_value = multicore_fifo_pop_blocking();
-        int16_t  pcm       = ppm_to_audio(ppm_value);
-        *mic_dst++         = pcm;
-        pcm_ticks_in_buffer += 2;
+        if (frames > span)
+            frames = span;
+        spk_convert(info.ptr_lin, frames, dst);
+        spsc_ring_commit(&spk_ring, frames);
+        tu_fifo_advance_read_pointer(ff, (uint16_t)(frames * frame_bytes));
+        statistics.total_pcm_received += frames;
     }
 
-    // Check sending conditions:
-    bool buffer_full     = (pcm_ticks_in_buffer >= packet_size_bytes);
-    bool timeout_expired = absolute_time_diff_us(last_fill_time, get_absolute_time()) >= 1000;
+    ppm_tm_level_set(&statistics.spk_ring_level, spsc_ring_count(&spk_ring));
+}
 
-    if (buffer_full || (pcm_ticks_in_buffer > 0 && timeout_expired)) {
-        tud_audio_write((uint8_t *)mic_buf, pcm_ticks_in_buffer);
-        pcm_ticks_in_buffer = 0;
-    }
+#if CFG_TUD_AUDIO_ENABLE_FEEDBACK_EP
+// Feedback is computed here from the TX queue, not by TinyUSB from the FIFO count
+void tud_audio_feedback_params_cb(uint8_t func_id, uint8_t alt_itf, audio_feedback_params_t *feedback_param) {
+    (void)func_id;
+    (void)alt_itf;
+
+    feedback_param->method      = AUDIO_FEEDBACK_METHOD_DISABLED;
+    feedback_param->sample_freq = current_sample_rate;
 }
 
-// void mic_task(void) {
-//     // Check that USB is ready
-//     if (tud_audio_mounted() && current_resolution == 16) {
-//         // Packet size
-//         uint16_t packet_size = 96;
+// Once per USB frame: report the nominal samples per frame (16.16), corrected by how far
+// the speaker queue depth is from its target, so the host follows our PPM clock
+void PPM_RT_FUNC(feedback_task)(void) {
+    static uint32_t last_ms   = 0;
+    static int32_t  depth_avg = 0;    // Filtered depth, 8 fractional bits
 
-//         // Fill buffer with silence
-//         if (pcm_ticks_in_buffer == 0) {
-//             memset(mic_buf, 0, packet_size);
-//             mic_dst           = (int16_t *)mic_buf;
-//         }
+    uint32_t now = board_millis();
+    if (now == last_ms || !tud_audio_mounted())
+        return;
+    last_ms = now;
+
+    uint32_t depth = tx_dma_lead() * PPM_FRAMES_PER_BLOCK / PPM_SYMBOLS_PER_BLOCK + spsc_ring_count(&spk_ring) +
+                     tu_fifo_count(tud_audio_get_ep_out_ff()) / spk_frame_bytes;
+    depth_avg += ((int32_t)(depth << 8) - depth_avg) >> 4;
+
+    int32_t target = (int32_t)((current_sample_rate * SPK_FB_TARGET_MS / 1000) << 8);
+    int32_t error  = target - depth_avg;
+
+    // One sample of depth error is worked off over SPK_FB_SETTLE_MS frames
+    int32_t correction = error * 256 / SPK_FB_SETTLE_MS;
+    int32_t limit      = 1 << 13;    // +-1/8 sample per frame
+    if (correction > limit)
+        correction = limit;
+    if (correction < -limit)
+        correction = -limit;
+
+    uint32_t nominal = (uint32_t)(((uint64_t)current_sample_rate << 16) / 1000);
+    tud_audio_fb_set((uint32_t)((int32_t)nominal + correction));
+}
+#else
+// Implicit feedback: the host follows the microphone packet sizes
+void feedback_task(void) {
+}
+#endif
 
-//         uint16_t samples_added = 0;
-//         uint16_t max_samples   = packet_size / 4;
+// Invoked on every USB start-of-frame (1 ms)
+void tud_sof_cb(uint32_t frame_count) {
+    (void)frame_count;
+    mic_frames_pending++;
+}
 
-//         // First try to get data from semaphores if they are initialized
-//         if (sem_initialized) {
-//             // Non-blocking check for data availability
-//             if (sem_try_acquire(&shared_ppm_data.sem_full)) {
-//                 // Data is available - process buffer
-//                 uint8_t  read_buf  = shared_ppm_data.read_index;
-//                 uint16_t available = shared_ppm_data.size[read_buf];
+// Samples owed for the next frame: rate / 1000 with the remainder carried over,
+// e.g. 44 x 9 + 45 at 44.1 kHz, a steady 48 at 48 kHz
+static inline uint32_t mic_samples_this_frame(void) {
+    mic_rate_phase += current_sample_rate;
+    uint32_t n = mic_rate_phase / 1000;
+    mic_rate_phase -= n * 1000;
+    return n;
+}
 
-//                 // Convert PPM to PCM data for USB
-//                 for (uint16_t i = 0; i < available && samples_added < max_samples; i++) {
-//                     uint32_t ppm_value = shared_ppm_data.buffer[read_buf][i];
-//                     statistics.total_summed_ppm_in_usb += ppm_value;
-//                     int16_t  pcm       = ppm_to_audio(ppm_value);
-//                     statistics.total_pcm_convert++;
+// Once per packet: trim the read rate so the filtered mic_ring depth settles at
+// MIC_RS_TARGET_MS. The far transmitter's clock is what fills the ring, so the integral
+// path ends up holding the offset between its clock and the host's.
+static void PPM_RT_FUNC(mic_rs_update)(void) {
+    uint32_t depth  = spsc_ring_count(&mic_ring);
+    uint32_t target = current_sample_rate * MIC_RS_TARGET_MS / 1000;
+
+    if (mic_rs_priming) {
+        if (depth < target)
+            return;
+        mic_rs_priming = false;
+        mic_rs_depth   = (int32_t)(depth << 8);
+    }
+    mic_rs_depth += ((int32_t)(depth << 8) - mic_rs_depth) >> 4;
+
+    // Positive while the ring fills, so the read rate goes up.
+    // One frame of error is worked off over MIC_RS_SETTLE_MS by the proportional path.
+    int32_t error        = mic_rs_depth - (int32_t)(target << 8);
+    int32_t gain         = (int32_t)((1u << 24) / (current_sample_rate * MIC_RS_SETTLE_MS / 1000));
+    int32_t proportional = error * gain;
+
+    mic_rs_integral += proportional / MIC_RS_INTEGRATE_MS;
+    if (mic_rs_integral > MIC_RS_MAX_TRIM)
+        mic_rs_integral = MIC_RS_MAX_TRIM;
+    if (mic_rs_integral < -MIC_RS_MAX_TRIM)
+        mic_rs_integral = -MIC_RS_MAX_TRIM;
+
+    int32_t trim = proportional + mic_rs_integral;
+    if (trim > MIC_RS_MAX_TRIM)
+        trim = MIC_RS_MAX_TRIM;
+    if (trim < -MIC_RS_MAX_TRIM)
+        trim = -MIC_RS_MAX_TRIM;
+    statistics.mic_rs_trim = trim;
+}
 
-//                     *mic_dst++ = pcm;    // Left channel
-//                     *mic_dst++ = pcm;    // Right channel
+// Linear interpolation of both channels of two fine frames, weight in Q15. The codes are
+// 9 or 10 bits, so anything steeper than linear would be buried in their quantisation.
+static inline uint32_t mic_rs_lerp(uint32_t a, uint32_t b, int32_t weight) {
+    int32_t left  = (int32_t)PPM_FRAME_LEFT(a);
+    int32_t right = (int32_t)PPM_FRAME_RIGHT(a);
 
-//                     samples_added++;
-//                 }
+    left += (((int32_t)PPM_FRAME_LEFT(b) - left) * weight) >> 15;
+    right += (((int32_t)PPM_FRAME_RIGHT(b) - right) * weight) >> 15;
+    return PPM_FRAME(left, right);
+}
 
-//                 // Release buffer
-//                 shared_ppm_data.size[read_buf] = 0;
-//                 shared_ppm_data.read_index     = (uint8_t)((read_buf + 1) % 2);    // Add explicit type casting
-//                 sem_release(&shared_ppm_data.sem_empty);
-//             }
-//         }
+// Advance the read position by one output frame. False, with the position unchanged,
+// if mic_ring runs dry on the way.
+static inline bool mic_rs_step(void) {
+    uint64_t pos   = (uint64_t)mic_rs_frac + (1ull << 32) + (int64_t)statistics.mic_rs_trim;
+    uint32_t whole = (uint32_t)(pos >> 32);
 
-//         // If data from semaphores is insufficient or not available, use FIFO
-//         while (multicore_fifo_rvalid() /*&& samples_added < max_samples*/) {
-//             uint32_t ppm_value = multicore_fifo_pop_blocking();
-//             statistics.total_summed_ppm_in_usb += ppm_value;
-//             int16_t  pcm       = ppm_to_audio(ppm_value);
-//             pcm_ticks_in_buffer++;
-//             statistics.total_pcm_convert++;
+    if (spsc_ring_count(&mic_ring) < whole)
+        return false;
+    for (; whole; whole--) {
+        uint32_t *src;
+        spsc_ring_read_span(&mic_ring, &src);
+        mic_rs_prev = mic_rs_next;
+        mic_rs_next = PPM_FRAME(ppm_code_to_fine(PPM_FRAME_LEFT(*src)), ppm_code_to_fine(PPM_FRAME_RIGHT(*src)));
+        spsc_ring_release(&mic_ring, 1);
+    }
+    mic_rs_frac = (uint32_t)pos;
+    return true;
+}
 
-//             *mic_dst++ = pcm;
+// One packet per SOF with exactly the samples owed for that frame, resampled from mic_ring
+void PPM_RT_FUNC(mic_task)(void) {
+    static bool concealing = false;
 
-//             samples_added++;
+    if (!tud_audio_mounted() || !mic_streaming) {
+        // Nobody is listening, keep the ring fresh
+        uint32_t *src;
+        uint32_t  span;
+        while ((span = spsc_ring_read_span(&mic_ring, &src)) != 0) {
+            spsc_ring_release(&mic_ring, span);
+        }
+        mic_frames_pending = 0;
+        mic_rs_prev        = MIC_RS_SILENCE;
+        mic_rs_next        = MIC_RS_SILENCE;
+        mic_rs_priming     = true;
+        return;
+    }
 
-//             if(pcm_ticks_in_buffer == packet_size){
-//                 break;
-//             }
-//         }
+    while (mic_frames_pending) {
+        mic_frames_pending--;
 
-//         // Send data via USB
-//         // TODO: send incomplete packets at end of transmission.
-//         if(pcm_ticks_in_buffer == packet_size) {
-//             uint16_t bytes_written = tud_audio_write((uint8_t *)mic_buf, pcm_ticks_in_buffer*2); // pcm_ticks_in_buffer*2 because pcm ticks are 16bit and we're counting bytes here.
-//             statistics.total_ticks_attempt_send_to_usb += pcm_ticks_in_buffer;
-//             statistics.total_bytes_sent_to_usb += bytes_written;
-//             pcm_ticks_in_buffer = 0;
-//         }
-//     }
-// }
+        uint32_t samples = mic_samples_this_frame();
+        uint8_t *dst     = (uint8_t *)mic_buf;
+        uint32_t padded  = 0;
+        uint32_t frames[MIC_RS_MAX_FRAME];
+
+        mic_rs_update();
+        for (uint32_t i = 0; i < samples; i++) {
+            frames[i] = mic_rs_lerp(mic_rs_prev, mic_rs_next, (int32_t)(mic_rs_frac >> 17));
+            if (mic_rs_priming) {
+                padded++;
+            }
+            else if (!mic_rs_step()) {
+                // Real underrun: hold the last value until the ring is back at its target
+                mic_rs_priming = true;
+                statistics.mic_rs_primes++;
+            }
+        }
+        mic_convert(frames, samples, dst);
+
+        if (padded) {
+            // Traced once per run of padded packets
+            if (!concealing)
+                ppm_trace(PPM_TRACE_MIC_PADDED, padded, samples);
+            concealing = true;
+
+            mic_ring.underflows += padded;
+            statistics.mic_padded_frames++;
+        }
+        else {
+            concealing = false;
+        }
+
+        ppm_tm_probe_end(&statistics.mic_probe, mic_ring.tail);
+        statistics.total_bytes_sent_to_usb += tud_audio_write(dst, (uint16_t)(samples * mic_frame_bytes));
+    }
+}
 
 //--------------------------------------------------------------------+
 // BLINKING TASK
@@ -570,39 +1079,53 @@ void led_blinking_task(void) {
     led_state = 1 - led_state;
 }
 
-// void statistics_task(void) {
-//     // Print statistics every 15 seconds
-//     static uint32_t last_print_ms = 0;
-
-//     if (board_millis() - last_print_ms < 15000)
-//         return;
-//     last_print_ms = board_millis();
-
-//     printf("Statistics:\r\n");
-//     printf("  Total PCM received: %lu\r\n", statistics.total_pcm_received);
-//     printf("  Total PPM converted: %lu\r\n", statistics.total_ppm_convert);
-//     printf("  Total PCM converted: %lu\r\n", statistics.total_pcm_convert);
-//     printf("  Total PPM sent: %lu\r\n", statistics.total_ppm_sent);
-//     printf("  Total PPM received: %lu\r\n", statistics.total_ppm_received);
-//     printf("  Total sent: %lu\r\n", statistics.total_sent);
-//     printf("  Total received: %lu\r\n", statistics.total_received);
-//     printf("  Total summed PPM out: %llu\r\n", statistics.total_summed_ppm_out);
-//     printf("  Total summed PPM in: %llu\r\n", statistics.total_summed_ppm_in);
-//     printf("  Total summed PPM before USB communication: %llu\r\n", statistics.total_summed_ppm_in_usb);
-//     printf("  Total ticks attempted to send to USB: %llu\r\n", statistics.total_ticks_attempt_send_to_usb);
-//     printf("  Total bytes sent to USB: %llu\r\n", statistics.total_bytes_sent_to_usb);
-
-//     // Reset statistics after printing
-//     statistics.total_pcm_received              = 0;
-//     statistics.total_ppm_convert               = 0;
-//     statistics.total_pcm_convert               = 0;
-//     statistics.total_ppm_sent                  = 0;
-//     statistics.total_ppm_received              = 0;
-//     statistics.total_sent                      = 0;
-//     statistics.total_received                  = 0;
-//     statistics.total_summed_ppm_out            = 0;
-//     statistics.total_summed_ppm_in             = 0;
-//     statistics.total_summed_ppm_in_usb         = 0;
-//     statistics.total_ticks_attempt_send_to_usb = 0;
-//     statistics.total_bytes_sent_to_usb         = 0;
-// }
+//--------------------------------------------------------------------+
+// TELEMETRY TASK
+//--------------------------------------------------------------------+
+static void statistics_build(ppm_tm_text_t *text) {
+    const statistics_t *st = &statistics;
+
+    ppm_tm_printf(text, "rate %lu\r\n", (unsigned long)current_sample_rate);
+    ppm_tm_printf(text, "clock %lu run=%lu switches=%lu\r\n", (unsigned long)SYS_FREQ, (unsigned long)timing_run_khz,
+                  (unsigned long)ppm_timing.switches);
+    ppm_tm_printf(text, "calibration %s\r\n", st->rx_calibrated ? "stored" : "default");
+    ppm_tm_printf(text, "count pcm_in=%lu ppm_out=%lu ppm_in=%lu frames_in=%lu usb_in_bytes=%llu\r\n",
+                  (unsigned long)st->total_pcm_received, (unsigned long)st->total_ppm_sent,
+                  (unsigned long)st->total_ppm_received, (unsigned long)st->total_received,
+                  (unsigned long long)st->total_bytes_sent_to_usb);
+    ppm_tm_printf(text, "drop tx_idle=%lu tx_overrun=%lu rx_overrun=%lu rx_sync=%lu rx_crc=%lu rx_lost=%lu rx_bad=%lu rx_slip=%lu mic_overflow=%lu mic_underflow=%lu mic_padded=%lu\r\n",
+                  (unsigned long)st->tx_idle_symbols, (unsigned long)st->tx_overruns, (unsigned long)st->rx_overruns, (unsigned long)st->rx_sync_errors,
+                  (unsigned long)st->rx_crc_errors, (unsigned long)st->rx_lost_blocks, (unsigned long)st->rx_bad_symbols,
+                  (unsigned long)st->rx_detector_slips, (unsigned long)mic_ring.overflows,
+                  (unsigned long)mic_ring.underflows, (unsigned long)st->mic_padded_frames);
+    ppm_tm_printf(text, "conceal rx_frames=%lu\r\n", (unsigned long)st->rx_concealed_frames);
+    ppm_tm_printf(text, "mic_rs trim_ppb=%ld primes=%lu\r\n", (long)(((int64_t)st->mic_rs_trim * 1000000000) >> 32),
+                  (unsigned long)st->mic_rs_primes);
+
+    ppm_tm_print_level(text, "usb_out", &st->usb_out_level);
+    ppm_tm_print_level(text, "spk_ring", &st->spk_ring_level);
+    ppm_tm_print_level(text, "tx_lead", &st->tx_lead_level);
+    ppm_tm_print_level(text, "rx_backlog", &st->rx_backlog_level);
+    ppm_tm_print_level(text, "mic_ring", &st->mic_ring_level);
+
+    ppm_tm_print_hist(text, "usb_out_to_tx_queue", &st->spk_probe.latency);
+    ppm_tm_print_hist(text, "tx_queue_to_dma", &st->tx_probe.latency);
+    ppm_tm_print_hist(text, "rx_to_usb_in", &st->mic_probe.latency);
+    ppm_tm_print_hist(text, "core0_loop", &st->core0_loop);
+    ppm_tm_print_hist(text, "core1_loop", &st->core1_loop);
+}
+
+// Terminal commands:
+//   clock <kHz>    switch to another clock profile (ppm_common/ppm_timing.h) if the link fits it
+static void statistics_command(const char *line) {
+    if (strncmp(line, "clock ", 6) == 0) {
+        uint32_t sys_khz = (uint32_t)strtoul(line + 6, NULL, 10);
+        if (timing_profile_fits(sys_khz) && ppm_timing_request(sys_khz))
+            timing_run_khz = sys_khz;
+    }
+}
+
+// Text snapshots on the CDC interface, whenever a terminal has it open
+void statistics_task(void) {
+    ppm_tm_stream_task(&telemetry, statistics_build, statistics_command);
+}
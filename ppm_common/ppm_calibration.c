@@ -0,0 +1,146 @@
+#include "ppm_calibration.h"
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include <stddef.h>
+#include <string.h>
+
+#define PPM_CAL_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define PPM_CAL_FLASH_BYTES  ((sizeof(ppm_cal_sector_t) + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1))
+
+_Static_assert(sizeof(ppm_cal_sector_t) <= FLASH_SECTOR_SIZE, "calibration does not fit one flash sector");
+
+static const ppm_cal_sector_t *const ppm_cal_flash = (const ppm_cal_sector_t *)(XIP_BASE + PPM_CAL_FLASH_OFFSET);
+
+// Staging copy for ppm_cal_store, padded to whole flash pages
+static union {
+    ppm_cal_sector_t sector;
+    uint8_t          bytes[PPM_CAL_FLASH_BYTES];
+} ppm_cal_staging;
+
+static uint32_t ppm_cal_crc32(const void *data, uint32_t len) {
+    const uint8_t *p   = (const uint8_t *)data;
+    uint32_t       crc = 0xFFFFFFFFu;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+static bool ppm_cal_valid(const ppm_cal_sector_t *sector) {
+    return sector->magic == PPM_CAL_MAGIC && sector->version == PPM_CAL_VERSION &&
+           sector->crc == ppm_cal_crc32(sector, offsetof(ppm_cal_sector_t, crc));
+}
+
+bool ppm_cal_load(uint32_t sys_khz, int8_t *delta, int8_t fallback) {
+    if (ppm_cal_valid(ppm_cal_flash)) {
+        for (uint32_t i = 0; i < PPM_CAL_MAX_PROFILES; i++) {
+            if (ppm_cal_flash->profiles[i].sys_khz == sys_khz) {
+                memcpy(delta, ppm_cal_flash->profiles[i].delta, PPM_CAL_WIDTHS);
+                return true;
+            }
+        }
+    }
+
+    memset(delta, fallback, PPM_CAL_WIDTHS);
+    return false;
+}
+
+// A raw count captured for several widths maps to the middle of them
+static void ppm_cal_set(ppm_cal_profile_t *profile, uint32_t raw, uint32_t first, uint32_t last) {
+    if (raw == 0)
+        return;
+
+    int32_t d = (int32_t)((first + last + 1) / 2) - (int32_t)raw;
+    if (d > INT8_MAX)
+        d = INT8_MAX;
+    if (d <= PPM_CAL_UNSET)
+        d = PPM_CAL_UNSET + 1;
+    profile->delta[raw] = (int8_t)d;
+}
+
+bool ppm_cal_build(ppm_cal_profile_t *profile, uint32_t sys_khz, const uint32_t *measured,
+                   uint32_t first_width, uint32_t n_widths) {
+    profile->sys_khz = sys_khz;
+    memset(profile->delta, PPM_CAL_UNSET, PPM_CAL_WIDTHS);
+
+    // Widths arrive in ascending order, so equal raw counts come in runs
+    uint32_t run_raw   = 0;
+    uint32_t run_first = 0;
+    uint32_t run_last  = 0;
+
+    for (uint32_t i = 0; i < n_widths; i++) {
+        uint32_t raw   = measured[i];
+        uint32_t width = first_width + i;
+        if (raw == 0 || raw >= PPM_CAL_WIDTHS)
+            continue;
+
+        if (raw == run_raw) {
+            run_last = width;
+            continue;
+        }
+        ppm_cal_set(profile, run_raw, run_first, run_last);
+        run_raw   = raw;
+        run_first = width;
+        run_last  = width;
+    }
+    ppm_cal_set(profile, run_raw, run_first, run_last);
+
+    // Raw counts the sweep never produced take the offset of the nearest one below,
+    // counts below the first capture take the first offset
+    int8_t carry = PPM_CAL_UNSET;
+    for (uint32_t raw = 0; raw < PPM_CAL_WIDTHS && carry == PPM_CAL_UNSET; raw++) {
+        carry = profile->delta[raw];
+    }
+    if (carry == PPM_CAL_UNSET)
+        return false;
+
+    for (uint32_t raw = 0; raw < PPM_CAL_WIDTHS; raw++) {
+        if (profile->delta[raw] == PPM_CAL_UNSET)
+            profile->delta[raw] = carry;
+        else
+            carry = profile->delta[raw];
+    }
+    return true;
+}
+
+static void ppm_cal_program(void *param) {
+    (void)param;
+    flash_range_erase(PPM_CAL_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(PPM_CAL_FLASH_OFFSET, ppm_cal_staging.bytes, PPM_CAL_FLASH_BYTES);
+}
+
+bool ppm_cal_store(const ppm_cal_profile_t *profile) {
+    ppm_cal_sector_t *sector = &ppm_cal_staging.sector;
+
+    memset(ppm_cal_staging.bytes, 0xFF, sizeof(ppm_cal_staging.bytes));
+    if (ppm_cal_valid(ppm_cal_flash)) {
+        memcpy(sector, ppm_cal_flash, sizeof(*sector));
+    }
+    else {
+        memset(sector, 0, sizeof(*sector));
+        sector->magic   = PPM_CAL_MAGIC;
+        sector->version = PPM_CAL_VERSION;
+    }
+
+    // Same clock first, then an empty slot, otherwise the last slot is replaced
+    uint32_t slot = PPM_CAL_MAX_PROFILES - 1;
+    for (uint32_t i = PPM_CAL_MAX_PROFILES; i-- > 0;) {
+        if (sector->profiles[i].sys_khz == 0)
+            slot = i;
+    }
+    for (uint32_t i = 0; i < PPM_CAL_MAX_PROFILES; i++) {
+        if (sector->profiles[i].sys_khz == profile->sys_khz)
+            slot = i;
+    }
+
+    sector->profiles[slot] = *profile;
+    sector->crc            = ppm_cal_crc32(sector, offsetof(ppm_cal_sector_t, crc));
+
+    if (flash_safe_execute(ppm_cal_program, NULL, 1000) != PICO_OK)
+        return false;
+    return ppm_cal_valid(ppm_cal_flash) && memcmp(ppm_cal_flash, sector, sizeof(*sector)) == 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-width detector calibration, kept in the last flash sector.
+//
+// The 'T' sweep in ppm_loop / ppm_loop2core sends every pause width and records the raw
+// count pulse_detector returns for it. The table stores, for each raw count, the offset
+// back to the pause width that produced it (the constant MIN_TACKT, measured per width).
+// One profile per system clock, since the offsets depend on it.
+//
+// Receivers copy their profile to RAM at boot with ppm_cal_load and correct every capture
+// with ppm_cal_correct, a single table lookup.
+
+#define PPM_CAL_MAGIC        0x4C43504Du    // "MPCL"
+#define PPM_CAL_VERSION      1
+#define PPM_CAL_WIDTHS       1536    // Raw counts covered by a profile, longer pauses use the fallback
+#define PPM_CAL_MAX_PROFILES 2
+#define PPM_CAL_UNSET        INT8_MIN
+
+typedef struct {
+    uint32_t sys_khz;                  // 0: empty slot
+    int8_t   delta[PPM_CAL_WIDTHS];    // Pause width - raw count
+} ppm_cal_profile_t;
+
+typedef struct {
+    uint32_t          magic;
+    uint32_t          version;
+    ppm_cal_profile_t profiles[PPM_CAL_MAX_PROFILES];
+    uint32_t          crc;    // CRC-32 of everything above
+} ppm_cal_sector_t;
+
+// Fill delta[PPM_CAL_WIDTHS] with the stored profile for sys_khz, or with fallback when
+// there is none. Returns true if a stored profile was found.
+bool ppm_cal_load(uint32_t sys_khz, int8_t *delta, int8_t fallback);
+
+// Build a profile from a sweep: measured[i] is the raw count captured for pause width
+// first_width + i, 0 if nothing was captured. Returns false if the sweep has no captures.
+bool ppm_cal_build(ppm_cal_profile_t *profile, uint32_t sys_khz, const uint32_t *measured,
+                   uint32_t first_width, uint32_t n_widths);
+
+// Write a profile to flash, replacing the one for the same clock. Safe to call with the
+// other core running if it has called multicore_lockout_victim_init().
+bool ppm_cal_store(const ppm_cal_profile_t *profile);
+
+// Pause width for a raw detector count
+static inline uint32_t ppm_cal_correct(const int8_t *delta, uint32_t measured, int32_t fallback) {
+    return (uint32_t)((int32_t)measured + (measured < PPM_CAL_WIDTHS ? delta[measured] : fallback));
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,88 @@
+#include "ppm_link.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "ppm.pio.h"
+
+static const pio_program_t *const ppm_link_programs[] = {
+    [PPM_LINK_GENERATOR]      = &pulse_generator_program,
+    [PPM_LINK_GENERATOR_FINE] = &pulse_generator_fine_program,
+    [PPM_LINK_DETECTOR]       = &pulse_detector_program,
+    [PPM_LINK_DETECTOR_LATE]  = &pulse_detector_late_program,
+};
+
+uint ppm_link_load(PIO pio, ppm_link_program_t program) {
+    return (uint)pio_add_program(pio, ppm_link_programs[program]);
+}
+
+// clk_sys / pio_hz in 1/256, rounded, at least 1
+static uint32_t ppm_link_clkdiv(uint32_t pio_hz) {
+    uint64_t clk_hz = clock_get_hz(clk_sys);
+    uint64_t div    = ((clk_hz << 8) + pio_hz / 2) / pio_hz;
+    return div < 0x100 ? 0x100 : (uint32_t)div;
+}
+
+void ppm_link_init(PIO pio, uint sm, ppm_link_program_t program, uint offset, uint pin, uint32_t pio_hz,
+                   bool rx_join) {
+    pio_sm_config c;
+    bool          output = program == PPM_LINK_GENERATOR || program == PPM_LINK_GENERATOR_FINE;
+
+    switch (program) {
+        case PPM_LINK_GENERATOR:
+            c = pulse_generator_program_get_default_config(offset);
+            break;
+        case PPM_LINK_GENERATOR_FINE:
+            c = pulse_generator_fine_program_get_default_config(offset);
+            break;
+        case PPM_LINK_DETECTOR:
+            c = pulse_detector_program_get_default_config(offset);
+            break;
+        default:
+            c = pulse_detector_late_program_get_default_config(offset);
+            break;
+    }
+
+    if (output) {
+        // The pulse is set and side-set on the same pin
+        sm_config_set_set_pins(&c, pin, 1);
+        sm_config_set_sideset_pins(&c, pin);
+    }
+    else {
+        sm_config_set_in_pins(&c, pin);
+        sm_config_set_jmp_pin(&c, pin);
+        if (rx_join)
+            sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    }
+    pio_gpio_init(pio, pin);
+    pio_sm_set_consecutive_pindirs(pio, sm, pin, 1, output);
+
+    uint32_t div = ppm_link_clkdiv(pio_hz);
+    sm_config_set_clkdiv_int_frac8(&c, div >> 8, (uint8_t)div);
+    pio_sm_init(pio, sm, offset, &c);
+}
+
+void ppm_link_set_clkdiv(PIO pio, uint sm, uint32_t pio_hz) {
+    uint32_t div = ppm_link_clkdiv(pio_hz);
+    pio_sm_set_clkdiv_int_frac8(pio, sm, div >> 8, (uint8_t)div);
+}
+
+void ppm_link_capture_init(ppm_link_capture_t *cap, PIO pio, uint sm, uint32_t *ring, uint ring_bits) {
+    cap->ring     = ring;
+    cap->mask     = (1u << ring_bits) - 1;
+    cap->chan     = (uint)dma_claim_unused_channel(true);
+    cap->consumed = 0;
+
+    dma_channel_config c = dma_channel_get_default_config(cap->chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, ring_bits + 2);    // Wrap write address on the ring (size in bytes)
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+
+    dma_channel_configure(cap->chan, &c, ring, &pio->rxf[sm], PPM_LINK_CAPTURE_COUNT, false);
+}
+
+void ppm_link_capture_arm(ppm_link_capture_t *cap, bool start) {
+    cap->consumed = 0;
+    dma_channel_set_write_addr(cap->chan, cap->ring, false);
+    dma_channel_set_trans_count(cap->chan, PPM_LINK_CAPTURE_COUNT, start);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// PPM link state machines shared by every firmware.
+//
+// ppm.pio next to this file holds the programs (pulse_generator, pulse_detector and their
+// PPM_FINE_DETECTOR variants), each firmware generates ppm.pio.h from it and builds
+// ppm_link.c with it. A generator drives one pin through set and side-set, a detector reads
+// one pin through in and jmp pin; both run at a whole or fractional division of clk_sys
+// computed in integer maths.
+//
+// The FIFO accessors below are inline and skip the SDK's parameter checks. The SMs are
+// claimed at runtime, so each is an indexed load or store into the PIO's FIFO registers.
+
+// Both generators hold every pulse high for PPM_LINK_PULSE_CYCLES. The PPM_FINE_DETECTOR
+// pair tests the pin on alternate cycles, with single cycle pulses one of them missed every
+// pulse after an odd pause. The pulse does not enter the measured pause (falling to rising
+// edge), but the two pulses of a symbol make it PPM_LINK_PULSE_COUNTS two cycle counts
+// longer: the minimum interval (ppm_timing_min_interval) is that much shorter instead.
+#define PPM_LINK_PULSE_CYCLES 2
+#define PPM_LINK_PULSE_COUNTS 1
+
+typedef enum {
+    PPM_LINK_GENERATOR,         // pulse_generator, two cycles per pause count
+    PPM_LINK_GENERATOR_FINE,    // pulse_generator_fine, one cycle per pause count
+    PPM_LINK_DETECTOR,          // pulse_detector
+    PPM_LINK_DETECTOR_LATE,     // pulse_detector_late, one cycle behind pulse_detector
+} ppm_link_program_t;
+
+// Load a program into a PIO, returns its offset. Once per PIO, every SM running it shares it.
+uint ppm_link_load(PIO pio, ppm_link_program_t program);
+
+// Configure a claimed SM to run program at offset on pin, clocked at pio_hz. Detectors get
+// a joined RX FIFO if rx_join (a DMA channel drains them). The SM is left disabled.
+void ppm_link_init(PIO pio, uint sm, ppm_link_program_t program, uint offset, uint pin, uint32_t pio_hz,
+                   bool rx_join);
+
+// Divider for pio_hz from the current clk_sys, 8 bit fraction, no float. Also after a clock
+// profile switch (ppm_timing.h).
+void ppm_link_set_clkdiv(PIO pio, uint sm, uint32_t pio_hz);
+
+// Capture ring: a DMA channel copies an SM's RX FIFO (a detector's captures, the PDM
+// sampler's words) into a ring of 1 << ring_bits words, aligned to its size. The channel is
+// armed for PPM_LINK_CAPTURE_COUNT transfers and counts down, so the captures written since
+// it was armed come out of its transfer count; consumed counts those the reader took out.
+#define PPM_LINK_CAPTURE_COUNT 0xFFFFFFFFu
+
+typedef struct {
+    uint32_t *ring;
+    uint32_t  mask;        // Ring size - 1
+    uint      chan;
+    uint32_t  consumed;    // Captures taken out of the ring since the DMA was armed
+} ppm_link_capture_t;
+
+// Claim a DMA channel for the RX FIFO of pio/sm, not started
+void ppm_link_capture_init(ppm_link_capture_t *cap, PIO pio, uint sm, uint32_t *ring, uint ring_bits);
+
+// Back to the start of the ring with a full count and nothing consumed. Started right away
+// if start, else the caller starts it with others (dma_start_channel_mask).
+void ppm_link_capture_arm(ppm_link_capture_t *cap, bool start);
+
+// Captures written since the DMA was armed
+static inline uint32_t ppm_link_capture_written(const ppm_link_capture_t *cap) {
+    return PPM_LINK_CAPTURE_COUNT - dma_hw->ch[cap->chan].transfer_count;
+}
+
+// Reader fell a whole ring behind written: skip to the oldest capture still intact. Returns the
+// captures lost, 0 if none.
+static inline uint32_t ppm_link_capture_skip(ppm_link_capture_t *cap, uint32_t written) {
+    uint32_t lost = written - cap->consumed;
+    if (lost <= cap->mask + 1)
+        return 0;
+    lost -= cap->mask + 1;
+    cap->consumed += lost;
+    return lost;
+}
+
+// Capture number n since the DMA was armed, still in the ring
+static inline uint32_t ppm_link_capture_at(const ppm_link_capture_t *cap, uint32_t n) {
+    return cap->ring[n & cap->mask];
+}
+
+// The transfer count ran out, the SM's FIFO holds captures until the channel is armed again
+static inline bool ppm_link_capture_done(const ppm_link_capture_t *cap) {
+    return !dma_channel_is_busy(cap->chan);
+}
+
+static inline bool ppm_link_tx_full(PIO pio, uint sm) {
+    return (pio->fstat & (1u << (PIO_FSTAT_TXFULL_LSB + sm))) != 0;
+}
+
+static inline bool ppm_link_rx_empty(PIO pio, uint sm) {
+    return (pio->fstat & (1u << (PIO_FSTAT_RXEMPTY_LSB + sm))) != 0;
+}
+
+// Queue a pause width on a generator, the caller checked for room
+static inline void ppm_link_put(PIO pio, uint sm, uint32_t width) {
+    pio->txf[sm] = width;
+}
+
+static inline void ppm_link_put_blocking(PIO pio, uint sm, uint32_t width) {
+    while (ppm_link_tx_full(pio, sm))
+        tight_loop_contents();
+    pio->txf[sm] = width;
+}
+
+// Raw count from a detector, the caller checked it has one
+static inline uint32_t ppm_link_get(PIO pio, uint sm) {
+    return pio->rxf[sm];
+}
+
+#ifdef __cplusplus
+}
+#endif
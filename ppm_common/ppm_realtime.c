@@ -0,0 +1,52 @@
+#include "ppm_realtime.h"
+#include "hardware/structs/systick.h"
+#include <string.h>
+
+#define PPM_RT_THRASH_BYTES (64 * 1024)    // 4x the XIP cache
+#define PPM_RT_THRASH_LINE  8              // XIP cache line
+
+// The probe itself runs from SRAM in either build, so only fn is measured
+void __not_in_flash_func(ppm_rt_jitter_measure)(void (*fn)(void), uint32_t iterations, ppm_rt_jitter_t *result) {
+    uint64_t sum = 0;
+
+    memset(result, 0, sizeof(*result));
+    result->iterations = iterations;
+    result->min        = UINT32_MAX;
+
+    // Free running 24 bit down counter at clk_sys
+    systick_hw->csr = 0;
+    systick_hw->rvr = 0x00FFFFFFu;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t start = systick_hw->cvr;
+        fn();
+        uint32_t cycles = (start - systick_hw->cvr) & 0x00FFFFFFu;
+
+        sum += cycles;
+        if (cycles < result->min)
+            result->min = cycles;
+        if (cycles > result->max)
+            result->max = cycles;
+
+        // Bin k holds calls under 64 << k cycles
+        int bin = cycles < 64 ? 0 : 32 - __builtin_clz(cycles) - 6;
+        if (bin >= PPM_RT_JITTER_BINS)
+            bin = PPM_RT_JITTER_BINS - 1;
+        result->hist[bin]++;
+    }
+
+    if (iterations)
+        result->mean = (uint32_t)(sum / iterations);
+    else
+        result->min = 0;
+}
+
+void ppm_rt_flash_thrash(void) {
+    const volatile uint32_t *flash = (const volatile uint32_t *)XIP_BASE;
+
+    for (uint32_t offset = 0; offset < PPM_RT_THRASH_BYTES; offset += PPM_RT_THRASH_LINE) {
+        (void)flash[offset / sizeof(uint32_t)];
+    }
+}
@@ -0,0 +1,9 @@
+# Deterministic latency build: time critical code in SRAM, hot data in core local scratch,
+# DMA and the real-time core first on the bus (ppm_common/ppm_realtime.h)
+option(PPM_REALTIME "Build the time critical paths for deterministic latency" OFF)
+
+function(ppm_realtime_configure target)
+  if(PPM_REALTIME)
+    target_compile_definitions(${target} PRIVATE PPM_REALTIME=1)
+  endif()
+endfunction()
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "hardware/structs/busctrl.h"
+#include "pico/platform.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deterministic latency build profile, enabled with cmake -DPPM_REALTIME=ON.
+//
+// Both cores and the DMA share the XIP cache and the QSPI bus. A cache miss on one core
+// therefore stalls for as long as the other core keeps the flash busy, and the receive and
+// transmit loops pick up microseconds of jitter from whatever the other core is doing. With
+// PPM_REALTIME:
+//
+//   PPM_RT_FUNC(name)    the function runs from SRAM
+//   PPM_RT_CORE0_DATA    the variable lives in SCRATCH_Y, next to core0's stack
+//   PPM_RT_CORE1_DATA    the variable lives in SCRATCH_X, next to core1's stack
+//   ppm_rt_init(core)    DMA and the given core win bus arbitration
+//
+// Without it everything expands to the default placement, so the same source builds both
+// ways for comparison. Each scratch bank is 4 KB with a 2 KB stack at the top, keep what
+// goes there small.
+
+#ifdef PPM_REALTIME
+#define PPM_RT_FUNC(name) __not_in_flash_func(name)
+#define PPM_RT_CORE0_DATA __scratch_y("ppm_rt")
+#define PPM_RT_CORE1_DATA __scratch_x("ppm_rt")
+#else
+#define PPM_RT_FUNC(name) name
+#define PPM_RT_CORE0_DATA
+#define PPM_RT_CORE1_DATA
+#endif
+
+// Call once from main, rt_core being the core that runs the time critical loop
+static inline void ppm_rt_init(uint32_t rt_core) {
+#ifdef PPM_REALTIME
+    busctrl_hw->priority = BUSCTRL_BUS_PRIORITY_DMA_W_BITS | BUSCTRL_BUS_PRIORITY_DMA_R_BITS |
+                           (rt_core ? BUSCTRL_BUS_PRIORITY_PROC1_BITS : BUSCTRL_BUS_PRIORITY_PROC0_BITS);
+#else
+    (void)rt_core;
+#endif
+}
+
+// Jitter test: time fn on the calling core with SysTick while the other core loads the
+// flash with ppm_rt_flash_thrash
+#define PPM_RT_JITTER_BINS 8
+
+typedef struct {
+    uint32_t iterations;
+    uint32_t min;
+    uint32_t max;
+    uint32_t mean;                        // Cycles per call, including the call itself
+    uint32_t hist[PPM_RT_JITTER_BINS];    // Calls under 64, 128, ... 4096 cycles, the last bin holds the rest
+} ppm_rt_jitter_t;
+
+void ppm_rt_jitter_measure(void (*fn)(void), uint32_t iterations, ppm_rt_jitter_t *result);
+
+// One pass over 64 KB of flash through the cache, evicting everything else in it
+void ppm_rt_flash_thrash(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,101 @@
+#include "ppm_telemetry.h"
+#include "tusb.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+void ppm_tm_printf(ppm_tm_text_t *text, const char *fmt, ...) {
+    if (text->len >= text->size)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(text->buf + text->len, text->size - text->len, fmt, args);
+    va_end(args);
+
+    // A truncated line still ends the buffer, the next snapshot starts clean
+    if (n > 0)
+        text->len += (uint32_t)n < text->size - text->len ? (uint32_t)n : text->size - text->len - 1;
+}
+
+// name n=<count> max=<us> then the bin counts, bin 0 first
+void ppm_tm_print_hist(ppm_tm_text_t *text, const char *name, const ppm_tm_hist_t *hist) {
+    ppm_tm_printf(text, "hist %s n=%lu max=%lu", name, (unsigned long)hist->count, (unsigned long)hist->max);
+    for (uint32_t i = 0; i < PPM_TM_HIST_BINS; i++) {
+        ppm_tm_printf(text, " %lu", (unsigned long)hist->bins[i]);
+    }
+    ppm_tm_printf(text, "\r\n");
+}
+
+void ppm_tm_print_level(ppm_tm_text_t *text, const char *name, const ppm_tm_level_t *level) {
+    ppm_tm_printf(text, "level %s %lu peak=%lu\r\n", name, (unsigned long)level->now, (unsigned long)level->peak);
+}
+
+void ppm_tm_stream_init(ppm_tm_stream_t *stream, uint32_t period_ms) {
+    stream->len         = 0;
+    stream->pos         = 0;
+    stream->last        = ppm_tm_now();
+    stream->sequence    = 0;
+    stream->period_us   = period_ms * 1000u;
+    stream->command_len = 0;
+}
+
+static void ppm_tm_command_task(ppm_tm_stream_t *stream, void (*command)(const char *line)) {
+    uint8_t  chunk[16];
+    uint32_t n;
+
+    while ((n = tud_cdc_read(chunk, sizeof(chunk))) != 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            char c = (char)chunk[i];
+            if (c != '\r' && c != '\n') {
+                // Overlong lines keep counting so they are not taken for a command
+                if (stream->command_len < PPM_TM_COMMAND_BYTES - 1)
+                    stream->command[stream->command_len] = c;
+                stream->command_len++;
+                continue;
+            }
+            if (stream->command_len && stream->command_len < PPM_TM_COMMAND_BYTES && command) {
+                stream->command[stream->command_len] = '\0';
+                command(stream->command);
+            }
+            stream->command_len = 0;
+        }
+    }
+}
+
+void ppm_tm_stream_task(ppm_tm_stream_t *stream, void (*build)(ppm_tm_text_t *text),
+                        void (*command)(const char *line)) {
+    if (tud_cdc_available())
+        ppm_tm_command_task(stream, command);
+
+    // No terminal open, drop what is pending rather than fill the FIFO
+    if (!tud_cdc_connected()) {
+        stream->len         = stream->pos = 0;
+        stream->command_len = 0;
+        return;
+    }
+
+    if (stream->pos < stream->len) {
+        uint32_t space = tud_cdc_write_available();
+        uint32_t n     = stream->len - stream->pos;
+        if (n > space)
+            n = space;
+        if (n) {
+            stream->pos += tud_cdc_write(stream->buf + stream->pos, n);
+            tud_cdc_write_flush();
+        }
+        return;
+    }
+
+    uint32_t now = ppm_tm_now();
+    if (now - stream->last < stream->period_us)
+        return;
+    stream->last = now;
+
+    ppm_tm_text_t text = {stream->buf, sizeof(stream->buf), 0};
+    ppm_tm_printf(&text, "# snapshot %lu t=%lu\r\n", (unsigned long)stream->sequence++, (unsigned long)now);
+    build(&text);
+    ppm_tm_printf(&text, "\r\n");
+
+    stream->len = text.len;
+    stream->pos = 0;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "hardware/structs/timer.h"
+#include "hardware/sync.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Low overhead telemetry for the USB audio firmwares.
+//
+// The hot paths only take timestamps and bump counters, everything is read back on core0 in
+// idle time and streamed as text snapshots to the CDC telemetry interface (ppm_tm_stream_task).
+//
+// Timestamps are raw reads of the 1 MHz system timer. The M0+ has no cycle counter and each
+// core has its own SysTick, the timer is the only clock both cores see alike, so a stage on
+// one core can be timed against a stage on the other.
+//
+// All structures have a single writer. The reader may see a histogram half way through an
+// update, which is harmless for telemetry.
+
+#define PPM_TM_HIST_BINS 16
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint32_t bins[PPM_TM_HIST_BINS];    // Bin 0 holds 0 us, bin k holds [2^(k-1), 2^k) us, the last bin the rest
+} ppm_tm_hist_t;
+
+// Fill level of a queue, in its own unit
+typedef struct {
+    uint32_t now;
+    uint32_t peak;    // Since boot
+} ppm_tm_level_t;
+
+// Latency of one stage, measured on one tagged item at a time. The start stage tags the item
+// at a stream position (e.g. a ring head), the end stage reports how far it has got (e.g. the
+// ring tail). The two may run on different cores: armed hands the probe back and forth.
+typedef struct {
+    volatile uint32_t armed;       // Set by the start stage, cleared by the end stage
+    volatile uint32_t position;    // Stream position of the tagged item
+    volatile uint32_t start;       // ppm_tm_now() when it was tagged
+    ppm_tm_hist_t     latency;     // Written by the end stage
+} ppm_tm_probe_t;
+
+static inline uint32_t ppm_tm_now(void) {
+    return timer_hw->timerawl;
+}
+
+static inline void ppm_tm_hist_add(ppm_tm_hist_t *hist, uint32_t us) {
+    uint32_t bin = us ? 32u - (uint32_t)__builtin_clz(us) : 0;
+    if (bin >= PPM_TM_HIST_BINS)
+        bin = PPM_TM_HIST_BINS - 1;
+
+    hist->bins[bin]++;
+    hist->count++;
+    if (us > hist->max)
+        hist->max = us;
+}
+
+static inline void ppm_tm_level_set(ppm_tm_level_t *level, uint32_t value) {
+    level->now = value;
+    if (value > level->peak)
+        level->peak = value;
+}
+
+// Start stage: tag the item at position, unless one is still on its way
+static inline void ppm_tm_probe_start(ppm_tm_probe_t *probe, uint32_t position) {
+    if (probe->armed)
+        return;
+    probe->position = position;
+    probe->start    = ppm_tm_now();
+    __dmb();    // Position and time before the flag
+    probe->armed = 1;
+}
+
+// End stage: every item before position done has passed. True if that included the tagged one.
+static inline bool ppm_tm_probe_end(ppm_tm_probe_t *probe, uint32_t done) {
+    if (!probe->armed)
+        return false;
+    __dmb();    // Flag before position and time
+    if ((int32_t)(done - probe->position) <= 0)
+        return false;
+
+    ppm_tm_hist_add(&probe->latency, ppm_tm_now() - probe->start);
+    __dmb();
+    probe->armed = 0;
+    return true;
+}
+
+// Text snapshot under construction, ppm_tm_printf never writes past size
+typedef struct {
+    char    *buf;
+    uint32_t size;
+    uint32_t len;
+} ppm_tm_text_t;
+
+void ppm_tm_printf(ppm_tm_text_t *text, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void ppm_tm_print_hist(ppm_tm_text_t *text, const char *name, const ppm_tm_hist_t *hist);
+void ppm_tm_print_level(ppm_tm_text_t *text, const char *name, const ppm_tm_level_t *level);
+
+#define PPM_TM_SNAPSHOT_BYTES 1536
+#define PPM_TM_COMMAND_BYTES  32
+
+typedef struct {
+    char     buf[PPM_TM_SNAPSHOT_BYTES];
+    uint32_t len;
+    uint32_t pos;          // Bytes of buf already handed to the CDC interface
+    uint32_t last;         // ppm_tm_now() of the last snapshot
+    uint32_t sequence;
+    uint32_t period_us;
+    char     command[PPM_TM_COMMAND_BYTES];    // Line being received from the host
+    uint32_t command_len;
+} ppm_tm_stream_t;
+
+void ppm_tm_stream_init(ppm_tm_stream_t *stream, uint32_t period_ms);
+
+// Call from the USB loop. Hands the pending snapshot to the CDC interface as its FIFO frees
+// up, never blocking, and has build append a new one every period while a terminal is open.
+// Lines typed on the terminal are passed to command without the line end, too long ones are
+// dropped. command may be NULL.
+void ppm_tm_stream_task(ppm_tm_stream_t *stream, void (*build)(ppm_tm_text_t *text),
+                        void (*command)(const char *line));
+
+#ifdef __cplusplus
+}
+#endif
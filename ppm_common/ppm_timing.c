@@ -0,0 +1,149 @@
+#include "ppm_timing.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/ssi.h"
+#include "hardware/structs/timer.h"
+#include "hardware/sync.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "ppm_link.h"
+#include "ppm_trace.h"
+#include <stddef.h>
+
+const ppm_timing_profile_t ppm_timing_profiles[PPM_TIMING_PROFILES] = {
+    {133000, 5, 2, VREG_VOLTAGE_1_10},    // Stock clock, flash at 66 MHz
+    {250000, 8, 2, VREG_VOLTAGE_1_10},    // Flash at 125 MHz
+    {300000, 9, 4, VREG_VOLTAGE_1_20},    // Flash at 75 MHz. MIN_TACKT extrapolated, run the 'T' sweep
+};
+
+ppm_timing_t ppm_timing;
+
+#define PPM_TIMING_VREG_SETTLE_US 1000
+
+// Core1 handshake, see ppm_timing.h. Only core0 leaves PARKED, only core1 enters it.
+enum {
+    PPM_TIMING_RUNNING,
+    PPM_TIMING_PARK,        // core0 waits for core1
+    PPM_TIMING_PARKED,      // core1 spins in RAM
+    PPM_TIMING_RELEASED,    // core1 may restart
+};
+
+static volatile uint32_t timing_requested = 0;    // kHz, 0: nothing pending
+static volatile uint32_t timing_phase     = PPM_TIMING_RUNNING;
+static uint32_t          timing_cores     = 1;
+static float             timing_min_pulse = 0.0f;    // us
+static enum vreg_voltage timing_vreg      = VREG_VOLTAGE_DEFAULT;
+
+const ppm_timing_profile_t *ppm_timing_find(uint32_t sys_khz) {
+    for (uint32_t i = 0; i < PPM_TIMING_PROFILES; i++) {
+        if (ppm_timing_profiles[i].sys_khz == sys_khz)
+            return &ppm_timing_profiles[i];
+    }
+    return NULL;
+}
+
+// The widened pulses take their share of the minimum period out of the pause
+uint16_t ppm_timing_min_interval(uint32_t sys_khz) {
+    return (uint16_t)(timing_min_pulse * ((float)sys_khz / 1000.0f)) - PPM_LINK_PULSE_COUNTS;
+}
+
+// XIP is gone while the SSI is disabled, so this runs from RAM with interrupts off and the
+// other core parked
+static void __no_inline_not_in_flash_func(ppm_timing_set_flash_clkdiv)(uint32_t clkdiv) {
+    while (ssi_hw->sr & SSI_SR_BUSY_BITS)
+        tight_loop_contents();
+    ssi_hw->ssienr = 0;
+    ssi_hw->baudr  = clkdiv;
+    ssi_hw->ssienr = 1;
+}
+
+// Voltage up and flash slower before the clock goes up, the other way round after it
+// went down
+static void ppm_timing_apply(const ppm_timing_profile_t *profile) {
+    if (profile->vreg > timing_vreg) {
+        vreg_set_voltage(profile->vreg);
+        busy_wait_us(PPM_TIMING_VREG_SETTLE_US);
+    }
+    if (profile->flash_clkdiv > ssi_hw->baudr)
+        ppm_timing_set_flash_clkdiv(profile->flash_clkdiv);
+
+    set_sys_clock_khz(profile->sys_khz, true);
+
+    if (profile->flash_clkdiv < ssi_hw->baudr)
+        ppm_timing_set_flash_clkdiv(profile->flash_clkdiv);
+    if (profile->vreg < timing_vreg)
+        vreg_set_voltage(profile->vreg);
+    timing_vreg = profile->vreg;
+
+    ppm_timing.profile             = profile;
+    ppm_timing.sys_khz             = profile->sys_khz;
+    ppm_timing.pio_freq            = profile->sys_khz * 1000u;
+    ppm_timing.min_tackt           = profile->min_tackt;
+    ppm_timing.min_interval_cycles = ppm_timing_min_interval(profile->sys_khz);
+}
+
+void ppm_timing_init(uint32_t sys_khz, float min_pulse_period_us, uint32_t cores) {
+    const ppm_timing_profile_t *profile = ppm_timing_find(sys_khz);
+
+    timing_cores     = cores;
+    timing_min_pulse = min_pulse_period_us;
+    ppm_timing_apply(profile ? profile : &ppm_timing_profiles[0]);
+}
+
+bool ppm_timing_request(uint32_t sys_khz) {
+    if (!ppm_timing_find(sys_khz))
+        return false;
+    timing_requested = sys_khz;
+    return true;
+}
+
+static void __no_inline_not_in_flash_func(ppm_timing_park)(void) {
+    uint32_t irq = save_and_disable_interrupts();
+    timing_phase = PPM_TIMING_PARKED;
+    while (timing_phase == PPM_TIMING_PARKED)
+        tight_loop_contents();
+    restore_interrupts(irq);
+}
+
+void ppm_timing_task(const ppm_timing_hooks_t *hooks) {
+    if (get_core_num() != 0) {
+        if (timing_phase != PPM_TIMING_PARK)
+            return;
+        if (hooks && hooks->stop)
+            hooks->stop();
+        ppm_timing_park();
+        if (hooks && hooks->start)
+            hooks->start();
+        return;
+    }
+
+    uint32_t sys_khz = timing_requested;
+    if (sys_khz == 0)
+        return;
+    timing_requested = 0;
+
+    const ppm_timing_profile_t *profile = ppm_timing_find(sys_khz);
+    if (profile == ppm_timing.profile)
+        return;
+
+    if (hooks && hooks->stop)
+        hooks->stop();
+    if (timing_cores > 1) {
+        timing_phase = PPM_TIMING_PARK;
+        while (timing_phase != PPM_TIMING_PARKED)
+            tight_loop_contents();
+    }
+
+    uint32_t irq   = save_and_disable_interrupts();
+    uint32_t start = timer_hw->timerawl;
+    ppm_timing_apply(profile);
+    uint32_t took = timer_hw->timerawl - start;
+    ppm_timing.switches++;
+    restore_interrupts(irq);
+
+    if (timing_cores > 1)
+        timing_phase = PPM_TIMING_RELEASED;
+    if (hooks && hooks->start)
+        hooks->start();
+
+    ppm_trace(PPM_TRACE_CLOCK_SWITCH, profile->sys_khz, took);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "hardware/vreg.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runtime system clock profiles.
+//
+// Everything the PPM link counts in PIO cycles follows clk_sys: the pause widths the pulse
+// generator puts out, the minimum interval in front of every code and the detector's fixed
+// offset (MIN_TACKT). A profile fixes the clock together with that offset, the core voltage
+// and the flash clock divider it needs, and ppm_timing holds the values derived from the
+// active one. A fast clock gives finer pause widths and shorter symbols, a slow one saves
+// power while nothing is streamed. Pause widths are counted in cycles, so both ends of a
+// link have to run the same profile.
+//
+// A switch is requested from anywhere with ppm_timing_request and carried out by
+// ppm_timing_task, called from the loop of every core that runs clock dependent work:
+//
+//   1. core0 runs its stop hook, asks core1 to run its own and waits until core1 is parked
+//      in RAM with interrupts off
+//   2. core0 changes voltage, flash divider and clk_sys with interrupts off
+//   3. core1 is released and both cores run their start hooks, which recompute clkdivs,
+//      DMA timers and the calibration from ppm_timing
+//
+// SMs and pacing DMA are stopped for the ~1 ms this takes, the link drops what was queued.
+
+typedef struct {
+    uint32_t          sys_khz;
+    int8_t            min_tackt;       // Pause width - raw detector count, the calibration fallback
+    uint8_t           flash_clkdiv;    // QSPI SCK = clk_sys / flash_clkdiv, even, the flash tops out at 133 MHz
+    enum vreg_voltage vreg;
+} ppm_timing_profile_t;
+
+#define PPM_TIMING_PROFILES 3
+
+extern const ppm_timing_profile_t ppm_timing_profiles[PPM_TIMING_PROFILES];
+
+typedef struct {
+    const ppm_timing_profile_t *profile;
+    uint32_t                    sys_khz;
+    uint32_t                    pio_freq;               // Hz, the PPM state machines run undivided
+    int8_t                      min_tackt;
+    uint16_t                    min_interval_cycles;    // Minimum pause in front of every code
+    uint32_t                    switches;               // Completed since boot
+} ppm_timing_t;
+
+extern ppm_timing_t ppm_timing;
+
+// Clock dependent work of one core. Either hook may be NULL.
+typedef struct {
+    void (*stop)(void);     // Stop the SMs and pacing DMA that depend on clk_sys
+    void (*start)(void);    // Recompute from ppm_timing and restart
+} ppm_timing_hooks_t;
+
+// Profile for a clock, NULL if there is none
+const ppm_timing_profile_t *ppm_timing_find(uint32_t sys_khz);
+
+// Minimum interval in cycles for a clock, as ppm_timing would hold it
+uint16_t ppm_timing_min_interval(uint32_t sys_khz);
+
+// Call first thing in main with core1 not running yet. An unknown clock takes the first
+// profile. cores is 2 if core1 calls ppm_timing_task as well.
+void ppm_timing_init(uint32_t sys_khz, float min_pulse_period_us, uint32_t cores);
+
+// Safe from either core and from callbacks, the switch happens in ppm_timing_task.
+// False if there is no profile for the clock.
+bool ppm_timing_request(uint32_t sys_khz);
+
+// Call from the main loop of each core taking part, with that core's hooks
+void ppm_timing_task(const ppm_timing_hooks_t *hooks);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,79 @@
+#include "ppm_trace.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+ppm_trace_ring_t ppm_trace_rings[2];
+
+// Drain state, core0 only
+static uint8_t  trace_frame[PPM_TRACE_FRAME_BYTES];
+static uint32_t trace_frame_pos       = PPM_TRACE_FRAME_BYTES;    // Nothing pending
+static uint32_t trace_dropped_sent[2] = {0, 0};
+
+static void ppm_trace_put32(uint8_t *dst, uint32_t value) {
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+    dst[2] = (uint8_t)(value >> 16);
+    dst[3] = (uint8_t)(value >> 24);
+}
+
+static void ppm_trace_frame(uint32_t core, const ppm_trace_record_t *record) {
+    trace_frame[0] = PPM_TRACE_SYNC_0;
+    trace_frame[1] = PPM_TRACE_SYNC_1;
+    trace_frame[2] = (uint8_t)core;
+    ppm_trace_put32(&trace_frame[3], record->time);
+    ppm_trace_put32(&trace_frame[7], record->id);
+    ppm_trace_put32(&trace_frame[11], record->a);
+    ppm_trace_put32(&trace_frame[15], record->b);
+
+    uint8_t sum = 0;
+    for (uint32_t i = 2; i < PPM_TRACE_FRAME_BYTES - 1; i++) {
+        sum = (uint8_t)(sum + trace_frame[i]);
+    }
+    trace_frame[PPM_TRACE_FRAME_BYTES - 1] = sum;
+    trace_frame_pos                        = 0;
+}
+
+// Frame the oldest pending record of either core, drop reports first. False if there is none.
+static bool ppm_trace_next(void) {
+    for (uint32_t core = 0; core < 2; core++) {
+        uint32_t dropped = ppm_trace_rings[core].dropped;
+        if (dropped != trace_dropped_sent[core]) {
+            ppm_trace_record_t record = {timer_hw->timerawl, PPM_TRACE_DROPPED, dropped - trace_dropped_sent[core], 0};
+            trace_dropped_sent[core]  = dropped;
+            ppm_trace_frame(core, &record);
+            return true;
+        }
+    }
+
+    ppm_trace_ring_t *oldest      = NULL;
+    uint32_t          oldest_core = 0;
+    for (uint32_t core = 0; core < 2; core++) {
+        ppm_trace_ring_t *ring = &ppm_trace_rings[core];
+        uint32_t          tail = ring->tail;
+        if (ring->head == tail)
+            continue;
+        __dmb();    // Head before the record it covers
+
+        if (!oldest || (int32_t)(ring->records[tail & PPM_TRACE_RING_MASK].time -
+                                 oldest->records[oldest->tail & PPM_TRACE_RING_MASK].time) < 0) {
+            oldest      = ring;
+            oldest_core = core;
+        }
+    }
+    if (!oldest)
+        return false;
+
+    uint32_t tail = oldest->tail;
+    ppm_trace_frame(oldest_core, &oldest->records[tail & PPM_TRACE_RING_MASK]);
+    __dmb();    // Copied before the slot is handed back
+    oldest->tail = tail + 1;
+    return true;
+}
+
+void ppm_trace_drain(uart_inst_t *uart) {
+    while (uart_is_writable(uart)) {
+        if (trace_frame_pos == PPM_TRACE_FRAME_BYTES && !ppm_trace_next())
+            return;
+        uart_putc_raw(uart, (char)trace_frame[trace_frame_pos++]);
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "hardware/structs/sio.h"
+#include "hardware/structs/timer.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deferred binary trace log, cheap enough to leave on in the real-time paths.
+//
+// ppm_trace() stores a timestamped fixed size record in a ring owned by the calling core,
+// with interrupts masked for the dozen or so cycles it takes, so thread code and ISRs on
+// the same core can both use it. A full ring drops the record and counts it, the caller
+// never waits. ppm_trace_drain() runs in idle time on core0, merges both rings by time
+// and sends the records as binary frames on a UART without blocking.
+//
+// ppm_trace.py decodes the frames on the host, it takes the event names from the enum
+// below, so keep one event per line with its number.
+
+#define PPM_TRACE_RING_BITS 6    // 64 records per core
+#define PPM_TRACE_RING_SIZE (1u << PPM_TRACE_RING_BITS)
+#define PPM_TRACE_RING_MASK (PPM_TRACE_RING_SIZE - 1)
+
+// Frame on the wire: sync, core, record (little endian), 8 bit sum of core and record
+#define PPM_TRACE_SYNC_0      0xA5
+#define PPM_TRACE_SYNC_1      0x5A
+#define PPM_TRACE_FRAME_BYTES (2 + 1 + 16 + 1)
+
+typedef enum {
+    PPM_TRACE_DROPPED          = 0,     // a: records lost on this core since the last report
+    PPM_TRACE_BOOT             = 1,     // a: clk_sys in kHz
+    PPM_TRACE_SAMPLE_RATE      = 2,     // a: sample rate set by the host
+    PPM_TRACE_SET_ITF          = 3,     // a: interface, b: alternate setting
+    PPM_TRACE_SET_MUTE         = 4,     // a: channel, b: mute
+    PPM_TRACE_SET_VOLUME       = 5,     // a: channel, b: volume in 1/256 dB (signed)
+    PPM_TRACE_TX_UNDERRUN      = 6,     // Speaker data ran out, the link is kept clocked. a: queued ahead
+    PPM_TRACE_TX_RESUMED       = 7,     // a: idle symbols or silent blocks sent during the underrun
+    PPM_TRACE_TX_DMA_RESTART   = 8,     // Transfer count ran out
+    PPM_TRACE_RX_OVERRUN       = 9,     // a: captures or words lost, b: lane
+    PPM_TRACE_RX_SYNC_ERROR    = 10,    // a: data symbols since the previous sync, b: lane
+    PPM_TRACE_RX_DMA_REARM     = 11,    // Transfer count ran out. a: lane
+    PPM_TRACE_MIC_PADDED       = 12,    // a: samples concealed, b: samples in the packet
+    PPM_TRACE_MIC_OVERFLOW     = 13,    // a: samples dropped at a full mic ring
+    PPM_TRACE_PDM_UNDERRUN     = 14,    // PDM buffers started being replayed. a: underruns so far
+    PPM_TRACE_PDM_OVERLOAD     = 15,    // The modulator was reset. a: overloads so far
+    PPM_TRACE_CLOCK_SWITCH     = 16,    // a: clk_sys in kHz, b: us spent with interrupts off
+    PPM_TRACE_RX_CRC_ERROR     = 17,    // a: check symbol received, b: CRC computed
+    PPM_TRACE_RX_CONCEALED     = 18,    // a: frames interpolated (0: gap too long), b: blocks lost
+    PPM_TRACE_RX_DET_SLIP      = 19,    // Fine detector pair restarted. a: first count, b: second count
+    PPM_TRACE_RX_LANES_MISSING = 20,    // Set of lanes missing from slots changed. a: missing, b: present (bit per lane)
+    PPM_TRACE_TX_OVERRUN       = 21,    // TX DMA ran past the queued symbols, lanes resynced. a: symbols replayed, b: lane
+    PPM_TRACE_PDM_RESUMED      = 22,    // Fresh PDM buffers again. a: buffers replayed during the underrun
+} ppm_trace_event_t;
+
+typedef struct {
+    uint32_t time;    // timer_hw->timerawl, us
+    uint32_t id;      // ppm_trace_event_t
+    uint32_t a;
+    uint32_t b;
+} ppm_trace_record_t;
+
+typedef struct {
+    volatile uint32_t  head;       // Written by the owning core
+    volatile uint32_t  dropped;    // Written by the owning core
+    volatile uint32_t  tail;       // Written by the drain
+    ppm_trace_record_t records[PPM_TRACE_RING_SIZE];
+} ppm_trace_ring_t;
+
+extern ppm_trace_ring_t ppm_trace_rings[2];
+
+static inline void ppm_trace(ppm_trace_event_t id, uint32_t a, uint32_t b) {
+    ppm_trace_ring_t *ring = &ppm_trace_rings[sio_hw->cpuid];
+    uint32_t          irq  = save_and_disable_interrupts();
+    uint32_t          head = ring->head;
+
+    if (head - ring->tail < PPM_TRACE_RING_SIZE) {
+        ppm_trace_record_t *record = &ring->records[head & PPM_TRACE_RING_MASK];
+        record->time               = timer_hw->timerawl;
+        record->id                 = (uint32_t)id;
+        record->a                  = a;
+        record->b                  = b;
+        __dmb();    // Record before the new head
+        ring->head = head + 1;
+    }
+    else {
+        ring->dropped = ring->dropped + 1;
+    }
+    restore_interrupts(irq);
+}
+
+// Call from the idle loop on core0. Sends what the UART TX FIFO takes and returns.
+void ppm_trace_drain(uart_inst_t *uart);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Decoder for the binary trace log of ppm_trace.h
+
+Reads frames from a serial port (the firmware's UART, 115200 baud) or from a
+capture file, and prints one line per event:
+
+    time_s     core  event            a           b
+
+Event names come from the ppm_trace_event_t enum in ppm_trace.h, so the
+decoder follows the firmware without edits. Bytes that do not form a valid
+frame (printf output on the same UART, a frame cut at start-up) are skipped.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+FRAME_BYTES = 2 + 1 + 16 + 1
+
+
+def load_events(header):
+    """Map event number -> (name, comment) from the enum in ppm_trace.h"""
+    events = {}
+    pattern = re.compile(r"^\s*PPM_TRACE_(\w+)\s*=\s*(\d+)\s*,?\s*(?://\s*(.*))?$")
+    with open(header, encoding="utf-8") as f:
+        for line in f:
+            match = pattern.match(line)
+            if match:
+                events[int(match.group(2))] = (match.group(1), match.group(3) or "")
+    return events
+
+
+def frames(stream, follow):
+    """Yield (core, time, id, a, b) for every frame with a valid checksum"""
+    buffer = b""
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            if follow:
+                continue  # Serial read timed out, the port stays open
+            return
+        buffer += chunk
+
+        while True:
+            start = buffer.find(SYNC)
+            if start < 0:
+                buffer = buffer[-1:]
+                break
+            if len(buffer) - start < FRAME_BYTES:
+                buffer = buffer[start:]
+                break
+
+            frame = buffer[start : start + FRAME_BYTES]
+            if sum(frame[2:-1]) & 0xFF != frame[-1]:
+                # Not a frame after all, look for the next sync
+                buffer = buffer[start + 1 :]
+                continue
+
+            buffer = buffer[start + FRAME_BYTES :]
+            time, event, a, b = struct.unpack("<IIII", frame[3:-1])
+            yield frame[2], time, event, a, b
+
+
+def signed(value):
+    """Arguments are 32 bit words, a few of them (volume) are signed"""
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+class Clock:
+    """Unwraps the 32 bit microsecond timestamps"""
+
+    def __init__(self):
+        self.last = None
+        self.high = 0
+
+    def seconds(self, time):
+        if self.last is not None and time < self.last and self.last - time > 1 << 31:
+            self.high += 1 << 32
+        self.last = time
+        return (self.high + time) / 1e6
+
+
+class Tee:
+    """Passes reads through and keeps a copy of the bytes"""
+
+    def __init__(self, stream, copy):
+        self.stream = stream
+        self.copy = copy
+
+    def read(self, n):
+        data = self.stream.read(n)
+        self.copy.write(data)
+        return data
+
+
+def open_source(source, baud):
+    """Returns the stream and whether to keep reading at its end"""
+    if os.path.isfile(source):
+        return open(source, "rb"), False
+
+    import serial  # pyserial
+
+    return serial.Serial(source, baud, timeout=0.1), True
+
+
+def main():
+    default_header = os.path.join(os.path.dirname(os.path.abspath(__file__)), "ppm_trace.h")
+
+    parser = argparse.ArgumentParser(description="Decode the ppm_trace binary log")
+    parser.add_argument("source", help="Serial port (e.g. /dev/ttyUSB0, COM3) or capture file")
+    parser.add_argument("--baud", type=int, default=115200, help="UART baud rate")
+    parser.add_argument("--header", default=default_header, help="ppm_trace.h with the event enum")
+    parser.add_argument("--raw", metavar="FILE", help="Also save the undecoded bytes to FILE")
+    args = parser.parse_args()
+
+    events = load_events(args.header)
+    clock = Clock()
+    stream, follow = open_source(args.source, args.baud)
+
+    raw = open(args.raw, "wb") if args.raw else None
+    source = Tee(stream, raw) if raw else stream
+
+    try:
+        for core, time, event, a, b in frames(source, follow):
+            name, _ = events.get(event, (f"EVENT_{event}", ""))
+            print(f"{clock.seconds(time):12.6f}  core{core}  {name:<16} {signed(a):>10} {signed(b):>10}")
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if raw:
+            raw.close()
+
+
+if __name__ == "__main__":
+    main()
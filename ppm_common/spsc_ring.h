@@ -0,0 +1,126 @@
+#pragma once
+
+#include "hardware/sync.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Single-producer / single-consumer lock-free ring of 32-bit words.
+//
+// head is written only by the producer, tail only by the consumer. Both are free-running
+// counters, the element index is (counter & mask), so capacity must be a power of two.
+// Each index sits in its own 32-byte line together with the counters owned by the same
+// side, so the two cores never write the same line.
+
+#define SPSC_RING_LINE 32
+
+typedef struct {
+    // Producer side
+    volatile uint32_t head __attribute__((aligned(SPSC_RING_LINE)));
+    volatile uint32_t overflows;    // Words dropped because the ring was full
+    // Consumer side
+    volatile uint32_t tail __attribute__((aligned(SPSC_RING_LINE)));
+    volatile uint32_t underflows;    // Words requested but not available
+    // Read-only after init
+    uint32_t *buffer __attribute__((aligned(SPSC_RING_LINE)));
+    uint32_t  mask;
+} spsc_ring_t;
+
+static inline void spsc_ring_init(spsc_ring_t *ring, uint32_t *buffer, uint32_t capacity) {
+    ring->head       = 0;
+    ring->overflows  = 0;
+    ring->tail       = 0;
+    ring->underflows = 0;
+    ring->buffer     = buffer;
+    ring->mask       = capacity - 1;
+}
+
+static inline uint32_t spsc_ring_count(const spsc_ring_t *ring) {
+    return ring->head - ring->tail;
+}
+
+static inline uint32_t spsc_ring_space(const spsc_ring_t *ring) {
+    return ring->mask + 1 - (ring->head - ring->tail);
+}
+
+// Producer: contiguous free space starting at *ptr (may be less than spsc_ring_space at the wrap)
+static inline uint32_t spsc_ring_write_span(spsc_ring_t *ring, uint32_t **ptr) {
+    uint32_t head   = ring->head;
+    uint32_t index  = head & ring->mask;
+    uint32_t space  = ring->mask + 1 - (head - ring->tail);
+    uint32_t linear = ring->mask + 1 - index;
+
+    *ptr = &ring->buffer[index];
+    return space < linear ? space : linear;
+}
+
+// Producer: publish n words written through spsc_ring_write_span
+static inline void spsc_ring_commit(spsc_ring_t *ring, uint32_t n) {
+    __dmb();    // Data must be visible before the new head
+    ring->head = ring->head + n;
+}
+
+// Consumer: contiguous filled words starting at *ptr
+static inline uint32_t spsc_ring_read_span(spsc_ring_t *ring, uint32_t **ptr) {
+    uint32_t tail   = ring->tail;
+    uint32_t index  = tail & ring->mask;
+    uint32_t count  = ring->head - tail;
+    uint32_t linear = ring->mask + 1 - index;
+
+    __dmb();    // Read head before the data it covers
+    *ptr = &ring->buffer[index];
+    return count < linear ? count : linear;
+}
+
+// Consumer: release n words obtained through spsc_ring_read_span
+static inline void spsc_ring_release(spsc_ring_t *ring, uint32_t n) {
+    __dmb();    // Finish reading before the slots are handed back
+    ring->tail = ring->tail + n;
+}
+
+// Producer: copy up to n words in, the rest is counted as overflow. Returns words pushed.
+static inline uint32_t spsc_ring_push(spsc_ring_t *ring, const uint32_t *src, uint32_t n) {
+    uint32_t pushed = 0;
+
+    while (pushed < n) {
+        uint32_t *dst;
+        uint32_t  span = spsc_ring_write_span(ring, &dst);
+        if (span == 0)
+            break;
+        if (span > n - pushed)
+            span = n - pushed;
+        for (uint32_t i = 0; i < span; i++) {
+            dst[i] = src[pushed + i];
+        }
+        pushed += span;
+        spsc_ring_commit(ring, span);
+    }
+
+    if (pushed < n) {
+        ring->overflows = ring->overflows + (n - pushed);
+    }
+    return pushed;
+}
+
+// Consumer: copy up to n words out, a shortfall is counted as underflow. Returns words popped.
+static inline uint32_t spsc_ring_pop(spsc_ring_t *ring, uint32_t *dst, uint32_t n) {
+    uint32_t popped = 0;
+
+    while (popped < n) {
+        uint32_t *src;
+        uint32_t  span = spsc_ring_read_span(ring, &src);
+        if (span == 0)
+            break;
+        if (span > n - popped)
+            span = n - popped;
+        for (uint32_t i = 0; i < span; i++) {
+            dst[popped + i] = src[i];
+        }
+        popped += span;
+        spsc_ring_release(ring, span);
+    }
+
+    if (popped < n) {
+        ring->underflows = ring->underflows + (n - popped);
+    }
+    return popped;
+}
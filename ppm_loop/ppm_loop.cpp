@@ -1,4 +1,5 @@
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/pio.h"
 #include "pico/stdlib.h"
 #include "pico/time.h"
@@ -11,14 +12,14 @@
 #include <string.h>
 #include <tusb.h>
 
-// Include generated header files with PIO programs
-#include "ppm.pio.h"
+#include "ppm_calibration.h"
+#include "ppm_link.h"
 
 #define PULSE_GEN_PIN 0
 #define PULSE_DET_PIN 1
 #define LED_PIN 25
 
-static PIO pio = pio0;
+static PIO const pio = pio0;
 static uint sm_gen, sm_det;
 
 #define LED_TIME 500
@@ -27,48 +28,43 @@ static uint sm_gen, sm_det;
 #define SYS_FREQ 250000
 #define MIN_TACKT 10
 
-// Initialize PIO for pulse generator
+// Streaming sweep ('S'): both state machines keep running, a DMA channel paced by a DMA
+// timer repeats every width, each capture is binned as it arrives
+#define SWEEP_MAX_WIDTH 1500
+#define SWEEP_WIDTHS (SWEEP_MAX_WIDTH + 1 - MIN_TACKT)
+#define SWEEP_SLOT_MARGIN 64 // PIO cycles per slot on top of 2 per pause count
+#define SWEEP_HIST_BINS 8    // Deviation -3..+3 from the expected count, last bin: anything else
+#define SWEEP_DEFAULT_REPEAT 1000
+#define SWEEP_MAX_REPEAT 65535
+#define SWEEP_QUIET_US 50 // No capture for this long after the DMA finished ends a width
+
+struct sweep_stats_t {
+  uint16_t min;
+  uint16_t max;
+  uint32_t count;
+  uint32_t sum;
+  uint16_t hist[SWEEP_HIST_BINS];
+};
+
+static sweep_stats_t sweep_stats[SWEEP_WIDTHS];
+static uint32_t sweep_word;
+static int sweep_dma_chan = -1;
+static int sweep_dma_timer = -1;
+
+// Initialize PIO for pulse generator, undivided
 void init_pulse_generator() {
   sm_gen = pio_claim_unused_sm(pio, true);
-
-  // Load program
-  uint offset = pio_add_program(pio, &pulse_generator_program);
-
-  // Configure state machine
-  pio_sm_config c = pulse_generator_program_get_default_config(offset);
-
-  // Setup pins for PIO
-  sm_config_set_set_pins(&c, PULSE_GEN_PIN,
-                         1);         // 1 pin starting from PULSE_GEN_PIN
-  pio_gpio_init(pio, PULSE_GEN_PIN); // Only initialization for PIO
-  pio_sm_set_consecutive_pindirs(pio, sm_gen, PULSE_GEN_PIN, 1,
-                                 true); // Set pin direction to output
-
-  // Frequency divider (default 1.0)
-  sm_config_set_clkdiv(&c, 1.0f);
-
-  // Initialize state machine
-  pio_sm_init(pio, sm_gen, offset, &c);
+  uint offset = ppm_link_load(pio, PPM_LINK_GENERATOR);
+  ppm_link_init(pio, sm_gen, PPM_LINK_GENERATOR, offset, PULSE_GEN_PIN,
+                SYS_FREQ * 1000, false);
 }
 
-// Initialize PIO for pulse detector
+// Initialize PIO for pulse detector, undivided
 void init_pulse_detector() {
   sm_det = pio_claim_unused_sm(pio, true);
-
-  // Load program
-  uint offset = pio_add_program(pio, &pulse_detector_program);
-
-  // Configure state machine
-  pio_sm_config c = pulse_detector_program_get_default_config(offset);
-
-  // Setup pins
-  sm_config_set_in_pins(&c, PULSE_DET_PIN);
-  sm_config_set_jmp_pin(&c, PULSE_DET_PIN);
-  pio_gpio_init(pio, PULSE_DET_PIN);
-  pio_sm_set_consecutive_pindirs(pio, sm_det, PULSE_DET_PIN, 1, false);
-
-  // Initialize state machine
-  pio_sm_init(pio, sm_det, offset, &c);
+  uint offset = ppm_link_load(pio, PPM_LINK_DETECTOR);
+  ppm_link_init(pio, sm_det, PPM_LINK_DETECTOR, offset, PULSE_DET_PIN,
+                SYS_FREQ * 1000, false);
 }
 
 // Function for generating and measuring pause between pulses
@@ -102,7 +98,7 @@ uint32_t test_pulse(uint32_t pause_width, bool verbose = true) {
   pio_sm_set_enabled(pio, sm_gen, true);
 
   // Send pause duration to generator
-  pio_sm_put_blocking(pio, sm_gen, pause_width);
+  ppm_link_put_blocking(pio, sm_gen, pause_width);
 
   // Debug output
   if (verbose) {
@@ -130,8 +126,8 @@ uint32_t test_pulse(uint32_t pause_width, bool verbose = true) {
     tud_cdc_write_str(pin_state_after ? "HIGH\r\n" : "LOW\r\n");
   }
 
-  if (!pio_sm_is_rx_fifo_empty(pio, sm_det)) {
-    measured_width = pio_sm_get_blocking(pio, sm_det);
+  if (!ppm_link_rx_empty(pio, sm_det)) {
+    measured_width = ppm_link_get(pio, sm_det);
     if (verbose) {
       tud_cdc_write_str("Measured pause: ");
       tud_cdc_write_str(std::to_string(measured_width).c_str());
@@ -156,8 +152,166 @@ uint32_t test_pulse(uint32_t pause_width, bool verbose = true) {
   return measured_width;
 }
 
+// Save the sweep as the calibration profile for the current clock
+void store_calibration(const uint32_t *raw, uint32_t first_width,
+                       uint32_t n_widths) {
+  static ppm_cal_profile_t profile;
+  uint32_t sys_khz = clock_get_hz(clk_sys) / 1000;
+
+  if (!ppm_cal_build(&profile, sys_khz, raw, first_width, n_widths)) {
+    printf("No pulses captured, calibration not saved\n");
+  } else if (ppm_cal_store(&profile)) {
+    printf("Calibration for %lu kHz saved to flash\n", sys_khz);
+  } else {
+    printf("Failed to write calibration to flash\n");
+  }
+}
+
+void init_sweep_dma() {
+  sweep_dma_chan = dma_claim_unused_channel(true);
+  sweep_dma_timer = dma_claim_unused_timer(true);
+
+  dma_channel_config c = dma_channel_get_default_config(sweep_dma_chan);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+  channel_config_set_read_increment(&c, false); // Same width every slot
+  channel_config_set_write_increment(&c, false);
+  channel_config_set_dreq(&c, dma_get_timer_dreq(sweep_dma_timer));
+  dma_channel_configure(sweep_dma_chan, &c, &pio->txf[sm_gen], &sweep_word, 0,
+                        false);
+}
+
+static void sweep_record(sweep_stats_t *st, uint32_t raw, uint32_t expected) {
+  int32_t dev = (int32_t)raw - (int32_t)expected;
+  uint32_t bin = (dev >= -3 && dev <= 3) ? (uint32_t)(dev + 3) : SWEEP_HIST_BINS - 1;
+
+  if (raw > UINT16_MAX)
+    raw = UINT16_MAX;
+  if (st->count == 0 || raw < st->min)
+    st->min = raw;
+  if (st->count == 0 || raw > st->max)
+    st->max = raw;
+  st->count++;
+  st->sum += raw;
+  st->hist[bin]++;
+}
+
+// Send one width repeat times and collect its captures. The slot is just longer than the
+// pulse, so the generator always waits for the next word and each word gives one capture.
+static void sweep_width(uint32_t width, uint32_t repeat, sweep_stats_t *st) {
+  uint32_t expected = width - MIN_TACKT;
+
+  memset(st, 0, sizeof(*st));
+  sweep_word = width;
+  dma_timer_set_fraction(sweep_dma_timer, 1, 2 * width + SWEEP_SLOT_MARGIN);
+  dma_channel_transfer_from_buffer_now(sweep_dma_chan, &sweep_word, repeat);
+
+  uint32_t last_capture = time_us_32();
+  while (true) {
+    if (!ppm_link_rx_empty(pio, sm_det)) {
+      sweep_record(st, ppm_link_get(pio, sm_det), expected);
+      last_capture = time_us_32();
+    } else if (!dma_channel_is_busy(sweep_dma_chan) &&
+               pio_sm_is_tx_fifo_empty(pio, sm_gen) &&
+               time_us_32() - last_capture > SWEEP_QUIET_US) {
+      break;
+    }
+  }
+}
+
+static void stop_state_machines() {
+  pio_sm_set_enabled(pio, sm_gen, false);
+  pio_sm_set_enabled(pio, sm_det, false);
+  pio_sm_clear_fifos(pio, sm_gen);
+  pio_sm_clear_fifos(pio, sm_det);
+  pio_sm_restart(pio, sm_gen);
+  pio_sm_restart(pio, sm_det);
+}
+
+void streaming_sweep(uint32_t repeat) {
+  printf("\n===== Streaming sweep (%d-%d cycles, %lu pulses each) =====\n\n",
+         MIN_TACKT, SWEEP_MAX_WIDTH, repeat);
+
+  stop_state_machines();
+  gpio_put(PULSE_GEN_PIN, 0);
+  pio_sm_set_enabled(pio, sm_det, true);
+  sleep_us(1);
+  pio_sm_set_enabled(pio, sm_gen, true);
+
+  uint32_t start_us = time_us_32();
+  for (uint32_t i = 0; i < SWEEP_WIDTHS; i++) {
+    sweep_width(MIN_TACKT + i, repeat, &sweep_stats[i]);
+    tud_task(); // Keep USB serviced between widths
+  }
+  uint32_t elapsed_ms = (time_us_32() - start_us) / 1000;
+
+  stop_state_machines();
+
+  // Summary: totals, deviation histogram, then only the widths that are not exact
+  static uint32_t sweep_raw[SWEEP_WIDTHS];
+  uint64_t captured = 0;
+  uint64_t hist[SWEEP_HIST_BINS] = {0};
+  int irregular = 0;
+
+  printf("| %8s | %8s | %8s | %8s | %10s | %-40s |\n", "Expected",
+         "Captured", "Min", "Max", "Mean", "Deviation -3..+3, other");
+  printf("|----------|----------|----------|----------|------------|------------------------------------------|\n");
+
+  for (uint32_t i = 0; i < SWEEP_WIDTHS; i++) {
+    const sweep_stats_t *st = &sweep_stats[i];
+    uint32_t expected = i; // width - MIN_TACKT
+
+    captured += st->count;
+    for (int b = 0; b < SWEEP_HIST_BINS; b++) {
+      hist[b] += st->hist[b];
+    }
+    sweep_raw[i] = st->count ? (st->sum + st->count / 2) / st->count : 0;
+
+    if (st->count == repeat && st->min == expected && st->max == expected)
+      continue;
+    irregular++;
+
+    uint32_t mean100 = 0;
+    if (st->count) {
+      mean100 = (uint32_t)(((uint64_t)st->sum * 100 + st->count / 2) / st->count);
+      mean100 += MIN_TACKT * 100;
+    }
+    printf("| %8lu | %8lu | %8u | %8u | %7lu.%02lu | %4u %4u %4u %4u %4u %4u %4u %4u |\n",
+           i + MIN_TACKT, st->count, st->min + MIN_TACKT, st->max + MIN_TACKT,
+           mean100 / 100, mean100 % 100, st->hist[0], st->hist[1], st->hist[2],
+           st->hist[3], st->hist[4], st->hist[5], st->hist[6], st->hist[7]);
+  }
+
+  uint64_t sent = (uint64_t)repeat * SWEEP_WIDTHS;
+  printf("\nSent %llu pulses, captured %llu, missing %lld in %lu ms\n", sent,
+         captured, (long long)(sent - captured), elapsed_ms);
+  printf("Deviation histogram:");
+  for (int b = 0; b < SWEEP_HIST_BINS - 1; b++) {
+    printf(" %+d:%llu", b - 3, hist[b]);
+  }
+  printf(" other:%llu\n", hist[SWEEP_HIST_BINS - 1]);
+  if (irregular == 0) {
+    printf("All widths captured exactly, no jitter.\n");
+  } else {
+    printf("%d widths with missing captures or jitter\n", irregular);
+  }
+
+  store_calibration(sweep_raw, MIN_TACKT, SWEEP_WIDTHS);
+
+  printf("\n=========== Sweep completed ===========\n");
+}
+
 void process_command(const char *input) {
-  if (input[0] == 'T' || input[0] == 't') {
+  if (input[0] == 'S' || input[0] == 's') {
+    char *endptr;
+    long repeat = strtol(input + 1, &endptr, 10);
+    if (endptr == input + 1)
+      repeat = SWEEP_DEFAULT_REPEAT;
+    if (repeat < 1 || repeat > SWEEP_MAX_REPEAT) {
+      printf("Repeat count must be 1 to %d\n", SWEEP_MAX_REPEAT);
+      return;
+    }
+    streaming_sweep((uint32_t)repeat);
+  } else if (input[0] == 'T' || input[0] == 't') {
     printf("\n===== Starting pause duration tests (%d-1500 cycles) =====\n\n", MIN_TACKT);
     printf("Note: Values from 0 to %d are not measured due to hardware limitations.\n\n", MIN_TACKT - 1);
     printf("| %8s | %8s | %10s |\n", "Expected", "Measured", "Difference");
@@ -165,9 +319,13 @@ void process_command(const char *input) {
 
     int discrepancyCount = 0;
 
+    // Raw detector counts per width, turned into the calibration table afterwards
+    static uint32_t sweep_raw[1500 + 1 - MIN_TACKT];
+
     // Test all values from 0 to 1500
     for (uint32_t width = MIN_TACKT; width <= 1500; width++) {
-      uint32_t measured = test_pulse(width, false) + MIN_TACKT;
+      sweep_raw[width - MIN_TACKT] = test_pulse(width, false);
+      uint32_t measured = sweep_raw[width - MIN_TACKT] + MIN_TACKT;
       int32_t diff = (int32_t)measured - (int32_t)width;
 
       // Only output values that don't match expectations
@@ -188,6 +346,8 @@ void process_command(const char *input) {
       printf("\nFound %d values with discrepancies\n", discrepancyCount);
     }
 
+    store_calibration(sweep_raw, MIN_TACKT, TU_ARRAY_SIZE(sweep_raw));
+
     printf("\n=========== Test completed ===========\n");
   } else {
     char *endptr;
@@ -199,7 +359,8 @@ void process_command(const char *input) {
       printf("Set pause: %-3d | Measured pause: %-3d cycles\n\n", width,
              measured);
     } else {
-      printf("Please enter a value from 0 to 1500, or 'T' to run all tests.\n");
+      printf("Please enter a value from 0 to 1500, 'T' to run all tests, or "
+             "'S [N]' for a streaming sweep.\n");
     }
   }
 }
@@ -223,6 +384,7 @@ int main() {
 
   init_pulse_generator();
   init_pulse_detector();
+  init_sweep_dma();
 
   char input[64];
   size_t input_pos = 0;
@@ -2,6 +2,7 @@
 
 #include "hardware/clocks.h"
 #include "hardware/pio.h"
+#include "hardware/sync.h"
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
 #include "pico/time.h"
@@ -9,8 +10,8 @@
 #include <cstdint>
 #include <stdio.h>
 
-// Include generated header files with PIO programs
-#include "ppm.pio.h"
+#include "ppm_link.h"
+#include "ppm_realtime.h"
 
 #define PULSE_GEN_PIN 0
 #define PULSE_DET_PIN 1
@@ -23,7 +24,10 @@
 // Command codes for multicore FIFO
 #define CMD_TEST_PULSE 1
 #define CMD_STOP 2
-#define CMD_READ_MEASUREMENT 3
+#define CMD_JITTER_TEST 4
+
+#define JITTER_ITERATIONS 100000
+#define MEASUREMENT_TIMEOUT_US 1000 // Capture published after a pulse, the longest pause is ~25 us
 
 // Structure for transferring commands between cores
 typedef struct {
@@ -36,9 +40,48 @@ typedef struct {
 typedef struct {
     uint32_t measured_width;
     bool success;
-    uint32_t timestamp;  // Measurement timestamp
+    uint32_t timestamp;  // Measurement timestamp, us
 } core_result_t;
 
+// Latest measurement, published by Core0 under a sequence lock and read by Core1
+// without a round trip: seq is odd while Core0 updates the fields, a reader that saw it
+// odd or changed retries
+typedef struct {
+    volatile uint32_t seq;
+    volatile uint32_t count;  // Measurements since boot
+    volatile uint32_t measured_width;
+    volatile uint32_t timestamp;
+} measurement_seqlock_t;
+
+extern measurement_seqlock_t shared_measurement;
+
+// Core0 only
+static inline void measurement_publish(uint32_t measured_width, uint32_t timestamp) {
+    uint32_t seq = shared_measurement.seq;
+    shared_measurement.seq = seq + 1;
+    __dmb();  // Odd sequence before the fields
+    shared_measurement.count = shared_measurement.count + 1;
+    shared_measurement.measured_width = measured_width;
+    shared_measurement.timestamp = timestamp;
+    __dmb();  // Fields before the even sequence
+    shared_measurement.seq = seq + 2;
+}
+
+// Consistent snapshot of the latest measurement, returns its count (0: none yet)
+static inline uint32_t measurement_read(core_result_t *result) {
+    uint32_t seq, count;
+    do {
+        seq = shared_measurement.seq;
+        __dmb();
+        count = shared_measurement.count;
+        result->measured_width = shared_measurement.measured_width;
+        result->timestamp = shared_measurement.timestamp;
+        __dmb();
+    } while ((seq & 1u) || seq != shared_measurement.seq);
+    result->success = count != 0;
+    return count;
+}
+
 // Main function signatures
 void first_core_main();  // Function for Core0 (receiver)
 void second_core_main(); // Function for Core1 (transmitter + interface)
\ No newline at end of file
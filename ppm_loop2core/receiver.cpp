@@ -1,31 +1,17 @@
 #include "common.h"
 #include <pico/stdlib.h>
-#include <cstring>  // For memcpy function
 
-static PIO pio = pio0;
+static PIO const pio = pio0;
 static uint sm_det;
 static volatile bool detector_running = false;
-static volatile core_result_t last_measurement = {0, false, 0};
-static volatile bool new_measurement_available = false;
+measurement_seqlock_t shared_measurement PPM_RT_CORE0_DATA = {0, 0, 0, 0};
 
-// Initialize PIO for pulse detector
+// Initialize PIO for pulse detector, undivided
 void init_pulse_detector() {
   sm_det = pio_claim_unused_sm(pio, true);
-
-  // Load program
-  uint offset = pio_add_program(pio, &pulse_detector_program);
-
-  // Configure state machine
-  pio_sm_config c = pulse_detector_program_get_default_config(offset);
-
-  // Setup pins
-  sm_config_set_in_pins(&c, PULSE_DET_PIN);
-  sm_config_set_jmp_pin(&c, PULSE_DET_PIN);
-  pio_gpio_init(pio, PULSE_DET_PIN);
-  pio_sm_set_consecutive_pindirs(pio, sm_det, PULSE_DET_PIN, 1, false);
-
-  // Initialize state machine
-  pio_sm_init(pio, sm_det, offset, &c);
+  uint offset = ppm_link_load(pio, PPM_LINK_DETECTOR);
+  ppm_link_init(pio, sm_det, PPM_LINK_DETECTOR, offset, PULSE_DET_PIN,
+                SYS_FREQ * 1000, false);
 }
 
 // Function to start the detector in continuous reception mode
@@ -39,38 +25,25 @@ void start_detector() {
 }
 
 // Function for checking and updating measurement data
-void update_measurements() {
-  if (detector_running && !pio_sm_is_rx_fifo_empty(pio, sm_det)) {
-    // Get new measurement
-    uint32_t measured_width = pio_sm_get(pio, sm_det);
-    
-    // Update measurement data
-    last_measurement.measured_width = measured_width;
-    last_measurement.success = true;
-    last_measurement.timestamp = to_ms_since_boot(get_absolute_time());
-    
-    // Set flag for new measurement availability
-    new_measurement_available = true;
+void PPM_RT_FUNC(update_measurements)() {
+  if (detector_running && !ppm_link_rx_empty(pio, sm_det)) {
+    // Publish every capture, Core1 picks it up when it wants it
+    measurement_publish(ppm_link_get(pio, sm_det), time_us_32());
   }
 }
 
 // Process commands from Core1
-void process_core1_command() {
+void PPM_RT_FUNC(process_core1_command)() {
   if (multicore_fifo_rvalid()) {
     uint32_t cmd_ptr = multicore_fifo_pop_blocking();
     core_command_t* cmd = (core_command_t*)cmd_ptr;
     
     switch (cmd->command) {
-      case CMD_READ_MEASUREMENT: {
-        // Create a static copy of the last measurement
-        static core_result_t result_copy;
-        memcpy(&result_copy, (const void*)&last_measurement, sizeof(core_result_t));
-        
-        // Reset the new measurement flag
-        new_measurement_available = false;
-        
-        // Send the result back to Core1
-        multicore_fifo_push_blocking((uint32_t)&result_copy);
+      case CMD_JITTER_TEST: {
+        // Time the receive path while Core1 keeps the flash busy
+        static ppm_rt_jitter_t jitter;
+        ppm_rt_jitter_measure(update_measurements, JITTER_ITERATIONS, &jitter);
+        multicore_fifo_push_blocking((uint32_t)&jitter);
         break;
       }
       
@@ -83,6 +56,9 @@ void process_core1_command() {
 
 // Main function for Core0 (receiver)
 void first_core_main() {
+  // Let Core1 pause this core while it writes the calibration to flash
+  multicore_lockout_victim_init();
+
   // Initialize detector
   init_pulse_detector();
   
@@ -116,6 +92,9 @@ void first_core_main() {
 int main() {
   // Set clock frequency
   set_sys_clock_khz(SYS_FREQ, true);
+
+  // Core0 runs the receiver
+  ppm_rt_init(0);
   
   // Initialize standard components
   stdio_init_all();
@@ -1,47 +1,43 @@
 #include "common.h"
+#include "ppm_calibration.h"
 #include <bsp/board_api.h>
 #include <iostream>
 #include <string>
 #include <tusb.h>
 
-static PIO pio = pio1; // Use another PIO to avoid conflicts
+static PIO const pio = pio1; // Use another PIO to avoid conflicts
 static uint sm_gen;
 
-// Initialize PIO for pulse generator
+// Initialize PIO for pulse generator, undivided
 void init_pulse_generator() {
   sm_gen = pio_claim_unused_sm(pio, true);
-
-  // Load program
-  uint offset = pio_add_program(pio, &pulse_generator_program);
-
-  // Configure state machine
-  pio_sm_config c = pulse_generator_program_get_default_config(offset);
-
-  // Setup pins for PIO
-  sm_config_set_set_pins(&c, PULSE_GEN_PIN, 1);
-  pio_gpio_init(pio, PULSE_GEN_PIN);
-  pio_sm_set_consecutive_pindirs(pio, sm_gen, PULSE_GEN_PIN, 1, true);
-
-  // Frequency divider (default 1.0)
-  sm_config_set_clkdiv(&c, 1.0f);
-
-  // Initialize state machine
-  pio_sm_init(pio, sm_gen, offset, &c);
+  uint offset = ppm_link_load(pio, PPM_LINK_GENERATOR);
+  ppm_link_init(pio, sm_gen, PPM_LINK_GENERATOR, offset, PULSE_GEN_PIN,
+                SYS_FREQ * 1000, false);
 }
 
 // Function for pulse generation
 void generate_pulse(uint32_t pause_width, bool verbose) {
+  uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm_gen);
+
   // Clear FIFOs
   pio_sm_clear_fifos(pio, sm_gen);
 
   // Force set initial state
   gpio_put(PULSE_GEN_PIN, 0);
 
-  // Start generator
+  // Queue the pause duration, then start the generator: its next pull stalls once the
+  // pulse pair is out
+  ppm_link_put(pio, sm_gen, pause_width);
+  pio->fdebug = stall;
   pio_sm_set_enabled(pio, sm_gen, true);
 
-  // Send pause duration to generator
-  pio_sm_put_blocking(pio, sm_gen, pause_width);
+  while (!(pio->fdebug & stall))
+    tight_loop_contents();
+
+  // Stop state machine
+  pio_sm_set_enabled(pio, sm_gen, false);
+  pio_sm_restart(pio, sm_gen);
 
   if (verbose) {
     tud_cdc_write_str("Pulse generated with pause width: ");
@@ -49,50 +45,82 @@ void generate_pulse(uint32_t pause_width, bool verbose) {
     tud_cdc_write_str(" cycles\r\n");
     tud_cdc_write_flush();
   }
+}
 
-  //   Give time for pulse generation
-  sleep_ms(1);
+// Send one pause and wait for Core0 to publish its capture. No request to Core0, no
+// sleep: a sweep runs at the pulse rate.
+core_result_t measure_pulse(uint32_t pause_width, bool verbose) {
+  core_result_t result;
+  uint32_t seen = measurement_read(&result);
 
-  // Stop state machine
-  pio_sm_set_enabled(pio, sm_gen, false);
-  pio_sm_restart(pio, sm_gen);
+  generate_pulse(pause_width, verbose);
+
+  uint32_t start = time_us_32();
+  while (measurement_read(&result) == seen) {
+    if (time_us_32() - start > MEASUREMENT_TIMEOUT_US) {
+      printf("Timeout waiting for measurement\n");
+      result.success = false;
+      return result;
+    }
+  }
+  return result;
 }
 
-// Function to request the last measurement from Core0
-core_result_t get_last_measurement() {
-  // Use static variable for command
-  static core_command_t cmd = {CMD_READ_MEASUREMENT, 0, false};
+// Save the sweep as the calibration profile for the current clock
+void store_calibration(const uint32_t *raw, uint32_t first_width,
+                       uint32_t n_widths) {
+  static ppm_cal_profile_t profile;
+  uint32_t sys_khz = clock_get_hz(clk_sys) / 1000;
 
-  // Send command to Core0
-  multicore_fifo_push_blocking((uint32_t)&cmd);
+  if (!ppm_cal_build(&profile, sys_khz, raw, first_width, n_widths)) {
+    printf("No pulses captured, calibration not saved\n");
+  } else if (ppm_cal_store(&profile)) {
+    printf("Calibration for %lu kHz saved to flash\n", sys_khz);
+  } else {
+    printf("Failed to write calibration to flash\n");
+  }
+}
 
-  // Add timeout to prevent hanging
-  absolute_time_t timeout = make_timeout_time_ms(100);
+// Time Core0's receive path while this core evicts the XIP cache, compare builds with
+// PPM_REALTIME off and on
+void jitter_test() {
+  static core_command_t cmd = {CMD_JITTER_TEST, 0, false};
 
-  // Wait for response with timeout
-  static core_result_t empty_result = {0, false, 0};
+  printf("\n===== Jitter test: %d receiver polls, flash busy on Core1 =====\n",
+         JITTER_ITERATIONS);
+#ifdef PPM_REALTIME
+  printf("Build: PPM_REALTIME on (receiver in SRAM, bus priority)\n\n");
+#else
+  printf("Build: PPM_REALTIME off (receiver in flash)\n\n");
+#endif
 
+  multicore_fifo_push_blocking((uint32_t)&cmd);
   while (!multicore_fifo_rvalid()) {
-    if (absolute_time_diff_us(get_absolute_time(), timeout) <= 0) {
-      printf("Timeout waiting for measurement\n");
-      return empty_result;
+    ppm_rt_flash_thrash();
+  }
+  const ppm_rt_jitter_t *jitter =
+      (const ppm_rt_jitter_t *)multicore_fifo_pop_blocking();
+
+  printf("Cycles per poll: min %lu, mean %lu, max %lu, spread %lu\n\n",
+         jitter->min, jitter->mean, jitter->max, jitter->max - jitter->min);
+  printf("| %12s | %8s |\n", "Cycles", "Polls");
+  printf("|--------------|----------|\n");
+  for (int bin = 0; bin < PPM_RT_JITTER_BINS; bin++) {
+    if (bin < PPM_RT_JITTER_BINS - 1) {
+      printf("| %5s < %4d | %8lu |\n", "", 64 << bin, jitter->hist[bin]);
+    } else {
+      printf("| %5s >=%4d | %8lu |\n", "", 64 << (bin - 1), jitter->hist[bin]);
     }
-    sleep_ms(1);
   }
 
-  // Get response from Core0
-  core_result_t *result = (core_result_t *)multicore_fifo_pop_blocking();
-
-  // Copy result to static variable
-  static core_result_t safe_result;
-  memcpy(&safe_result, result, sizeof(core_result_t));
-
-  return safe_result;
+  printf("\n=========== Test completed ===========\n");
 }
 
 // Function for processing user commands
 void process_command(const char *input) {
-  if (input[0] == 'T' || input[0] == 't') {
+  if (input[0] == 'J' || input[0] == 'j') {
+    jitter_test();
+  } else if (input[0] == 'T' || input[0] == 't') {
     printf("\n===== Starting pause duration tests (%d-1500 cycles) =====\n\n",
            MIN_TACKT);
     printf("Note: Values from 0 to %d are not measured due to hardware "
@@ -103,12 +131,14 @@ void process_command(const char *input) {
 
     int discrepancyCount = 0;
 
+    // Raw detector counts per width, turned into the calibration table afterwards
+    static uint32_t sweep_raw[1500 + 1 - MIN_TACKT];
+
     // Test all values from 0 to 1500
     for (uint32_t width = MIN_TACKT; width <= 1500; width++) {
       // Генерируем импульс с заданной шириной
-      generate_pulse(width, false);
-
-      core_result_t result = get_last_measurement();
+      core_result_t result = measure_pulse(width, false);
+      sweep_raw[width - MIN_TACKT] = result.success ? result.measured_width : 0;
 
       if (result.success) {
         uint32_t measured = result.measured_width + MIN_TACKT;
@@ -133,6 +163,8 @@ void process_command(const char *input) {
       printf("\nFound %d values with discrepancies\n", discrepancyCount);
     }
 
+    store_calibration(sweep_raw, MIN_TACKT, TU_ARRAY_SIZE(sweep_raw));
+
     printf("\n=========== Test completed ===========\n");
   } else {
     char *endptr;
@@ -140,9 +172,7 @@ void process_command(const char *input) {
     if (endptr != input && width >= 0 && width <= 1500) {
       printf("\n--- Single test with pause: %d cycles ---\n", width);
 
-      generate_pulse(static_cast<uint32_t>(width), true);
-
-      core_result_t result = get_last_measurement();
+      core_result_t result = measure_pulse(static_cast<uint32_t>(width), true);
 
       if (result.success) {
         uint32_t measured = result.measured_width + MIN_TACKT;
@@ -152,7 +182,8 @@ void process_command(const char *input) {
         printf("Measurement failed\n\n");
       }
     } else {
-      printf("Please enter a value from 0 to 1500, or 'T' to run all tests.\n");
+      printf("Please enter a value from 0 to 1500, 'T' to run all tests or "
+             "'J' for the jitter test.\n");
     }
   }
 }
@@ -203,8 +234,9 @@ void second_core_main() {
         tud_cdc_write_str(" Hz\r\n");
         tud_cdc_write_str(
             "Core0: Receiver (always running), Core1: Transmitter + UI\r\n");
-        tud_cdc_write_str("Enter a value from 0 to 1500 for pulse width, or "
-                          "'T' to test all values.\r\n");
+        tud_cdc_write_str("Enter a value from 0 to 1500 for pulse width, "
+                          "'T' to test all values or 'J' for the jitter "
+                          "test.\r\n");
         tud_cdc_write_flush();
         was_connected = true;
       }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/pio.h"
 #include "pico/multicore.h"
 #include "pico/stdlib.h"
@@ -12,8 +13,10 @@
 #include "hardware/structs/timer.h"
 #include "hardware/timer.h"
 
-// Include generated header files with PIO programs
-#include "ppm.pio.h"
+#include "ppm_calibration.h"
+#include "ppm_link.h"
+#include "ppm_realtime.h"
+#include "spsc_ring.h"
 
 #define PULSE_GEN_PIN 0
 #define PULSE_DET_PIN 1
@@ -33,12 +36,40 @@
 #define MIN_PULSE_PERIOD 3.0f
 
 static constexpr float    MIN_PULSE_PERIOD_US = MIN_PULSE_PERIOD / 2;
-static constexpr float    PIO_FREQ            = SYS_FREQ * 1000.0f;
+static constexpr uint32_t PIO_FREQ            = SYS_FREQ * 1000u;
 static constexpr uint16_t MIN_INTERVAL_CYCLES =
-    MIN_PULSE_PERIOD_US * (SYS_FREQ / 1000);
+    MIN_PULSE_PERIOD_US * (SYS_FREQ / 1000) - PPM_LINK_PULSE_COUNTS;    // The pulses take the rest
 
 #define AUDIO_SAMPLE_RATE 48000
 
+// DMA receive ring, a ppm_link capture ring of raw pulse_detector counts read by update_measurements
+#define RX_DMA_RING_BITS 10    // 1024 words = 4 KB
+#define RX_DMA_RING_SIZE (1u << RX_DMA_RING_BITS)
+
+// Received widths, Core0 -> Core1: two words per capture, the time Core0 decoded it (us)
+// and the corrected width. The DMA keeps no capture time, the decode time trails the pulse
+// by up to the capture ring's backlog.
+#define WIDTH_RING_BITS 12    // 2048 captures, ~40 ms at 48 kHz
+#define WIDTH_RING_SIZE (1u << WIDTH_RING_BITS)
+
+extern spsc_ring_t width_ring;
+
+// Binary stream ('B' on the terminal, 'A' back to text), decoded by ppm_stream.py. Every
+// frame is one full 64 byte CDC packet, little endian:
+//   0  sync STREAM_SYNC_0, STREAM_SYNC_1
+//   2  u8  frame sequence number
+//   3  u8  records used, 1..STREAM_RECORDS
+//   4  u32 decode time of the first record, us
+//   8  STREAM_RECORDS x {u16 width (0xFFFF: out of range), u16 decode us since the record before}
+//   60 u16 captures lost in front of this frame (saturating)
+//   62 u8  0
+//   63 u8  sum of bytes 2..62
+#define STREAM_SYNC_0      0xC3
+#define STREAM_SYNC_1      0x3C
+#define STREAM_FRAME_BYTES 64
+#define STREAM_RECORDS     13
+#define STREAM_FLUSH_US    2000    // A partial frame goes out after this long
+
 // Main function signatures
 void first_core_main();     // Function for Core0 (receiver)
 void second_core_main();    // Function for Core1 (transmitter + interface)
\ No newline at end of file
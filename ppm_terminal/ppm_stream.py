@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Reader for the binary width stream of ppm_terminal ('B' on the terminal)
+
+Switches the firmware to binary mode on its CDC port, or reads a capture file,
+and prints one line per received width:
+
+    decoded_s  width
+
+or writes them to a CSV file. decoded_s is when the receiver core took the
+width out of its capture ring, which trails the pulse by up to the ring's
+backlog: the DMA that captures stores no time. Captures the firmware lost (full ring, full CDC
+FIFO) and frames lost on the way (sequence gaps) are reported on stderr. The
+frame format is described in common.h.
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "ppm_common"))
+from ppm_trace import Clock, Tee  # Shared with the trace decoder
+
+SYNC = b"\xc3\x3c"
+FRAME_BYTES = 64
+RECORDS = 13
+WIDTH_OUT_OF_RANGE = 0xFFFF
+
+
+def frames(stream, follow):
+    """Yield (seq, time0, records, lost) for every frame with a valid checksum"""
+    buffer = b""
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            if follow:
+                continue  # Serial read timed out, the port stays open
+            return
+        buffer += chunk
+
+        while True:
+            start = buffer.find(SYNC)
+            if start < 0:
+                buffer = buffer[-1:]
+                break
+            if len(buffer) - start < FRAME_BYTES:
+                buffer = buffer[start:]
+                break
+
+            frame = buffer[start : start + FRAME_BYTES]
+            if sum(frame[2:-1]) & 0xFF != frame[-1] or not 0 < frame[3] <= RECORDS:
+                # Not a frame after all (text output before the switch), look for the next sync
+                buffer = buffer[start + 1 :]
+                continue
+
+            buffer = buffer[start + FRAME_BYTES :]
+            seq, count, time0 = struct.unpack("<BBI", frame[2:8])
+            records = struct.unpack(f"<{2 * count}H", frame[8 : 8 + 4 * count])
+            (lost,) = struct.unpack("<H", frame[60:62])
+            yield seq, time0, list(zip(records[0::2], records[1::2])), lost
+
+
+def open_source(source):
+    """Returns the stream and whether to keep reading at its end"""
+    if os.path.isfile(source):
+        return open(source, "rb"), False
+
+    import serial  # pyserial
+
+    port = serial.Serial(source, timeout=0.1)  # USB CDC, the baud rate does not matter
+    port.write(b"B\r")
+    return port, True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read the ppm_terminal binary width stream")
+    parser.add_argument("source", help="Serial port (e.g. /dev/ttyACM0, COM3) or capture file")
+    parser.add_argument("--csv", metavar="FILE", help="Write decoded_s,width rows to FILE instead of printing")
+    parser.add_argument("--raw", metavar="FILE", help="Also save the undecoded bytes to FILE")
+    args = parser.parse_args()
+
+    clock = Clock()
+    stream, follow = open_source(args.source)
+    raw = open(args.raw, "wb") if args.raw else None
+    out = open(args.csv, "w", newline="") if args.csv else None
+    writer = csv.writer(out) if out else None
+    if writer:
+        writer.writerow(["decoded_s", "width"])
+
+    expected = None
+    widths = lost_captures = lost_frames = 0
+    source = Tee(stream, raw) if raw else stream
+
+    try:
+        for seq, time0, records, lost in frames(source, follow):
+            if expected is not None and seq != expected:
+                gap = (seq - expected) & 0xFF
+                lost_frames += gap
+                print(f"# {gap} frame(s) missing before seq {seq}", file=sys.stderr)
+            expected = (seq + 1) & 0xFF
+            if lost:
+                lost_captures += lost
+                print(f"# {lost} capture(s) lost by the firmware", file=sys.stderr)
+
+            time = time0
+            for width, dt in records:
+                time += dt
+                seconds = clock.seconds(time & 0xFFFFFFFF)
+                value = "" if width == WIDTH_OUT_OF_RANGE else width
+                widths += 1
+                if writer:
+                    writer.writerow([f"{seconds:.6f}", value])
+                else:
+                    print(f"{seconds:12.6f}  {value}")
+            if not writer:
+                sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if follow:
+            stream.write(b"A\r")  # Back to text mode
+        if raw:
+            raw.close()
+        if out:
+            out.close()
+        print(f"# {widths} widths, {lost_captures} captures lost, {lost_frames} frames missing", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
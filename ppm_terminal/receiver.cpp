@@ -1,42 +1,67 @@
 #include "common.h"
 #include <pico/stdlib.h>
 
-static PIO           pio = pio0;
+static PIO const     pio = pio0;
 static uint          sm_det;
 static volatile bool detector_running = false;
 
-void update_measurements() {
+// Captures are streamed by DMA from the detector RX FIFO into this ring
+static uint32_t           rx_dma_ring[RX_DMA_RING_SIZE] __attribute__((aligned(RX_DMA_RING_SIZE * sizeof(uint32_t))));
+static ppm_link_capture_t rx_capture;
+static uint32_t           rx_overruns = 0;    // Captures overwritten before update_measurements got to them
 
-    while (detector_running && !pio_sm_is_rx_fifo_empty(pio, sm_det)) {
-        uint32_t measured_width = pio_sm_get(pio, sm_det);
+spsc_ring_t     width_ring;
+static uint32_t width_ring_buf[WIDTH_RING_SIZE];
 
-        uint32_t corrected_width = (measured_width + MIN_TACKT) - MIN_INTERVAL_CYCLES;
+// Raw count -> pause width offsets from the 'T' sweep, MIN_TACKT everywhere if uncalibrated
+static int8_t rx_cal[PPM_CAL_WIDTHS] PPM_RT_CORE0_DATA;
+static bool   rx_calibrated = false;
+
+void PPM_RT_FUNC(update_measurements)() {
+    if (!detector_running) {
+        return;
+    }
+
+    uint32_t written = ppm_link_capture_written(&rx_capture);
+
+    // Consumer fell a whole ring behind, skip to the oldest capture still intact
+    rx_overruns += ppm_link_capture_skip(&rx_capture, written);
+
+    while (rx_capture.consumed != written) {
+        uint32_t measured_width  = ppm_link_capture_at(&rx_capture, rx_capture.consumed);
+        uint32_t corrected_width = ppm_cal_correct(rx_cal, measured_width, MIN_TACKT) - MIN_INTERVAL_CYCLES;
+        rx_capture.consumed++;
 
         if (corrected_width > 0) {
-            if (multicore_fifo_wready()) {
-                multicore_fifo_push_blocking(corrected_width);
-            }
+            // Both words or none, a full ring counts the capture as lost
+            uint32_t record[2] = {timer_hw->timerawl, corrected_width};
+            if (spsc_ring_space(&width_ring) >= 2)
+                spsc_ring_push(&width_ring, record, 2);
+            else
+                width_ring.overflows = width_ring.overflows + 2;
         }
     }
-}
 
-// Initialize PIO for pulse detector
-void init_pulse_detector(float freq) {
-    sm_det               = pio_claim_unused_sm(pio, true);
-    uint          offset = pio_add_program(pio, &pulse_detector_program);
-    pio_sm_config c      = pulse_detector_program_get_default_config(offset);
+    // Transfer count ran out (~24 h at 48 kHz); the detector FIFO holds captures meanwhile
+    if (ppm_link_capture_done(&rx_capture)) {
+        ppm_link_capture_arm(&rx_capture, true);
+    }
+}
 
-    sm_config_set_in_pins(&c, PULSE_DET_PIN);
-    sm_config_set_jmp_pin(&c, PULSE_DET_PIN);
-    pio_gpio_init(pio, PULSE_DET_PIN);
-    pio_sm_set_consecutive_pindirs(pio, sm_det, PULSE_DET_PIN, 1, false);
+void init_rx_dma() {
+    ppm_link_capture_init(&rx_capture, pio, sm_det, rx_dma_ring, RX_DMA_RING_BITS);
+}
 
-    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / freq);
-    pio_sm_init(pio, sm_det, offset, &c);
+// Initialize PIO for pulse detector, RX only, DMA drains it
+void init_pulse_detector(uint32_t pio_hz) {
+    sm_det      = pio_claim_unused_sm(pio, true);
+    uint offset = ppm_link_load(pio, PPM_LINK_DETECTOR);
+    ppm_link_init(pio, sm_det, PPM_LINK_DETECTOR, offset, PULSE_DET_PIN, pio_hz, true);
 }
 
 void start_detector() {
     pio_sm_clear_fifos(pio, sm_det);
+    ppm_link_capture_arm(&rx_capture, true);
     pio_sm_set_enabled(pio, sm_det, true);
     detector_running = true;
 }
@@ -44,6 +69,8 @@ void start_detector() {
 // Main function for Core0 (receiver)
 void first_core_main() {
     init_pulse_detector(PIO_FREQ);
+    init_rx_dma();
+    rx_calibrated = ppm_cal_load(clock_get_hz(clk_sys) / 1000, rx_cal, MIN_TACKT);
     start_detector();
 
     bool led_state = false;
@@ -64,9 +91,12 @@ void first_core_main() {
 
 int main() {
     set_sys_clock_khz(SYS_FREQ, true);
+    ppm_rt_init(0);    // Core0 runs the receiver and holds its PPM_RT_CORE0_DATA tables
     gpio_init(LED_PIN);
     gpio_set_dir(LED_PIN, GPIO_OUT);
 
+    spsc_ring_init(&width_ring, width_ring_buf, WIDTH_RING_SIZE);
+
     multicore_reset_core1();
     sleep_ms(100);
     multicore_launch_core1(second_core_main);
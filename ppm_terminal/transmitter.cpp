@@ -1,24 +1,38 @@
 #include "common.h"
 #include <bsp/board_api.h>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <tusb.h>
 
-static PIO  pio = pio1;    // Use another PIO to avoid conflicts
-static uint sm_gen;
+static PIO const pio = pio1;    // Use another PIO to avoid conflicts
+static uint      sm_gen;
 
-static volatile uint32_t ppm_code_to_send = 0;
-static volatile bool     has_custom_value = false;
+static volatile uint32_t ppm_code_to_send PPM_RT_CORE1_DATA = 0;
+static volatile bool     has_custom_value PPM_RT_CORE1_DATA = false;
 
 uint32_t          current_sample_rate = AUDIO_SAMPLE_RATE;
-volatile uint32_t audio_frame_ticks;
+volatile uint32_t audio_frame_ticks;    // Whole us per frame
+volatile uint32_t audio_frame_rem;      // 1000000 % current_sample_rate, carried over by the timer interrupt
+
+static uint32_t audio_frame_phase PPM_RT_CORE1_DATA = 0;    // Carried remainder, below current_sample_rate
+static uint32_t audio_frame_due PPM_RT_CORE1_DATA   = 0;    // Alarm time of the next frame, us
 // volatile  uint32_t audio_frame_ticks = (SYS_FREQ * 1000) / AUDIO_SAMPLE_RATE;
 
-void generate_pulse(uint32_t pause_width, bool verbose) {
-    pio_sm_put_blocking(pio, sm_gen, pause_width);
+// Binary stream state, see common.h
+static bool     stream_binary = false;
+static uint8_t  stream_frame[STREAM_FRAME_BYTES];
+static uint32_t stream_records = 0;    // Records in stream_frame
+static uint32_t stream_last    = 0;    // Decode time of the last record, us
+static uint8_t  stream_seq     = 0;
+static uint32_t stream_lost    = 0;    // Captures lost since the last frame went out
+static uint32_t stream_seen    = 0;    // width_ring.overflows already counted
+
+void PPM_RT_FUNC(generate_pulse)(uint32_t pause_width, bool verbose) {
+    ppm_link_put_blocking(pio, sm_gen, pause_width);
 }
 
-void timer0_irq_handler() {
+void PPM_RT_FUNC(timer0_irq_handler)() {
     if (timer_hw->intr & (1u << 0)) {
         timer_hw->intr = 1u << 0;
 
@@ -33,29 +47,42 @@ void timer0_irq_handler() {
 
         generate_pulse(ppm_value, false);
 
-        timer_hw->alarm[0] = timer_hw->timerawl + audio_frame_ticks;
+        // Frames are 1000000 / rate us apart on average, not in whole us: 20.83 us at 48 kHz
+        uint32_t ticks = audio_frame_ticks;
+        audio_frame_phase += audio_frame_rem;
+        if (audio_frame_phase >= current_sample_rate) {
+            audio_frame_phase -= current_sample_rate;
+            ticks++;
+        }
+        audio_frame_due += ticks;
+
+        // A missed alarm would only fire after the timer wrapped, start over from now
+        if ((int32_t)(audio_frame_due - timer_hw->timerawl) <= 0)
+            audio_frame_due = timer_hw->timerawl + ticks;
+        timer_hw->alarm[0] = audio_frame_due;
     }
 }
 
 // Initialize PIO for pulse generator
-void init_pulse_generator(float freq) {
-    sm_gen               = pio_claim_unused_sm(pio, true);
-    uint          offset = pio_add_program(pio, &pulse_generator_program);
-    pio_sm_config c      = pulse_generator_program_get_default_config(offset);
-
-    // Setup pins for PIO
-    sm_config_set_set_pins(&c, PULSE_GEN_PIN, 1);
-    pio_gpio_init(pio, PULSE_GEN_PIN);
-    pio_sm_set_consecutive_pindirs(pio, sm_gen, PULSE_GEN_PIN, 1, true);
-
-    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / freq);
-
-    pio_sm_init(pio, sm_gen, offset, &c);
+void init_pulse_generator(uint32_t pio_hz) {
+    sm_gen      = pio_claim_unused_sm(pio, true);
+    uint offset = ppm_link_load(pio, PPM_LINK_GENERATOR);
+    ppm_link_init(pio, sm_gen, PPM_LINK_GENERATOR, offset, PULSE_GEN_PIN, pio_hz, false);
     pio_sm_set_enabled(pio, sm_gen, true);
 }
 
 // Function for processing user commands
 void process_command(const char *input) {
+    if (strcmp(input, "B") == 0 || strcmp(input, "b") == 0) {
+        stream_binary  = true;
+        stream_records = 0;
+        return;
+    }
+    if (strcmp(input, "A") == 0 || strcmp(input, "a") == 0) {
+        stream_binary = false;
+        return;
+    }
+
     char *endptr;
     int   value = strtol(input, &endptr, 10);
 
@@ -79,20 +106,89 @@ void process_command(const char *input) {
     }
 }
 
+// Close the frame and queue it, a frame the CDC FIFO has no room for is counted as lost
+static void stream_send(void) {
+    uint32_t lost = stream_lost > 0xFFFF ? 0xFFFF : stream_lost;
+    uint8_t  sum  = 0;
+
+    stream_frame[0] = STREAM_SYNC_0;
+    stream_frame[1] = STREAM_SYNC_1;
+    stream_frame[2] = stream_seq;
+    stream_frame[3] = (uint8_t)stream_records;
+    memset(&stream_frame[8 + 4 * stream_records], 0, 4 * (STREAM_RECORDS - stream_records));
+    stream_frame[60] = (uint8_t)lost;
+    stream_frame[61] = (uint8_t)(lost >> 8);
+    stream_frame[62] = 0;
+    for (uint32_t i = 2; i < STREAM_FRAME_BYTES - 1; i++) {
+        sum += stream_frame[i];
+    }
+    stream_frame[63] = sum;
+
+    if (tud_cdc_write_available() >= STREAM_FRAME_BYTES) {
+        tud_cdc_write(stream_frame, STREAM_FRAME_BYTES);    // A full packet, sent without a flush
+        stream_seq++;
+        stream_lost = 0;
+    }
+    else {
+        stream_lost += stream_records;
+    }
+    stream_records = 0;
+}
+
+static void stream_add(uint32_t decoded, uint32_t width) {
+    uint8_t *record = &stream_frame[8 + 4 * stream_records];
+    uint32_t dt     = stream_records == 0 ? 0 : decoded - stream_last;
+
+    if (stream_records == 0) {
+        stream_frame[4] = (uint8_t)decoded;
+        stream_frame[5] = (uint8_t)(decoded >> 8);
+        stream_frame[6] = (uint8_t)(decoded >> 16);
+        stream_frame[7] = (uint8_t)(decoded >> 24);
+    }
+    if (width > 0xFFFF)
+        width = 0xFFFF;
+    if (dt > 0xFFFF)
+        dt = 0xFFFF;
+    record[0]   = (uint8_t)width;
+    record[1]   = (uint8_t)(width >> 8);
+    record[2]   = (uint8_t)dt;
+    record[3]   = (uint8_t)(dt >> 8);
+    stream_last = decoded;
+
+    if (++stream_records == STREAM_RECORDS)
+        stream_send();
+}
+
 void process_received_measurements() {
-    while (multicore_fifo_rvalid()) {
-        uint32_t measured_width = multicore_fifo_pop_blocking();
+    uint32_t record[2];
 
-        char debug_msg[128];
-        snprintf(debug_msg, sizeof(debug_msg), "Width: %u\r\n", measured_width);
+    // Captures Core0 could not queue
+    uint32_t overflows = width_ring.overflows;
+    stream_lost += (overflows - stream_seen) / 2;
+    stream_seen = overflows;
 
-        if (tud_cdc_connected()) {
+    while (spsc_ring_count(&width_ring) >= 2) {
+        spsc_ring_pop(&width_ring, record, 2);
+        if (!tud_cdc_connected())
+            continue;
+
+        if (stream_binary) {
+            stream_add(record[0], record[1]);
+        }
+        else {
+            char debug_msg[128];
+            snprintf(debug_msg, sizeof(debug_msg), "Width: %u\r\n", record[1]);
             tud_cdc_write_str(debug_msg);
             tud_cdc_write_flush();
         }
     }
+
+    // Slow link: do not hold a partial frame for long
+    if (stream_binary && stream_records > 0 && timer_hw->timerawl - stream_last > STREAM_FLUSH_US)
+        stream_send();
 }
 
+// Whole part only, the timer interrupt adds the remainder up (audio_frame_rem)
 uint32_t calculate_audio_frame_ticks() {
     // return (uint32_t)clock_get_hz(clk_sys) / current_sample_rate / 100;
     return 1000000 / current_sample_rate;
@@ -119,11 +215,13 @@ void second_core_main() {
     absolute_time_t next_led_toggle_time = make_timeout_time_ms(LED_TIME * 2);
 
     audio_frame_ticks = calculate_audio_frame_ticks();
+    audio_frame_rem   = 1000000 % current_sample_rate;
 
     irq_set_exclusive_handler(TIMER_IRQ_0, timer0_irq_handler);
     hw_set_bits(&timer_hw->inte, (1u << 0));
     irq_set_enabled(TIMER_IRQ_0, true);
-    timer_hw->alarm[0] = timer_hw->timerawl + audio_frame_ticks;
+    audio_frame_due    = timer_hw->timerawl + audio_frame_ticks;
+    timer_hw->alarm[0] = audio_frame_due;
 
     // Main operation loop on Core1
     while (1) {
@@ -143,11 +241,15 @@ void second_core_main() {
                 tud_cdc_write_str(" Hz\r\n");
                 tud_cdc_write_str("Frame Ticks: ");
                 tud_cdc_write_str(std::to_string(audio_frame_ticks).c_str());
-                tud_cdc_write_str("\r\n");
+                tud_cdc_write_str(" + ");
+                tud_cdc_write_str(std::to_string(audio_frame_rem).c_str());
+                tud_cdc_write_str("/");
+                tud_cdc_write_str(std::to_string(current_sample_rate).c_str());
+                tud_cdc_write_str(" us\r\n");
                 tud_cdc_write_str("Sample Rate: ");
                 tud_cdc_write_str(std::to_string(current_sample_rate).c_str());
                 tud_cdc_write_str(" Hz\r\n");
-                tud_cdc_write_str("Enter a value from 0 to 1024 to send via PPM.\r\n");
+                tud_cdc_write_str("Enter a value from 0 to 1024 to send via PPM, 'B' for the binary stream, 'A' to go back to text.\r\n");
                 tud_cdc_write_flush();
                 was_connected = true;
             }
@@ -156,14 +258,17 @@ void second_core_main() {
                 uint8_t  buf[64];
                 uint32_t count = tud_cdc_read(buf, sizeof(buf));
                 if (count > 0) {
-                    tud_cdc_write(buf, count);    // echo
-                    tud_cdc_write_flush();
+                    if (!stream_binary) {
+                        tud_cdc_write(buf, count);    // echo
+                        tud_cdc_write_flush();
+                    }
                     for (uint32_t i = 0; i < count; i++) {
                         char c = static_cast<char>(buf[i]);
                         if (c == '\r' || c == '\n') {
                             if (input_pos > 0) {
                                 input[input_pos] = '\0';
-                                tud_cdc_write_str("\r\n");
+                                if (!stream_binary)
+                                    tud_cdc_write_str("\r\n");
                                 process_command(input);
                                 input_pos = 0;
                             }
@@ -178,6 +283,8 @@ void second_core_main() {
         else {
             was_connected = false;
         }
-        sleep_ms(1);
+        // Keep the CDC endpoint busy while streaming
+        if (!stream_binary)
+            sleep_ms(1);
     }
 }
\ No newline at end of file
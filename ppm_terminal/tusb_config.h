@@ -28,8 +28,8 @@
 #define CFG_TUD_CDC             (2)
 // Set CDC FIFO buffer sizes
 #define CFG_TUD_CDC_RX_BUFSIZE  (64)
-#define CFG_TUD_CDC_TX_BUFSIZE  (64)
-#define CFG_TUD_CDC_EP_BUFSIZE  (64)
+#define CFG_TUD_CDC_TX_BUFSIZE  (2048)    // ~30 binary stream frames
+#define CFG_TUD_CDC_EP_BUFSIZE  (512)     // Several packets per transfer
 
 #ifndef CFG_TUD_ENDPOINT0_SIZE
 #define CFG_TUD_ENDPOINT0_SIZE  (64)